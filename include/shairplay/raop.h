@@ -22,11 +22,43 @@ extern "C" {
 #define RAOP_LOG_INFO        6       /* informational */
 #define RAOP_LOG_DEBUG       7       /* debug-level messages */
 
+/* RTSP methods with request latency statistics */
+#define RAOP_METHOD_OPTIONS        0
+#define RAOP_METHOD_ANNOUNCE       1
+#define RAOP_METHOD_SETUP          2
+#define RAOP_METHOD_RECORD         3
+#define RAOP_METHOD_PAUSE          4
+#define RAOP_METHOD_FLUSH          5
+#define RAOP_METHOD_TEARDOWN       6
+#define RAOP_METHOD_GET_PARAMETER  7
+#define RAOP_METHOD_SET_PARAMETER  8
+#define RAOP_METHOD_COUNT          9
+
+/* Bucket i counts requests handled in less than 2^i microseconds, */
+/* the last bucket counts all slower requests */
+#define RAOP_LATENCY_BUCKETS      24
+
 
 typedef struct raop_s raop_t;
 
 typedef void (*raop_log_callback_t)(void *cls, int level, const char *msg);
 
+/* ALACSpecificConfig of a stream as announced in its fmtp */
+struct raop_alac_config_s {
+	unsigned int frameLength;
+	unsigned char compatibleVersion;
+	unsigned char bitDepth;
+	unsigned char pb;
+	unsigned char mb;
+	unsigned char kb;
+	unsigned char numChannels;
+	unsigned short maxRun;
+	unsigned int maxFrameBytes;
+	unsigned int avgBitRate;
+	unsigned int sampleRate;
+};
+typedef struct raop_alac_config_s raop_alac_config_t;
+
 struct raop_callbacks_s {
 	void* cls;
 
@@ -40,17 +72,61 @@ struct raop_callbacks_s {
 	void  (*audio_set_volume)(void *cls, void *session, float volume);
 	void  (*audio_set_metadata)(void *cls, void *session, const void *buffer, int buflen);
 	void  (*audio_set_coverart)(void *cls, void *session, const void *buffer, int buflen);
+
+	/* Optional callbacks for sinks that decode ALAC themselves, if both are */
+	/* set and audio_passthrough returns nonzero for a new session, its frames */
+	/* are passed to audio_process_alac decrypted but not decoded */
+	int   (*audio_passthrough)(void *cls, void *session, const raop_alac_config_t *config);
+	void  (*audio_process_alac)(void *cls, void *session, const void *buffer, int buflen);
 };
 typedef struct raop_callbacks_s raop_callbacks_t;
 
+struct raop_send_stats_s {
+	unsigned long long bytes_sent;     /* bytes written to RTSP sockets */
+	unsigned long long bytes_queued;   /* bytes that waited for a full socket */
+	unsigned long long blocked_ms;     /* time connections waited for a full socket */
+	int blocked_connections;           /* connections waiting at the moment */
+	int max_queued;                    /* largest queue of a single connection */
+};
+typedef struct raop_send_stats_s raop_send_stats_t;
+
+struct raop_method_stats_s {
+	unsigned long long count;          /* requests handled */
+	unsigned long long total_us;       /* total handling time */
+	unsigned long long max_us;         /* slowest request */
+	unsigned long long buckets[RAOP_LATENCY_BUCKETS];
+};
+typedef struct raop_method_stats_s raop_method_stats_t;
+
+struct raop_key_cache_stats_s {
+	unsigned long long hits;           /* AES keys found in the cache */
+	unsigned long long misses;         /* AES keys that needed RSA decryption */
+};
+typedef struct raop_key_cache_stats_s raop_key_cache_stats_t;
+
+struct raop_memory_stats_s {
+	int sessions;                      /* connections with an audio session */
+	unsigned long long bytes;          /* memory held by the sessions now */
+	unsigned long long private_bytes;  /* same if each owned all its buffers */
+};
+typedef struct raop_memory_stats_s raop_memory_stats_t;
+
 RAOP_API raop_t *raop_init(int max_clients, raop_callbacks_t *callbacks, const char *pemkey, int *error);
 RAOP_API raop_t *raop_init_from_keyfile(int max_clients, raop_callbacks_t *callbacks, const char *keyfile, int *error);
 
 RAOP_API void raop_set_log_level(raop_t *raop, int level);
 RAOP_API void raop_set_log_callback(raop_t *raop, raop_log_callback_t callback, void *cls);
 
+/* Handle RTSP requests in a pool of worker threads, set before raop_start */
+/* With zero workers (the default) requests are handled in the server thread */
+RAOP_API int raop_set_request_workers(raop_t *raop, int workers);
+
 RAOP_API int raop_start(raop_t *raop, unsigned short *port, const char *hwaddr, int hwaddrlen, const char *password);
 RAOP_API int raop_is_running(raop_t *raop);
+RAOP_API void raop_get_send_stats(raop_t *raop, raop_send_stats_t *stats);
+RAOP_API int raop_get_method_stats(raop_t *raop, int method, raop_method_stats_t *stats);
+RAOP_API void raop_get_key_cache_stats(raop_t *raop, raop_key_cache_stats_t *stats);
+RAOP_API void raop_get_memory_stats(raop_t *raop, raop_memory_stats_t *stats);
 RAOP_API void raop_stop(raop_t *raop);
 
 RAOP_API void raop_destroy(raop_t *raop);
@@ -0,0 +1,343 @@
+/**
+ *  Copyright (C) 2012-2013  Juho Vähä-Herttua
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included
+ *  in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Decodes a dump of ALAC frames to raw PCM with a pool of threads. Every
+ * frame in the input is preceded by its length as a 32-bit big endian
+ * integer, that is how the frames of a decrypted RAOP stream are dumped. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef WIN32
+# include <windows.h>
+#else
+# include <time.h>
+#endif
+
+#include "lib/alac/alac.h"
+#include "lib/alac/alac_batch.h"
+
+#define DEFAULT_FMTP "96 352 0 16 40 10 14 2 255 0 0 44100"
+
+/* Keeps the bytes of a decoded frame well inside an int */
+#define MAX_FRAME_LENGTH 65536
+
+typedef struct {
+	char fmtp[128];
+	int threads;
+	int scaling;
+	const char *input;
+	const char *output;
+} alacdecode_options_t;
+
+typedef struct {
+	int frameLength;
+	int bitDepth;
+	int numChannels;
+	int sampleRate;
+	char decoder_info[48];
+} alacdecode_format_t;
+
+static double
+get_seconds(void)
+{
+#ifdef WIN32
+	return GetTickCount() / 1000.0;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+#endif
+}
+
+static int
+parse_fmtp(alacdecode_format_t *format, const char *fmtp)
+{
+	unsigned char *info = (unsigned char *) format->decoder_info;
+	int intarr[12];
+	int i;
+
+	/* Same fields as in raop_buffer, the first one is the payload type */
+	for (i=0; i<12; i++) {
+		char *end;
+
+		intarr[i] = strtol(fmtp, &end, 10);
+		if (end == fmtp) {
+			return -1;
+		}
+		fmtp = end;
+	}
+	if (intarr[1] <= 0 || intarr[1] > MAX_FRAME_LENGTH ||
+	    (intarr[3] != 16 && intarr[3] != 24) || (intarr[7] != 1 && intarr[7] != 2)) {
+		return -1;
+	}
+	format->frameLength = intarr[1];
+	format->bitDepth = intarr[3];
+	format->numChannels = intarr[7];
+	format->sampleRate = intarr[11];
+
+	memset(info, 0, sizeof(format->decoder_info));
+	info[24] = intarr[1] >> 24;
+	info[25] = intarr[1] >> 16;
+	info[26] = intarr[1] >> 8;
+	info[27] = intarr[1];
+	for (i=2; i<=7; i++) {
+		info[26+i] = intarr[i];
+	}
+	info[34] = intarr[8] >> 8;
+	info[35] = intarr[8];
+	for (i=9; i<=11; i++) {
+		info[4*i+0] = intarr[i] >> 24;
+		info[4*i+1] = intarr[i] >> 16;
+		info[4*i+2] = intarr[i] >> 8;
+		info[4*i+3] = intarr[i];
+	}
+	return 0;
+}
+
+static unsigned long
+get_uint32(const unsigned char *buf)
+{
+	return ((unsigned long) buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+}
+
+static unsigned char *
+read_frames(const char *path, int *frames, unsigned char ***inbuffers, int **inputsizes)
+{
+	unsigned char *data;
+	long size, pos;
+	FILE *fp;
+	int count;
+
+	fp = fopen(path, "rb");
+	if (!fp) {
+		return NULL;
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	data = malloc(size > 0 ? size : 1);
+	if (!data || fread(data, 1, size, fp) != (size_t) size) {
+		free(data);
+		fclose(fp);
+		return NULL;
+	}
+	fclose(fp);
+
+	/* Count the frames first, then index them */
+	for (count=0, pos=0; pos < size; count++) {
+		if (size-pos < 4 || get_uint32(data+pos) > (unsigned long) (size-pos-4)) {
+			free(data);
+			return NULL;
+		}
+		pos += 4 + get_uint32(data+pos);
+	}
+
+	*inbuffers = malloc(count * sizeof(unsigned char *) + 1);
+	*inputsizes = malloc(count * sizeof(int) + 1);
+	if (!*inbuffers || !*inputsizes) {
+		free(*inbuffers);
+		free(*inputsizes);
+		free(data);
+		return NULL;
+	}
+	for (count=0, pos=0; pos < size; count++) {
+		(*inputsizes)[count] = get_uint32(data+pos);
+		(*inbuffers)[count] = data+pos+4;
+		pos += 4 + (*inputsizes)[count];
+	}
+	*frames = count;
+	return data;
+}
+
+static double
+measure(alacdecode_format_t *format, int threads, int frames,
+        unsigned char **inbuffers, int *inputsizes, void **outbuffers, int *outputsizes)
+{
+	alac_batch_t *batch;
+	double start, elapsed;
+	int passes = 0;
+
+	batch = alac_batch_init(threads, format->bitDepth, format->numChannels, format->decoder_info);
+	if (!batch) {
+		return 0.0;
+	}
+
+	/* Warm up the caches and threads, then decode for at least a second */
+	alac_batch_decode(batch, frames, inbuffers, inputsizes, outbuffers, outputsizes);
+	start = get_seconds();
+	do {
+		alac_batch_decode(batch, frames, inbuffers, inputsizes, outbuffers, outputsizes);
+		passes++;
+		elapsed = get_seconds() - start;
+	} while (elapsed < 1.0);
+
+	alac_batch_destroy(batch);
+	return (double) frames * passes / elapsed;
+}
+
+static int
+parse_options(alacdecode_options_t *opt, int argc, char *argv[])
+{
+	char *path = argv[0];
+	char *arg;
+
+	strncpy(opt->fmtp, DEFAULT_FMTP, sizeof(opt->fmtp)-1);
+
+	while ((arg = *++argv)) {
+		if (!strcmp(arg, "-t") && argv[1]) {
+			opt->threads = atoi(*++argv);
+		} else if (!strncmp(arg, "--threads=", 10)) {
+			opt->threads = atoi(arg+10);
+		} else if (!strcmp(arg, "-f") && argv[1]) {
+			strncpy(opt->fmtp, *++argv, sizeof(opt->fmtp)-1);
+		} else if (!strncmp(arg, "--fmtp=", 7)) {
+			strncpy(opt->fmtp, arg+7, sizeof(opt->fmtp)-1);
+		} else if (!strcmp(arg, "-s") || !strcmp(arg, "--scaling")) {
+			opt->scaling = 1;
+		} else if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+			break;
+		} else if (!opt->input) {
+			opt->input = arg;
+		} else if (!opt->output) {
+			opt->output = arg;
+		} else {
+			break;
+		}
+	}
+	if (arg || !opt->input || (!opt->output && !opt->scaling) || opt->threads < 0) {
+		fprintf(stderr, "Usage: %s [OPTION...] input [output]\n", path);
+		fprintf(stderr, "\n");
+		fprintf(stderr, "Decodes ALAC frames, each preceded by a 32-bit big endian length, to PCM\n");
+		fprintf(stderr, "\n");
+		fprintf(stderr, "  -t, --threads=0                 Sets decoding threads, 0 is one per CPU\n");
+		fprintf(stderr, "  -f, --fmtp=\"%s\"\n", DEFAULT_FMTP);
+		fprintf(stderr, "                                  Sets the stream format as in the SDP fmtp\n");
+		fprintf(stderr, "  -s, --scaling                   Reports frames/s from one thread up to all\n");
+		fprintf(stderr, "  -h, --help                      This help\n");
+		fprintf(stderr, "\n");
+		return 1;
+	}
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	alacdecode_options_t options;
+	alacdecode_format_t format;
+	unsigned char *data;
+	unsigned char **inbuffers;
+	int *inputsizes;
+	void **outbuffers;
+	int *outputsizes;
+	char *pcm;
+	int frame_bytes;
+	int frames;
+	int i;
+
+	memset(&options, 0, sizeof(options));
+	if (parse_options(&options, argc, argv)) {
+		return 1;
+	}
+	if (parse_fmtp(&format, options.fmtp) < 0) {
+		fprintf(stderr, "Unsupported fmtp: %s\n", options.fmtp);
+		return 1;
+	}
+
+	data = read_frames(options.input, &frames, &inbuffers, &inputsizes);
+	if (!data) {
+		fprintf(stderr, "Could not read frames from %s\n", options.input);
+		return 1;
+	}
+
+	frame_bytes = format.frameLength * format.numChannels * format.bitDepth/8;
+	pcm = malloc((size_t) frame_bytes * frames + 1);
+	outbuffers = malloc(frames * sizeof(void *) + 1);
+	outputsizes = malloc(frames * sizeof(int) + 1);
+	if (!pcm || !outbuffers || !outputsizes) {
+		fprintf(stderr, "Out of memory for %d frames\n", frames);
+		return 1;
+	}
+	for (i=0; i<frames; i++) {
+		outbuffers[i] = pcm + (size_t) frame_bytes * i;
+		outputsizes[i] = frame_bytes;
+	}
+
+	if (options.scaling) {
+		alac_batch_t *batch;
+		double single = 0.0;
+		int threads;
+
+		/* Only to find out how many threads zero means */
+		batch = alac_batch_init(options.threads, format.bitDepth, format.numChannels, format.decoder_info);
+		threads = batch ? alac_batch_get_threads(batch) : 1;
+		alac_batch_destroy(batch);
+
+		printf("%d frames of %d samples\n", frames, format.frameLength);
+		for (i=1; i<=threads; i++) {
+			double rate = measure(&format, i, frames, inbuffers, inputsizes, outbuffers, outputsizes);
+			if (i == 1) {
+				single = rate;
+			}
+			printf("%3d threads: %9.0f frames/s, %9.0f frames/s per thread, %5.2fx, %6.0fx realtime\n",
+			       i, rate, rate / i, single > 0.0 ? rate / single : 0.0,
+			       rate * format.frameLength / (format.sampleRate > 0 ? format.sampleRate : 44100));
+		}
+	} else {
+		alac_batch_t *batch;
+		FILE *fp;
+
+		batch = alac_batch_init(options.threads, format.bitDepth, format.numChannels, format.decoder_info);
+		if (!batch) {
+			fprintf(stderr, "Could not initialize the decoder\n");
+			return 1;
+		}
+		alac_batch_decode(batch, frames, inbuffers, inputsizes, outbuffers, outputsizes);
+		alac_batch_destroy(batch);
+
+		fp = fopen(options.output, "wb");
+		if (!fp) {
+			fprintf(stderr, "Could not open %s for writing\n", options.output);
+			return 1;
+		}
+		for (i=0; i<frames; i++) {
+			if (outputsizes[i] < 0 || outputsizes[i] > frame_bytes) {
+				fprintf(stderr, "Frame %d decoded to %d bytes, a frame holds %d\n", i, outputsizes[i], frame_bytes);
+				fclose(fp);
+				return 1;
+			}
+			fwrite(outbuffers[i], 1, outputsizes[i], fp);
+		}
+		fclose(fp);
+	}
+
+	free(outputsizes);
+	free(outbuffers);
+	free(pcm);
+	free(inputsizes);
+	free(inbuffers);
+	free(data);
+	return 0;
+}
@@ -0,0 +1,186 @@
+/**
+ *  Copyright (C) 2012-2013  Juho Vähä-Herttua
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included
+ *  in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Encodes raw little endian PCM to ALAC frames, each preceded by its
+ * length as a 32-bit big endian integer like alacdecode reads them. The
+ * fmtp of the stream is printed for decoding the frames again. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lib/alac/alac_encoder.h"
+
+typedef struct {
+	int bits;
+	int channels;
+	int frame_length;
+	int samplerate;
+	const char *input;
+	const char *output;
+} alacencode_options_t;
+
+static int
+parse_options(alacencode_options_t *opt, int argc, char *argv[])
+{
+	char *path = argv[0];
+	char *arg;
+
+	opt->bits = 16;
+	opt->channels = 2;
+	opt->frame_length = 352;
+	opt->samplerate = 44100;
+
+	while ((arg = *++argv)) {
+		if (!strcmp(arg, "-b") && argv[1]) {
+			opt->bits = atoi(*++argv);
+		} else if (!strncmp(arg, "--bits=", 7)) {
+			opt->bits = atoi(arg+7);
+		} else if (!strcmp(arg, "-c") && argv[1]) {
+			opt->channels = atoi(*++argv);
+		} else if (!strncmp(arg, "--channels=", 11)) {
+			opt->channels = atoi(arg+11);
+		} else if (!strcmp(arg, "-l") && argv[1]) {
+			opt->frame_length = atoi(*++argv);
+		} else if (!strncmp(arg, "--frame-length=", 15)) {
+			opt->frame_length = atoi(arg+15);
+		} else if (!strcmp(arg, "-r") && argv[1]) {
+			opt->samplerate = atoi(*++argv);
+		} else if (!strncmp(arg, "--rate=", 7)) {
+			opt->samplerate = atoi(arg+7);
+		} else if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+			break;
+		} else if (!opt->input) {
+			opt->input = arg;
+		} else if (!opt->output) {
+			opt->output = arg;
+		} else {
+			break;
+		}
+	}
+	if (arg || !opt->input || !opt->output) {
+		fprintf(stderr, "Usage: %s [OPTION...] input output\n", path);
+		fprintf(stderr, "\n");
+		fprintf(stderr, "Encodes raw little endian PCM to ALAC frames, each preceded by a 32-bit big endian length\n");
+		fprintf(stderr, "\n");
+		fprintf(stderr, "  -b, --bits=16                   Sets the bits per sample, 16 or 24\n");
+		fprintf(stderr, "  -c, --channels=2                Sets the number of channels, 1 or 2\n");
+		fprintf(stderr, "  -l, --frame-length=352          Sets the samples per frame\n");
+		fprintf(stderr, "  -r, --rate=44100                Sets the sample rate for the fmtp\n");
+		fprintf(stderr, "  -h, --help                      This help\n");
+		fprintf(stderr, "\n");
+		return 1;
+	}
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	alacencode_options_t options;
+	alac_encoder_t *encoder;
+	unsigned char *inbuffer;
+	unsigned char *outbuffer;
+	int sample_bytes;
+	int frame_bytes;
+	int max_bytes;
+	char fmtp[64];
+	FILE *in, *out;
+	long frames = 0;
+	int ret = 0;
+
+	memset(&options, 0, sizeof(options));
+	if (parse_options(&options, argc, argv)) {
+		return 1;
+	}
+
+	encoder = alac_encoder_init(options.bits, options.channels,
+	                            options.frame_length, options.samplerate);
+	if (!encoder) {
+		fprintf(stderr, "Unsupported format: %d bits, %d channels, %d samples per frame\n",
+		        options.bits, options.channels, options.frame_length);
+		return 1;
+	}
+	alac_encoder_get_fmtp(encoder, fmtp, sizeof(fmtp));
+
+	sample_bytes = options.channels * options.bits/8;
+	frame_bytes = options.frame_length * sample_bytes;
+	max_bytes = alac_encoder_get_max_frame_bytes(encoder);
+	inbuffer = malloc(frame_bytes);
+	outbuffer = malloc(max_bytes);
+	if (!inbuffer || !outbuffer) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	in = fopen(options.input, "rb");
+	if (!in) {
+		fprintf(stderr, "Could not open %s for reading\n", options.input);
+		return 1;
+	}
+	out = fopen(options.output, "wb");
+	if (!out) {
+		fprintf(stderr, "Could not open %s for writing\n", options.output);
+		fclose(in);
+		return 1;
+	}
+
+	while (1) {
+		unsigned char length[4];
+		int samples, outlen;
+
+		/* The last frame may be partial, a trailing partial sample is dropped */
+		samples = fread(inbuffer, 1, frame_bytes, in) / sample_bytes;
+		if (samples <= 0) {
+			break;
+		}
+		outlen = alac_encoder_encode(encoder, inbuffer, samples, outbuffer, max_bytes);
+		if (outlen < 0) {
+			fprintf(stderr, "Encoding frame %ld failed\n", frames);
+			ret = 1;
+			break;
+		}
+
+		length[0] = outlen >> 24;
+		length[1] = outlen >> 16;
+		length[2] = outlen >> 8;
+		length[3] = outlen;
+		if (fwrite(length, 1, 4, out) != 4 ||
+		    fwrite(outbuffer, 1, outlen, out) != (size_t) outlen) {
+			fprintf(stderr, "Could not write to %s\n", options.output);
+			ret = 1;
+			break;
+		}
+		frames++;
+	}
+	fclose(out);
+	fclose(in);
+
+	if (!ret) {
+		printf("%ld frames, fmtp: %s\n", frames, fmtp);
+	}
+	alac_encoder_destroy(encoder);
+	free(outbuffer);
+	free(inbuffer);
+	return ret;
+}
@@ -75,6 +75,9 @@ audio_set_volume_prototype =    CFUNCTYPE(None, c_void_p, c_void_p, c_float)
 audio_set_metadata_prototype =  CFUNCTYPE(None, c_void_p, c_void_p, c_void_p, c_int)
 audio_set_coverart_prototype =  CFUNCTYPE(None, c_void_p, c_void_p, c_void_p, c_int)
 
+audio_passthrough_prototype =   CFUNCTYPE(c_int, c_void_p, c_void_p, c_void_p)
+audio_process_alac_prototype =  CFUNCTYPE(None, c_void_p, c_void_p, c_void_p, c_int)
+
 class RaopNativeCallbacks(Structure):
 	_fields_ = [("cls",                 py_object),
 	            ("audio_init",          audio_init_prototype),
@@ -83,7 +86,9 @@ class RaopNativeCallbacks(Structure):
 	            ("audio_flush",         audio_flush_prototype),
 	            ("audio_set_volume",    audio_set_volume_prototype),
 	            ("audio_set_metadata",  audio_set_metadata_prototype),
-	            ("audio_set_coverart",  audio_set_coverart_prototype)]
+	            ("audio_set_coverart",  audio_set_coverart_prototype),
+	            ("audio_passthrough",   audio_passthrough_prototype),
+	            ("audio_process_alac",  audio_process_alac_prototype)]
 
 def InitShairplay(libshairplay):
 	# Initialize dnssd related functions
@@ -183,6 +183,8 @@ bool RaopService::init(int max_clients, RaopAudioHandler *callbacks)
     raop_cbs.audio_set_volume = &audio_set_volume_cb;
     raop_cbs.audio_set_metadata = &audio_set_metadata_cb;
     raop_cbs.audio_set_coverart = &audio_set_coverart_cb;
+    raop_cbs.audio_passthrough = 0;
+    raop_cbs.audio_process_alac = 0;
 
     m_raop = raop_init(max_clients, &raop_cbs, RSA_KEY, 0);
     if (!m_raop) {
@@ -45,6 +45,25 @@ static const int host_bigendian = 0;
 #endif
 
 #include "alac.h"
+#include "alac_simd.h"
+
+#ifdef _MSC_VER
+#define ALAC_INLINE __inline
+#define ALAC_ALWAYS_INLINE __forceinline
+#elif defined(__GNUC__)
+#define ALAC_INLINE inline
+#define ALAC_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALAC_INLINE inline
+#define ALAC_ALWAYS_INLINE inline
+#endif
+
+/* The stream format every RAOP sender uses, fmtp "352 0 16 40 10 14 2" */
+#define RAOP_FRAME_LENGTH        352
+#define RAOP_SAMPLE_SIZE         16
+#define RAOP_RICE_HISTORYMULT    40 /* pb */
+#define RAOP_RICE_INITIALHISTORY 10 /* mb */
+#define RAOP_RICE_KMODIFIER      14 /* kb */
 
 #define _Swap32(v) do { \
                    v = (((v) & 0x000000FF) << 0x18) | \
@@ -61,14 +80,17 @@ struct {signed int x:24;} se_struct_24;
 
 struct alac_file
 {
-    unsigned char *input_buffer;
-    int input_buffer_bitaccumulator; /* used so we can do arbitary
-                                        bit reads */
+    unsigned char *input_buffer;     /* next byte to load into the cache */
+    unsigned char *input_buffer_end;
+    uint64_t input_buffer_cache;     /* unread bits, msb first */
+    int input_buffer_cachebits;      /* valid bits in the cache */
 
     int samplesize;
     int numchannels;
     int bytespersample;
 
+    alac_simd_t simd;                /* vector kernels for this CPU */
+
 
     /* buffers */
     int32_t *predicterror_buffer_a;
@@ -98,6 +120,42 @@ struct alac_file
 
 };
 
+/* the sample buffers are only needed while a frame is decoded, where
+ * thread local keys are available they are borrowed from memory kept
+ * by the decoding thread instead of every decoder owning them */
+#if !defined(_WIN32)
+#define ALAC_SCRATCH_POOL
+#include <pthread.h>
+#endif
+
+#define ALAC_SCRATCH_BUFFERS 6
+
+#ifdef ALAC_SCRATCH_POOL
+
+typedef struct
+{
+    uint32_t samples; /* per buffer */
+    int32_t *buffers; /* ALAC_SCRATCH_BUFFERS of them back to back */
+} alac_scratch;
+
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t scratch_key;
+static int scratch_key_valid;
+
+static void free_scratch(void *ptr)
+{
+    alac_scratch *scratch = ptr;
+
+    free(scratch->buffers);
+    free(scratch);
+}
+
+static void create_scratch_key(void)
+{
+    scratch_key_valid = !pthread_key_create(&scratch_key, free_scratch);
+}
+
+#else
 
 static void allocate_buffers(alac_file *alac)
 {
@@ -129,6 +187,89 @@ static void deallocate_buffers(alac_file *alac)
 	alac->uncompressed_bytes_buffer_b = NULL;
 }
 
+#endif
+
+/* sets the sample buffers up for decoding one frame, returns 0 if
+ * there is no memory for them */
+static int borrow_buffers(alac_file *alac)
+{
+#ifdef ALAC_SCRATCH_POOL
+    uint32_t samples = alac->setinfo_max_samples_per_frame;
+    alac_scratch *scratch;
+    int32_t *ptr;
+
+    pthread_once(&scratch_once, create_scratch_key);
+    if (!scratch_key_valid)
+        return 0;
+
+    scratch = pthread_getspecific(scratch_key);
+    if (!scratch)
+    {
+        scratch = calloc(1, sizeof(alac_scratch));
+        if (!scratch)
+            return 0;
+        if (pthread_setspecific(scratch_key, scratch))
+        {
+            free(scratch);
+            return 0;
+        }
+    }
+
+    /* grows to the longest frames decoded on this thread */
+    if (scratch->samples < samples)
+    {
+        if (samples > SIZE_MAX / (ALAC_SCRATCH_BUFFERS * 4))
+            return 0;
+        free(scratch->buffers);
+        scratch->buffers = malloc((size_t)samples * ALAC_SCRATCH_BUFFERS * 4);
+        scratch->samples = scratch->buffers ? samples : 0;
+        if (!scratch->buffers)
+            return 0;
+    }
+
+    ptr = scratch->buffers;
+    alac->predicterror_buffer_a = ptr;
+    alac->predicterror_buffer_b = ptr + samples;
+    alac->outputsamples_buffer_a = ptr + samples * 2;
+    alac->outputsamples_buffer_b = ptr + samples * 3;
+    alac->uncompressed_bytes_buffer_a = ptr + samples * 4;
+    alac->uncompressed_bytes_buffer_b = ptr + samples * 5;
+    return 1;
+#else
+    return alac->predicterror_buffer_a != NULL;
+#endif
+}
+
+static void return_buffers(alac_file *alac)
+{
+#ifdef ALAC_SCRATCH_POOL
+    alac->predicterror_buffer_a = NULL;
+    alac->predicterror_buffer_b = NULL;
+    alac->outputsamples_buffer_a = NULL;
+    alac->outputsamples_buffer_b = NULL;
+    alac->uncompressed_bytes_buffer_a = NULL;
+    alac->uncompressed_bytes_buffer_b = NULL;
+#endif
+}
+
+int alac_get_state_size(alac_file *alac)
+{
+#ifdef ALAC_SCRATCH_POOL
+    return sizeof(alac_file);
+#else
+    return sizeof(alac_file) + alac->setinfo_max_samples_per_frame * ALAC_SCRATCH_BUFFERS * 4;
+#endif
+}
+
+int alac_get_scratch_size(alac_file *alac)
+{
+#ifdef ALAC_SCRATCH_POOL
+    return alac->setinfo_max_samples_per_frame * ALAC_SCRATCH_BUFFERS * 4;
+#else
+    return 0;
+#endif
+}
+
 void alac_set_info(alac_file *alac, char *inputbuffer)
 {
   char *ptr = inputbuffer;
@@ -173,90 +314,80 @@ void alac_set_info(alac_file *alac, char *inputbuffer)
       _Swap32(alac->setinfo_8a_rate);
   ptr += 4;
 
+#ifndef ALAC_SCRATCH_POOL
   allocate_buffers(alac);
-
+#endif
 }
 
 /* stream reading */
 
-/* supports reading 1 to 16 bits, in big endian format */
-static uint32_t readbits_16(alac_file *alac, int bits)
+/* bits are read msb first from a 64-bit cache that is refilled a
+ * word at a time, past the end of the input zeros are read */
+static ALAC_INLINE void refillbits(alac_file *alac)
 {
-    uint32_t result;
-    int new_accumulator;
-
-    result = (alac->input_buffer[0] << 16) |
-             (alac->input_buffer[1] << 8) |
-             (alac->input_buffer[2]);
-
-    /* shift left by the number of bits we've already read,
-     * so that the top 'n' bits of the 24 bits we read will
-     * be the return bits */
-    result = result << alac->input_buffer_bitaccumulator;
-
-    result = result & 0x00ffffff;
+    unsigned char *ptr = alac->input_buffer;
 
-    /* and then only want the top 'n' bits from that, where
-     * n is 'bits' */
-    result = result >> (24 - bits);
-
-    new_accumulator = (alac->input_buffer_bitaccumulator + bits);
-
-    /* increase the buffer pointer if we've read over n bytes. */
-    alac->input_buffer += (new_accumulator >> 3);
-
-    /* and the remainder goes back into the bit accumulator */
-    alac->input_buffer_bitaccumulator = (new_accumulator & 7);
-
-    return result;
-}
-
-/* supports reading 1 to 32 bits, in big endian format */
-static uint32_t readbits(alac_file *alac, int bits)
-{
-    int32_t result = 0;
-
-    if (bits > 16)
+    if (alac->input_buffer_end - ptr >= 8)
     {
-        bits -= 16;
-        result = readbits_16(alac, 16) << bits;
+        uint64_t word = ((uint64_t)ptr[0] << 56) | ((uint64_t)ptr[1] << 48) |
+                        ((uint64_t)ptr[2] << 40) | ((uint64_t)ptr[3] << 32) |
+                        ((uint64_t)ptr[4] << 24) | ((uint64_t)ptr[5] << 16) |
+                        ((uint64_t)ptr[6] << 8) | (uint64_t)ptr[7];
+
+        /* only whole bytes are consumed, the bits of a partial byte
+         * below the valid ones are loaded again by the next refill */
+        alac->input_buffer_cache |= word >> alac->input_buffer_cachebits;
+        alac->input_buffer += (63 - alac->input_buffer_cachebits) >> 3;
+        alac->input_buffer_cachebits |= 56;
+        return;
     }
 
-    result |= readbits_16(alac, bits);
-
-    return result;
+    while (alac->input_buffer_cachebits <= 56)
+    {
+        if (alac->input_buffer < alac->input_buffer_end)
+        {
+            alac->input_buffer_cache |= (uint64_t)*alac->input_buffer++ <<
+                                        (56 - alac->input_buffer_cachebits);
+        }
+        alac->input_buffer_cachebits += 8;
+    }
 }
 
-/* reads a single bit */
-static int readbit(alac_file *alac)
+/* returns the next 1 to 32 bits without consuming them */
+static ALAC_INLINE uint32_t peekbits(alac_file *alac, int bits)
 {
-    int result;
-    int new_accumulator;
+    if (alac->input_buffer_cachebits < bits)
+        refillbits(alac);
 
-    result = alac->input_buffer[0];
-
-    result = result << alac->input_buffer_bitaccumulator;
+    return (uint32_t)(alac->input_buffer_cache >> (64 - bits));
+}
 
-    result = result >> 7 & 1;
+static ALAC_INLINE void skipbits(alac_file *alac, int bits)
+{
+    alac->input_buffer_cache <<= bits;
+    alac->input_buffer_cachebits -= bits;
+}
 
-    new_accumulator = (alac->input_buffer_bitaccumulator + 1);
+/* supports reading 0 to 32 bits, in big endian format */
+static ALAC_INLINE uint32_t readbits(alac_file *alac, int bits)
+{
+    uint32_t result;
 
-    alac->input_buffer += (new_accumulator / 8);
+    if (!bits)
+        return 0;
 
-    alac->input_buffer_bitaccumulator = (new_accumulator % 8);
+    result = peekbits(alac, bits);
+    skipbits(alac, bits);
 
     return result;
 }
 
-static void unreadbits(alac_file *alac, int bits)
+static void setbits(alac_file *alac, unsigned char *buffer, int size)
 {
-    int new_accumulator = (alac->input_buffer_bitaccumulator - bits);
-
-    alac->input_buffer += (new_accumulator >> 3);
-
-    alac->input_buffer_bitaccumulator = (new_accumulator & 7);
-    if (alac->input_buffer_bitaccumulator < 0)
-        alac->input_buffer_bitaccumulator *= -1;
+    alac->input_buffer = buffer;
+    alac->input_buffer_end = buffer + size;
+    alac->input_buffer_cache = 0;
+    alac->input_buffer_cachebits = 0;
 }
 
 /* various implementations of count_leading_zero:
@@ -296,6 +427,7 @@ static int count_leading_zeros(int input)
 #elif defined(__GNUC__)
 static int count_leading_zeros(int input)
 {
+    if (!input) return 32;
     return __builtin_clz(input);
 }
 #elif defined(_MSC_VER) && defined(_M_IX86)
@@ -362,18 +494,23 @@ found:
 
 #define RICE_THRESHOLD 8 // maximum number of bits for a rice prefix.
 
-int32_t entropy_decode_value(alac_file* alac,
-							 int readSampleSize,
-							 int k,
-							 int rice_kmodifier_mask)
+// largest k whose code fits a 32-bit window with the longest prefix
+#define RICE_WINDOW_MAXK (32 - (RICE_THRESHOLD + 1))
+
+static int32_t entropy_decode_value_slow(alac_file* alac,
+										 int readSampleSize,
+										 int k,
+										 int rice_kmodifier_mask)
 {
-	int32_t x = 0; // decoded value
+	int32_t x; // decoded value
+	uint32_t prefix;
 	
 	// read x, number of 1s before 0 represent the rice value.
-	while (x <= RICE_THRESHOLD && readbit(alac))
-	{
-		x++;
-	}
+	// at most RICE_THRESHOLD + 1 ones are counted, the inverted
+	// low bits are all set and stop the count there
+	prefix = peekbits(alac, RICE_THRESHOLD + 1);
+	x = count_leading_zeros(~(prefix << (32 - (RICE_THRESHOLD + 1))));
+	skipbits(alac, x > RICE_THRESHOLD ? x : x + 1);
 	
 	if (x > RICE_THRESHOLD)
 	{
@@ -391,29 +528,78 @@ int32_t entropy_decode_value(alac_file* alac,
 	{
 		if (k != 1)
 		{
-			int extraBits = readbits(alac, k);
+			int extraBits = k ? peekbits(alac, k) : 0;
 			
 			// x = x * (2^k - 1)
 			x *= (((1 << k) - 1) & rice_kmodifier_mask);
 			
+			// values 0 and 1 are coded with k - 1 bits
 			if (extraBits > 1)
+			{
 				x += extraBits - 1;
-			else
-				unreadbits(alac, 1);
+				skipbits(alac, k);
+			}
+			else if (k)
+				skipbits(alac, k - 1);
 		}
 	}
 	
 	return x;
 }
 
-void entropy_rice_decode(alac_file* alac,
-						 int32_t* outputBuffer,
-						 int outputSize,
-						 int readSampleSize,
-						 int rice_initialhistory,
-						 int rice_kmodifier,
-						 int rice_historymult,
-						 int rice_kmodifier_mask)
+static ALAC_ALWAYS_INLINE int32_t entropy_decode_value(alac_file* alac,
+													   int readSampleSize,
+													   int k,
+													   int rice_kmodifier_mask)
+{
+	uint32_t window;
+	int prefix;
+	int extraBits;
+	int32_t x;
+	
+	if (k < 1 || k > RICE_WINDOW_MAXK)
+		return entropy_decode_value_slow(alac, readSampleSize, k, rice_kmodifier_mask);
+	
+	// the prefix and the suffix of a code both come from one window,
+	// the set low bits stop the prefix count at RICE_THRESHOLD + 1
+	if (alac->input_buffer_cachebits < RICE_THRESHOLD + 1 + k)
+		refillbits(alac);
+	window = (uint32_t)(alac->input_buffer_cache >> 32);
+	prefix = count_leading_zeros(~window | (0xFFFFFFFF >> (RICE_THRESHOLD + 1)));
+	if (prefix > RICE_THRESHOLD)
+		return entropy_decode_value_slow(alac, readSampleSize, k, rice_kmodifier_mask);
+	
+	if (k == 1)
+	{
+		skipbits(alac, prefix + 1);
+		return prefix;
+	}
+	
+	// x = x * (2^k - 1)
+	extraBits = (window << (prefix + 1)) >> (32 - k);
+	x = prefix * (((1 << k) - 1) & rice_kmodifier_mask);
+	
+	// values 0 and 1 are coded with k - 1 bits
+	if (extraBits > 1)
+	{
+		x += extraBits - 1;
+		skipbits(alac, prefix + 1 + k);
+	}
+	else
+		skipbits(alac, prefix + k);
+	
+	return x;
+}
+
+/* inlined where the stream parameters are known at compile time */
+static ALAC_ALWAYS_INLINE void entropy_rice_decode_inline(alac_file* alac,
+														  int32_t* outputBuffer,
+														  int outputSize,
+														  int readSampleSize,
+														  int rice_initialhistory,
+														  int rice_kmodifier,
+														  int rice_historymult,
+														  int rice_kmodifier_mask)
 {
 	int				outputCount;
 	int				history = rice_initialhistory;
@@ -434,9 +620,8 @@ void entropy_rice_decode(alac_file* alac,
 		decodedValue = entropy_decode_value(alac, readSampleSize, k, 0xFFFFFFFF);
 		
 		decodedValue += signModifier;
-		finalValue = (decodedValue + 1) / 2; // inc by 1 and shift out sign bit
-		if (decodedValue & 1) // the sign is stored in the low bit
-			finalValue *= -1;
+		// the sign is stored in the low bit, odd values are negative
+		finalValue = (decodedValue >> 1) ^ -(decodedValue & 1);
 		
 		outputBuffer[outputCount] = finalValue;
 		
@@ -476,6 +661,20 @@ void entropy_rice_decode(alac_file* alac,
 	}
 }
 
+void entropy_rice_decode(alac_file* alac,
+						 int32_t* outputBuffer,
+						 int outputSize,
+						 int readSampleSize,
+						 int rice_initialhistory,
+						 int rice_kmodifier,
+						 int rice_historymult,
+						 int rice_kmodifier_mask)
+{
+	entropy_rice_decode_inline(alac, outputBuffer, outputSize, readSampleSize,
+							   rice_initialhistory, rice_kmodifier,
+							   rice_historymult, rice_kmodifier_mask);
+}
+
 #define SIGN_EXTENDED32(val, bits) ((val << (32 - bits)) >> (32 - bits))
 
 #define SIGN_ONLY(v) \
@@ -483,7 +682,8 @@ void entropy_rice_decode(alac_file* alac,
                                 ((v > 0) ? (1) : \
                                            (0)))
 
-static void predictor_decompress_fir_adapt(int32_t *error_buffer,
+static void predictor_decompress_fir_adapt(const alac_simd_t *simd,
+                                           int32_t *error_buffer,
                                            int32_t *buffer_out,
                                            int output_size,
                                            int readsamplesize,
@@ -536,22 +736,20 @@ static void predictor_decompress_fir_adapt(int32_t *error_buffer,
         }
     }
 
-#if 0
-    /* 4 and 8 are very common cases (the only ones i've seen). these
-     * should be unrolled and optimised
+    /* 4 and 8 are very common cases (the only ones i've seen), the
+     * vector kernels fall back here for frames they can't do exactly
      */
-    if (predictor_coef_num == 4)
-    {
-        /* FIXME: optimised general case */
+    if (predictor_coef_num <= 4 && simd->predictor_fir_4 &&
+        simd->predictor_fir_4(error_buffer, buffer_out, output_size,
+                              readsamplesize, predictor_coef_table,
+                              predictor_coef_num, predictor_quantitization))
         return;
-    }
 
-    if (predictor_coef_table == 8)
-    {
-        /* FIXME: optimised general case */
+    if (predictor_coef_num <= 8 && simd->predictor_fir_8 &&
+        simd->predictor_fir_8(error_buffer, buffer_out, output_size,
+                              readsamplesize, predictor_coef_table,
+                              predictor_coef_num, predictor_quantitization))
         return;
-    }
-#endif
 
 
     /* general case */
@@ -623,19 +821,24 @@ static void predictor_decompress_fir_adapt(int32_t *error_buffer,
     }
 }
 
-void deinterlace_16(int32_t *buffer_a, int32_t *buffer_b,
+void deinterlace_16(const alac_simd_t *simd,
+                    int32_t *buffer_a, int32_t *buffer_b,
                     int16_t *buffer_out,
                     int numchannels, int numsamples,
                     uint8_t interlacing_shift,
                     uint8_t interlacing_leftweight)
 {
-    int i;
+    int i = 0;
     if (numsamples <= 0) return;
 
+    if (numchannels == 2 && simd->deinterlace_16)
+        i = simd->deinterlace_16(buffer_a, buffer_b, buffer_out, numsamples,
+                                 interlacing_shift, interlacing_leftweight);
+
     /* weighted interlacing */
     if (interlacing_leftweight)
     {
-        for (i = 0; i < numsamples; i++)
+        for (; i < numsamples; i++)
         {
             int32_t difference, midright;
             int16_t left;
@@ -663,7 +866,7 @@ void deinterlace_16(int32_t *buffer_a, int32_t *buffer_b,
     }
 
     /* otherwise basic interlacing took place */
-    for (i = 0; i < numsamples; i++)
+    for (; i < numsamples; i++)
     {
         int16_t left, right;
 
@@ -682,7 +885,8 @@ void deinterlace_16(int32_t *buffer_a, int32_t *buffer_b,
     }
 }
 
-void deinterlace_24(int32_t *buffer_a, int32_t *buffer_b,
+void deinterlace_24(const alac_simd_t *simd,
+                    int32_t *buffer_a, int32_t *buffer_b,
 					int uncompressed_bytes,
 					int32_t *uncompressed_bytes_buffer_a, int32_t *uncompressed_bytes_buffer_b,
                     void *buffer_out,
@@ -690,13 +894,19 @@ void deinterlace_24(int32_t *buffer_a, int32_t *buffer_b,
                     uint8_t interlacing_shift,
                     uint8_t interlacing_leftweight)
 {
-	int i;
+	int i = 0;
     if (numsamples <= 0) return;
+
+    if (numchannels == 2 && simd->deinterlace_24)
+        i = simd->deinterlace_24(buffer_a, buffer_b, uncompressed_bytes,
+                                 uncompressed_bytes_buffer_a, uncompressed_bytes_buffer_b,
+                                 (uint8_t*)buffer_out, numsamples,
+                                 interlacing_shift, interlacing_leftweight);
 	
     /* weighted interlacing */
     if (interlacing_leftweight)
     {
-        for (i = 0; i < numsamples; i++)
+        for (; i < numsamples; i++)
         {
             int32_t difference, midright;
             int32_t left;
@@ -731,7 +941,7 @@ void deinterlace_24(int32_t *buffer_a, int32_t *buffer_b,
     }
 	
     /* otherwise basic interlacing took place */
-    for (i = 0; i < numsamples; i++)
+    for (; i < numsamples; i++)
     {
         int32_t left, right;
 		
@@ -760,16 +970,134 @@ void deinterlace_24(int32_t *buffer_a, int32_t *buffer_b,
 	
 }
 
-void decode_frame(alac_file *alac,
-                  unsigned char *inbuffer,
-                  void *outbuffer, int *outputsize)
+/* decodes the predicted channels of a compressed stereo frame, the
+ * stream parameters are arguments so that the specialized decoders
+ * below get them folded in as constants */
+static ALAC_ALWAYS_INLINE void decode_stereo_compressed(alac_file *alac,
+                                                        int outputsamples,
+                                                        int readsamplesize,
+                                                        int uncompressed_bytes,
+                                                        int rice_initialhistory,
+                                                        int rice_kmodifier,
+                                                        int rice_historymult,
+                                                        uint8_t *interlacing_shift,
+                                                        uint8_t *interlacing_leftweight)
+{
+    int16_t predictor_coef_table_a[32];
+    int predictor_coef_num_a;
+    int prediction_type_a;
+    int prediction_quantitization_a;
+    int ricemodifier_a;
+
+    int16_t predictor_coef_table_b[32];
+    int predictor_coef_num_b;
+    int prediction_type_b;
+    int prediction_quantitization_b;
+    int ricemodifier_b;
+
+    int i;
+
+    *interlacing_shift = readbits(alac, 8);
+    *interlacing_leftweight = readbits(alac, 8);
+
+    /******** channel 1 ***********/
+    prediction_type_a = readbits(alac, 4);
+    prediction_quantitization_a = readbits(alac, 4);
+
+    ricemodifier_a = readbits(alac, 3);
+    predictor_coef_num_a = readbits(alac, 5);
+
+    /* read the predictor table */
+    for (i = 0; i < predictor_coef_num_a; i++)
+    {
+        predictor_coef_table_a[i] = (int16_t)readbits(alac, 16);
+    }
+
+    /******** channel 2 *********/
+    prediction_type_b = readbits(alac, 4);
+    prediction_quantitization_b = readbits(alac, 4);
+
+    ricemodifier_b = readbits(alac, 3);
+    predictor_coef_num_b = readbits(alac, 5);
+
+    /* read the predictor table */
+    for (i = 0; i < predictor_coef_num_b; i++)
+    {
+        predictor_coef_table_b[i] = (int16_t)readbits(alac, 16);
+    }
+
+    /*********************/
+    if (uncompressed_bytes)
+    { /* see mono case */
+		for (i = 0; i < outputsamples; i++)
+		{
+			alac->uncompressed_bytes_buffer_a[i] = readbits(alac, uncompressed_bytes * 8);
+			alac->uncompressed_bytes_buffer_b[i] = readbits(alac, uncompressed_bytes * 8);
+		}
+    }
+
+    /* channel 1 */
+    entropy_rice_decode_inline(alac,
+                               alac->predicterror_buffer_a,
+                               outputsamples,
+                               readsamplesize,
+                               rice_initialhistory,
+                               rice_kmodifier,
+                               ricemodifier_a * rice_historymult / 4,
+                               (1 << rice_kmodifier) - 1);
+
+    if (prediction_type_a == 0)
+    { /* adaptive fir */
+        predictor_decompress_fir_adapt(&alac->simd,
+                                       alac->predicterror_buffer_a,
+                                       alac->outputsamples_buffer_a,
+                                       outputsamples,
+                                       readsamplesize,
+                                       predictor_coef_table_a,
+                                       predictor_coef_num_a,
+                                       prediction_quantitization_a);
+    }
+    else
+    { /* see mono case */
+        fprintf(stderr, "FIXME: unhandled predicition type: %i\n", prediction_type_a);
+    }
+
+    /* channel 2 */
+    entropy_rice_decode_inline(alac,
+                               alac->predicterror_buffer_b,
+                               outputsamples,
+                               readsamplesize,
+                               rice_initialhistory,
+                               rice_kmodifier,
+                               ricemodifier_b * rice_historymult / 4,
+                               (1 << rice_kmodifier) - 1);
+
+    if (prediction_type_b == 0)
+    { /* adaptive fir */
+        predictor_decompress_fir_adapt(&alac->simd,
+                                       alac->predicterror_buffer_b,
+                                       alac->outputsamples_buffer_b,
+                                       outputsamples,
+                                       readsamplesize,
+                                       predictor_coef_table_b,
+                                       predictor_coef_num_b,
+                                       prediction_quantitization_b);
+    }
+    else
+    {
+        fprintf(stderr, "FIXME: unhandled predicition type: %i\n", prediction_type_b);
+    }
+}
+
+static void decode_frame_generic(alac_file *alac,
+                                 unsigned char *inbuffer, int inputsize,
+                                 void *outbuffer, int *outputsize)
 {
     int channels;
     int32_t outputsamples = alac->setinfo_max_samples_per_frame;
 
     /* setup the stream */
-    alac->input_buffer = inbuffer;
-    alac->input_buffer_bitaccumulator = 0;
+    setbits(alac, inbuffer, inputsize);
 
     channels = readbits(alac, 3);
 
@@ -854,7 +1182,8 @@ void decode_frame(alac_file *alac,
 
             if (prediction_type == 0)
             { /* adaptive fir */
-                predictor_decompress_fir_adapt(alac->predicterror_buffer_a,
+                predictor_decompress_fir_adapt(&alac->simd,
+                                               alac->predicterror_buffer_a,
                                                alac->outputsamples_buffer_a,
                                                outputsamples,
                                                readsamplesize,
@@ -988,109 +1317,15 @@ void decode_frame(alac_file *alac,
 
         if (!isnotcompressed)
         { /* compressed */
-            int16_t predictor_coef_table_a[32];
-            int predictor_coef_num_a;
-            int prediction_type_a;
-            int prediction_quantitization_a;
-            int ricemodifier_a;
-
-            int16_t predictor_coef_table_b[32];
-            int predictor_coef_num_b;
-            int prediction_type_b;
-            int prediction_quantitization_b;
-            int ricemodifier_b;
-
-            int i;
-
-            interlacing_shift = readbits(alac, 8);
-            interlacing_leftweight = readbits(alac, 8);
-
-            /******** channel 1 ***********/
-            prediction_type_a = readbits(alac, 4);
-            prediction_quantitization_a = readbits(alac, 4);
-
-            ricemodifier_a = readbits(alac, 3);
-            predictor_coef_num_a = readbits(alac, 5);
-
-            /* read the predictor table */
-            for (i = 0; i < predictor_coef_num_a; i++)
-            {
-                predictor_coef_table_a[i] = (int16_t)readbits(alac, 16);
-            }
-
-            /******** channel 2 *********/
-            prediction_type_b = readbits(alac, 4);
-            prediction_quantitization_b = readbits(alac, 4);
-
-            ricemodifier_b = readbits(alac, 3);
-            predictor_coef_num_b = readbits(alac, 5);
-
-            /* read the predictor table */
-            for (i = 0; i < predictor_coef_num_b; i++)
-            {
-                predictor_coef_table_b[i] = (int16_t)readbits(alac, 16);
-            }
-
-            /*********************/
-            if (uncompressed_bytes)
-            { /* see mono case */
-				int i;
-				for (i = 0; i < outputsamples; i++)
-				{
-					alac->uncompressed_bytes_buffer_a[i] = readbits(alac, uncompressed_bytes * 8);
-					alac->uncompressed_bytes_buffer_b[i] = readbits(alac, uncompressed_bytes * 8);
-				}
-            }
-
-            /* channel 1 */
-            entropy_rice_decode(alac,
-								alac->predicterror_buffer_a,
-								outputsamples,
-								readsamplesize,
-								alac->setinfo_rice_initialhistory,
-								alac->setinfo_rice_kmodifier,
-								ricemodifier_a * alac->setinfo_rice_historymult / 4,
-								(1 << alac->setinfo_rice_kmodifier) - 1);
-
-            if (prediction_type_a == 0)
-            { /* adaptive fir */
-                predictor_decompress_fir_adapt(alac->predicterror_buffer_a,
-                                               alac->outputsamples_buffer_a,
-                                               outputsamples,
-                                               readsamplesize,
-                                               predictor_coef_table_a,
-                                               predictor_coef_num_a,
-                                               prediction_quantitization_a);
-            }
-            else
-            { /* see mono case */
-                fprintf(stderr, "FIXME: unhandled predicition type: %i\n", prediction_type_a);
-            }
-
-            /* channel 2 */
-            entropy_rice_decode(alac,
-								alac->predicterror_buffer_b,
-								outputsamples,
-								readsamplesize,
-								alac->setinfo_rice_initialhistory,
-								alac->setinfo_rice_kmodifier,
-								ricemodifier_b * alac->setinfo_rice_historymult / 4,
-								(1 << alac->setinfo_rice_kmodifier) - 1);
-
-            if (prediction_type_b == 0)
-            { /* adaptive fir */
-                predictor_decompress_fir_adapt(alac->predicterror_buffer_b,
-                                               alac->outputsamples_buffer_b,
-                                               outputsamples,
-                                               readsamplesize,
-                                               predictor_coef_table_b,
-                                               predictor_coef_num_b,
-                                               prediction_quantitization_b);
-            }
-            else
-            {
-                fprintf(stderr, "FIXME: unhandled predicition type: %i\n", prediction_type_b);
-            }
+            decode_stereo_compressed(alac,
+                                     outputsamples,
+                                     readsamplesize,
+                                     uncompressed_bytes,
+                                     alac->setinfo_rice_initialhistory,
+                                     alac->setinfo_rice_kmodifier,
+                                     alac->setinfo_rice_historymult,
+                                     &interlacing_shift,
+                                     &interlacing_leftweight);
         }
         else
         { /* not compressed, easy case */
@@ -1141,7 +1376,8 @@ void decode_frame(alac_file *alac,
         {
         case 16:
         {
-            deinterlace_16(alac->outputsamples_buffer_a,
+            deinterlace_16(&alac->simd,
+                           alac->outputsamples_buffer_a,
                            alac->outputsamples_buffer_b,
                            (int16_t*)outbuffer,
                            alac->numchannels,
@@ -1152,7 +1388,8 @@ void decode_frame(alac_file *alac,
         }
 		case 24:
 		{
-			deinterlace_24(alac->outputsamples_buffer_a,
+			deinterlace_24(&alac->simd,
+                           alac->outputsamples_buffer_a,
                            alac->outputsamples_buffer_b,
 						   uncompressed_bytes,
 						   alac->uncompressed_bytes_buffer_a,
@@ -1177,13 +1414,88 @@ void decode_frame(alac_file *alac,
     }
 }
 
+void decode_frame(alac_file *alac,
+                  unsigned char *inbuffer, int inputsize,
+                  void *outbuffer, int *outputsize)
+{
+    if (!borrow_buffers(alac))
+    {
+        *outputsize = 0;
+        return;
+    }
+    decode_frame_generic(alac, inbuffer, inputsize, outbuffer, outputsize);
+    return_buffers(alac);
+}
+
+void decode_frame_stereo16_352(alac_file *alac,
+                               unsigned char *inbuffer, int inputsize,
+                               void *outbuffer, int *outputsize)
+{
+    uint32_t header;
+    uint8_t interlacing_shift;
+    uint8_t interlacing_leftweight;
+
+    if (alac->setinfo_max_samples_per_frame != RAOP_FRAME_LENGTH ||
+        alac->setinfo_sample_size != RAOP_SAMPLE_SIZE ||
+        alac->setinfo_rice_historymult != RAOP_RICE_HISTORYMULT ||
+        alac->setinfo_rice_initialhistory != RAOP_RICE_INITIALHISTORY ||
+        alac->setinfo_rice_kmodifier != RAOP_RICE_KMODIFIER ||
+        alac->numchannels != 2)
+    {
+        decode_frame(alac, inbuffer, inputsize, outbuffer, outputsize);
+        return;
+    }
+
+    if (!borrow_buffers(alac))
+    {
+        *outputsize = 0;
+        return;
+    }
+
+    setbits(alac, inbuffer, inputsize);
+
+    /* channels, 16 unknown bits, hassize, uncompressed bytes and
+     * isnotcompressed. anything but a compressed two channel frame of
+     * the full length goes through the generic decoder */
+    header = readbits(alac, 3 + 16 + 1 + 2 + 1);
+    if ((header >> 20) != 1 || (header & 0xF) != 0)
+    {
+        decode_frame_generic(alac, inbuffer, inputsize, outbuffer, outputsize);
+        return_buffers(alac);
+        return;
+    }
+
+    decode_stereo_compressed(alac,
+                             RAOP_FRAME_LENGTH,
+                             RAOP_SAMPLE_SIZE + 1,
+                             0,
+                             RAOP_RICE_INITIALHISTORY,
+                             RAOP_RICE_KMODIFIER,
+                             RAOP_RICE_HISTORYMULT,
+                             &interlacing_shift,
+                             &interlacing_leftweight);
+
+    deinterlace_16(&alac->simd,
+                   alac->outputsamples_buffer_a,
+                   alac->outputsamples_buffer_b,
+                   (int16_t*)outbuffer,
+                   2,
+                   RAOP_FRAME_LENGTH,
+                   interlacing_shift,
+                   interlacing_leftweight);
+
+    *outputsize = RAOP_FRAME_LENGTH * alac->bytespersample;
+    return_buffers(alac);
+}
+
 alac_file *create_alac(int samplesize, int numchannels)
 {
-    alac_file *newfile = malloc(sizeof(alac_file));
+    alac_file *newfile = calloc(1, sizeof(alac_file));
 
     newfile->samplesize = samplesize;
     newfile->numchannels = numchannels;
     newfile->bytespersample = (samplesize / 8) * numchannels;
+    alac_simd_init(&newfile->simd);
 
     return newfile;
 }
@@ -1191,6 +1503,8 @@ alac_file *create_alac(int samplesize, int numchannels)
 void destroy_alac(alac_file *alac)
 {
     if (!alac) return;
+#ifndef ALAC_SCRATCH_POOL
     deallocate_buffers(alac);
+#endif
     free(alac);
 }
@@ -3,11 +3,24 @@
 
 typedef struct alac_file alac_file;
 
+typedef void (*alac_decode_frame_t)(alac_file *alac,
+                                    unsigned char *inbuffer, int inputsize,
+                                    void *outbuffer, int *outputsize);
+
 alac_file *create_alac(int samplesize, int numchannels);
 void decode_frame(alac_file *alac,
-                  unsigned char *inbuffer,
+                  unsigned char *inbuffer, int inputsize,
                   void *outbuffer, int *outputsize);
+/* decode_frame specialized for 352 samples of 16-bit stereo with
+ * kb=14 mb=10 pb=40, other frames are passed on to decode_frame */
+void decode_frame_stereo16_352(alac_file *alac,
+                               unsigned char *inbuffer, int inputsize,
+                               void *outbuffer, int *outputsize);
 void alac_set_info(alac_file *alac, char *inputbuffer);
+/* bytes held by the decoder itself, and the bytes of sample buffers it
+ * borrows from the decoding thread for each frame where that is possible */
+int alac_get_state_size(alac_file *alac);
+int alac_get_scratch_size(alac_file *alac);
 void destroy_alac(alac_file *alac);
 
 #endif /* __ALAC__DECOMP_H */
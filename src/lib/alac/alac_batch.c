@@ -0,0 +1,285 @@
+/**
+ *  Copyright (C) 2011-2012  Juho Vähä-Herttua
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "alac.h"
+#include "alac_batch.h"
+#include "../threads.h"
+
+/* Frames are independent, workers only need the condition variables
+ * that are missing from the Windows thread macros */
+#if !defined(WIN32)
+# define ALAC_BATCH_USE_THREADS
+#endif
+
+/* Frames taken at a time, a frame decodes in some microseconds */
+#define ALAC_BATCH_CHUNK 16
+
+typedef struct alac_batch_worker_s {
+	alac_batch_t *batch;
+	alac_file *alac;
+#if defined(ALAC_BATCH_USE_THREADS)
+	thread_handle_t thread;
+#endif
+} alac_batch_worker_t;
+
+struct alac_batch_s {
+	/* The first worker is the calling thread */
+	int threads;
+	alac_batch_worker_t *workers;
+
+#if defined(ALAC_BATCH_USE_THREADS)
+	mutex_handle_t mutex;
+	cond_handle_t work_cond;
+	cond_handle_t done_cond;
+	int running;
+
+	/* Incremented for every batch, busy counts the threads still in it */
+	unsigned int generation;
+	int busy;
+#endif
+
+	/* Current batch, next is the first frame not taken yet */
+	int frames;
+	int next;
+	unsigned char **inbuffers;
+	const int *inputsizes;
+	void **outbuffers;
+	int *outputsizes;
+};
+
+static int
+alac_batch_take(alac_batch_t *batch, int *first)
+{
+	int count;
+
+#if defined(ALAC_BATCH_USE_THREADS)
+	MUTEX_LOCK(batch->mutex);
+#endif
+	count = batch->frames - batch->next;
+	if (count > ALAC_BATCH_CHUNK) {
+		count = ALAC_BATCH_CHUNK;
+	}
+	*first = batch->next;
+	batch->next += count;
+#if defined(ALAC_BATCH_USE_THREADS)
+	MUTEX_UNLOCK(batch->mutex);
+#endif
+	return count;
+}
+
+static void
+alac_batch_run(alac_batch_worker_t *worker)
+{
+	alac_batch_t *batch = worker->batch;
+	int first, count, i;
+
+	while ((count = alac_batch_take(batch, &first)) > 0) {
+		for (i=first; i<first+count; i++) {
+			/* Passes frames of other formats on to decode_frame */
+			decode_frame_stereo16_352(worker->alac,
+			                          batch->inbuffers[i], batch->inputsizes[i],
+			                          batch->outbuffers[i], &batch->outputsizes[i]);
+		}
+	}
+}
+
+#if defined(ALAC_BATCH_USE_THREADS)
+
+static THREAD_RETVAL
+alac_batch_thread(void *arg)
+{
+	alac_batch_worker_t *worker = arg;
+	alac_batch_t *batch = worker->batch;
+	unsigned int generation = 0;
+
+	MUTEX_LOCK(batch->mutex);
+	while (1) {
+		while (batch->running && batch->generation == generation) {
+			COND_WAIT(batch->work_cond, batch->mutex);
+		}
+		if (!batch->running) {
+			break;
+		}
+		generation = batch->generation;
+		MUTEX_UNLOCK(batch->mutex);
+
+		alac_batch_run(worker);
+
+		MUTEX_LOCK(batch->mutex);
+		if (--batch->busy == 0) {
+			COND_SIGNAL(batch->done_cond);
+		}
+	}
+	MUTEX_UNLOCK(batch->mutex);
+
+	return 0;
+}
+
+#endif
+
+static int
+alac_batch_online_cpus(void)
+{
+#if defined(_SC_NPROCESSORS_ONLN)
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus > 0) {
+		return (int) cpus;
+	}
+#endif
+	return 1;
+}
+
+alac_batch_t *
+alac_batch_init(int threads, int samplesize, int numchannels, char *decoder_info)
+{
+	alac_batch_t *batch;
+	int i;
+
+	assert(decoder_info);
+
+	if (threads < 0) {
+		return NULL;
+	} else if (threads == 0) {
+		threads = alac_batch_online_cpus();
+	}
+#if !defined(ALAC_BATCH_USE_THREADS)
+	threads = 1;
+#endif
+
+	batch = calloc(1, sizeof(alac_batch_t));
+	if (!batch) {
+		return NULL;
+	}
+	batch->workers = calloc(threads, sizeof(alac_batch_worker_t));
+	if (!batch->workers) {
+		free(batch);
+		return NULL;
+	}
+
+	/* Every thread decodes with its own scratch buffers */
+	for (i=0; i<threads; i++) {
+		alac_batch_worker_t *worker = &batch->workers[i];
+
+		worker->batch = batch;
+		worker->alac = create_alac(samplesize, numchannels);
+		if (!worker->alac) {
+			batch->threads = i;
+			alac_batch_destroy(batch);
+			return NULL;
+		}
+		alac_set_info(worker->alac, decoder_info);
+	}
+	batch->threads = threads;
+
+#if defined(ALAC_BATCH_USE_THREADS)
+	MUTEX_CREATE(batch->mutex);
+	COND_CREATE(batch->work_cond);
+	COND_CREATE(batch->done_cond);
+	batch->running = 1;
+	for (i=1; i<threads; i++) {
+		THREAD_CREATE(batch->workers[i].thread, alac_batch_thread, &batch->workers[i]);
+		if (!batch->workers[i].thread) {
+			break;
+		}
+	}
+
+	/* Decode with the threads that started, the others are never joined */
+	batch->threads = i;
+	for (; i<threads; i++) {
+		destroy_alac(batch->workers[i].alac);
+		batch->workers[i].alac = NULL;
+	}
+#endif
+	return batch;
+}
+
+int
+alac_batch_get_threads(alac_batch_t *batch)
+{
+	assert(batch);
+
+	return batch->threads;
+}
+
+void
+alac_batch_decode(alac_batch_t *batch, int frames,
+                  unsigned char **inbuffers, const int *inputsizes,
+                  void **outbuffers, int *outputsizes)
+{
+	assert(batch);
+
+	if (frames <= 0) {
+		return;
+	}
+
+#if defined(ALAC_BATCH_USE_THREADS)
+	MUTEX_LOCK(batch->mutex);
+#endif
+	batch->frames = frames;
+	batch->next = 0;
+	batch->inbuffers = inbuffers;
+	batch->inputsizes = inputsizes;
+	batch->outbuffers = outbuffers;
+	batch->outputsizes = outputsizes;
+#if defined(ALAC_BATCH_USE_THREADS)
+	batch->busy = batch->threads - 1;
+	batch->generation++;
+	COND_BROADCAST(batch->work_cond);
+	MUTEX_UNLOCK(batch->mutex);
+#endif
+
+	alac_batch_run(&batch->workers[0]);
+
+#if defined(ALAC_BATCH_USE_THREADS)
+	/* The output of the workers is visible after they have checked out */
+	MUTEX_LOCK(batch->mutex);
+	while (batch->busy) {
+		COND_WAIT(batch->done_cond, batch->mutex);
+	}
+	MUTEX_UNLOCK(batch->mutex);
+#endif
+}
+
+void
+alac_batch_destroy(alac_batch_t *batch)
+{
+	int i;
+
+	if (!batch) {
+		return;
+	}
+
+#if defined(ALAC_BATCH_USE_THREADS)
+	if (batch->running) {
+		MUTEX_LOCK(batch->mutex);
+		batch->running = 0;
+		COND_BROADCAST(batch->work_cond);
+		MUTEX_UNLOCK(batch->mutex);
+		for (i=1; i<batch->threads; i++) {
+			THREAD_JOIN(batch->workers[i].thread);
+		}
+		COND_DESTROY(batch->done_cond);
+		COND_DESTROY(batch->work_cond);
+		MUTEX_DESTROY(batch->mutex);
+	}
+#endif
+	for (i=0; i<batch->threads; i++) {
+		destroy_alac(batch->workers[i].alac);
+	}
+	free(batch->workers);
+	free(batch);
+}
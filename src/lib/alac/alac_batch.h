@@ -0,0 +1,35 @@
+/**
+ *  Copyright (C) 2011-2012  Juho Vähä-Herttua
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+#ifndef ALAC_BATCH_H
+#define ALAC_BATCH_H
+
+typedef struct alac_batch_s alac_batch_t;
+
+/* Creates a decoder for many frames of one stream, decoder_info is the
+ * same buffer that is given to alac_set_info. With zero threads one is
+ * started per online CPU, the calling thread counts as one of them. */
+alac_batch_t *alac_batch_init(int threads, int samplesize, int numchannels,
+                              char *decoder_info);
+int alac_batch_get_threads(alac_batch_t *batch);
+
+/* Decodes all frames and returns when they are done. Each output buffer
+ * must hold a full frame, the sizes are set like in decode_frame. */
+void alac_batch_decode(alac_batch_t *batch, int frames,
+                       unsigned char **inbuffers, const int *inputsizes,
+                       void **outbuffers, int *outputsizes);
+
+void alac_batch_destroy(alac_batch_t *batch);
+
+#endif
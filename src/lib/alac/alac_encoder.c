@@ -0,0 +1,558 @@
+/**
+ *  Copyright (C) 2011-2012  Juho Vähä-Herttua
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+/* Writes the frames that decode_frame reads: a single channel or channel
+ * pair element coded with the adaptive FIR predictor and the adaptive
+ * rice coder, or stored uncompressed when that is smaller. Every step
+ * mirrors the decoder, so each frame decodes on its own. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#ifdef _WIN32
+# include "stdint_win.h"
+#else
+# include <stdint.h>
+#endif
+
+#include "alac_encoder.h"
+
+#if defined(_MSC_VER)
+# define ALAC_ENCODER_INLINE __inline
+#else
+# define ALAC_ENCODER_INLINE inline
+#endif
+
+/* Rice parameters of the stream, as in the fmtp of RAOP senders */
+#define ALAC_ENCODER_HISTORYMULT    40
+#define ALAC_ENCODER_INITIALHISTORY 10
+#define ALAC_ENCODER_KMODIFIER      14
+#define ALAC_ENCODER_MAXRUN         255
+
+/* Predictor of each channel, the coefficients keep adapting from frame
+ * to frame and are written to every frame header */
+#define ALAC_ENCODER_ORDER          4
+#define ALAC_ENCODER_QUANTIZATION   9
+#define ALAC_ENCODER_RICEMODIFIER   4
+
+/* Stereo is either coded as left and right, or as the average and the
+ * difference of the channels with the weight 2 of 2^2 */
+#define ALAC_ENCODER_MIXBITS        2
+#define ALAC_ENCODER_MIXRES         2
+
+/* Element tags and the longest rice prefix before an escape */
+#define ALAC_ID_SCE                 0
+#define ALAC_ID_CPE                 1
+#define ALAC_ID_END                 7
+#define ALAC_RICE_THRESHOLD         8
+
+#define SIGN_EXTENDED32(val, bits) ((int32_t)((uint32_t)(val) << (32 - (bits))) >> (32 - (bits)))
+
+typedef struct {
+	unsigned char *ptr;
+	unsigned char *end;
+	uint64_t cache;
+	int cachebits;
+	int overflow;
+} alac_bitwriter_t;
+
+struct alac_encoder_s {
+	int samplesize;
+	int numchannels;
+	int frame_length;
+	int samplerate;
+
+	/* Coefficients by the stereo mode and the channel */
+	int16_t coefs[2][2][ALAC_ENCODER_ORDER];
+
+	/* Channels of the current frame and the prediction errors */
+	int32_t *channel[2];
+	int32_t *residual;
+};
+
+static ALAC_ENCODER_INLINE void
+put_bits(alac_bitwriter_t *writer, uint32_t value, int bits)
+{
+	/* At most 31 bits are left in the cache, so 1 to 32 bits fit */
+	writer->cache = (writer->cache << bits) | value;
+	writer->cachebits += bits;
+	if (writer->cachebits >= 32) {
+		uint32_t word;
+
+		writer->cachebits -= 32;
+		word = (uint32_t) (writer->cache >> writer->cachebits);
+		if (writer->end - writer->ptr < 4) {
+			writer->overflow = 1;
+			return;
+		}
+		writer->ptr[0] = word >> 24;
+		writer->ptr[1] = word >> 16;
+		writer->ptr[2] = word >> 8;
+		writer->ptr[3] = word;
+		writer->ptr += 4;
+	}
+}
+
+/* Pads to a whole byte, returns the bytes written or -1 on overflow */
+static int
+flush_bits(alac_bitwriter_t *writer, unsigned char *start)
+{
+	if (writer->cachebits & 7) {
+		put_bits(writer, 0, 8 - (writer->cachebits & 7));
+	}
+	while (writer->cachebits > 0 && !writer->overflow) {
+		writer->cachebits -= 8;
+		if (writer->ptr == writer->end) {
+			writer->overflow = 1;
+			break;
+		}
+		*writer->ptr++ = (unsigned char) (writer->cache >> writer->cachebits);
+	}
+	return writer->overflow ? -1 : (int) (writer->ptr - start);
+}
+
+static int
+count_leading_zeros(uint32_t input)
+{
+	int output = 0;
+
+	if (!input) {
+		return 32;
+	}
+#if defined(__GNUC__)
+	output = __builtin_clz(input);
+#else
+	while (!(input & 0x80000000)) {
+		input <<= 1;
+		output++;
+	}
+#endif
+	return output;
+}
+
+/* Inverse of entropy_decode_value: a unary quotient of value/(2^k-1)
+ * and the remainder in k bits, or an escape and the raw value. The
+ * decoder masks 2^k-1 with the kmodifier bits, k never exceeds them. */
+static ALAC_ENCODER_INLINE void
+put_rice_value(alac_bitwriter_t *writer, uint32_t value, int k, int bits)
+{
+	uint32_t divisor = (1 << k) - 1;
+	uint32_t quotient = value >> k;
+
+	if (quotient <= ALAC_RICE_THRESHOLD) {
+		/* Divides by 2^k first, the remainder is then less than
+		 * 2^k+9 so it needs at most a few corrections */
+		uint32_t remainder = (value & divisor) + quotient;
+		uint32_t code;
+
+		while (remainder >= divisor) {
+			remainder -= divisor;
+			quotient++;
+		}
+		code = ((1 << quotient) - 1) << 1;
+		if (quotient > ALAC_RICE_THRESHOLD) {
+			/* escaped below */
+		} else if (k == 1) {
+			put_bits(writer, code, quotient + 1);
+			return;
+		} else if (remainder == 0) {
+			/* Values 0 and 1 of the suffix are coded with k-1 bits */
+			put_bits(writer, code << (k - 1), quotient + k);
+			return;
+		} else {
+			put_bits(writer, (code << k) | (remainder + 1), quotient + 1 + k);
+			return;
+		}
+	}
+	put_bits(writer, (1 << (ALAC_RICE_THRESHOLD + 1)) - 1, ALAC_RICE_THRESHOLD + 1);
+	put_bits(writer, value, bits);
+}
+
+/* Inverse of entropy_rice_decode, the history is updated the same way */
+static void
+put_rice(alac_bitwriter_t *writer, const int32_t *residual, int samples, int bits, int historymult)
+{
+	int history = ALAC_ENCODER_INITIALHISTORY;
+	int sign_modifier = 0;
+	int i;
+
+	for (i=0; i<samples; i++) {
+		uint32_t value;
+		int k;
+
+		k = 31 - ALAC_ENCODER_KMODIFIER - count_leading_zeros((history >> 9) + 3);
+		if (k < 0) {
+			k += ALAC_ENCODER_KMODIFIER;
+		} else {
+			k = ALAC_ENCODER_KMODIFIER;
+		}
+
+		/* The sign is stored in the low bit, odd values are negative */
+		value = ((uint32_t) residual[i] << 1) ^ (uint32_t) (residual[i] >> 31);
+		put_rice_value(writer, value - sign_modifier, k, bits);
+		sign_modifier = 0;
+
+		history += ((int32_t) value * historymult) - ((history * historymult) >> 9);
+		if (value > 0xffff) {
+			history = 0xffff;
+		}
+
+		/* Runs of zeros after quiet parts, the next value is not zero */
+		if (history < 128 && i+1 < samples) {
+			int run = 0;
+
+			while (i+1+run < samples && run < 0xffff && residual[i+1+run] == 0) {
+				run++;
+			}
+			k = count_leading_zeros(history) + ((history + 16) / 64) - 24;
+			put_rice_value(writer, run, k, 16);
+			i += run;
+
+			sign_modifier = 1;
+			history = 0;
+		}
+	}
+}
+
+/* Inverse of predictor_decompress_fir_adapt, the coefficients adapt to
+ * the sign of each error exactly like in the decoder */
+static void
+predict_fir_adapt(const int32_t *input, int32_t *residual, int samples, int bits,
+                  int16_t *coefs, int order, int quantization)
+{
+	int i, j;
+
+	if (samples <= 0) {
+		return;
+	}
+	residual[0] = input[0];
+	for (i=1; i<=order && i<samples; i++) {
+		residual[i] = SIGN_EXTENDED32(input[i] - input[i-1], bits);
+	}
+
+	for (i=order+1; i<samples; i++) {
+		const int32_t *history = &input[i-order-1];
+		uint32_t sum = 0;
+		int32_t prediction;
+		int error;
+
+		for (j=0; j<order; j++) {
+			sum += (uint32_t) (history[order-j] - history[0]) * coefs[j];
+		}
+		prediction = (int32_t) ((1u << (quantization-1)) + sum) >> quantization;
+		error = SIGN_EXTENDED32(input[i] - history[0] - prediction, bits);
+		residual[i] = error;
+
+		if (error > 0) {
+			for (j=order-1; j>=0 && error>0; j--) {
+				int val = history[0] - history[order-j];
+				int sign = (val > 0) - (val < 0);
+
+				coefs[j] -= sign;
+				error -= ((val * sign) >> quantization) * (order - j);
+			}
+		} else if (error < 0) {
+			for (j=order-1; j>=0 && error<0; j--) {
+				int val = history[0] - history[order-j];
+				int sign = (val < 0) - (val > 0);
+
+				coefs[j] -= sign;
+				error -= ((val * sign) >> quantization) * (order - j);
+			}
+		}
+	}
+}
+
+static ALAC_ENCODER_INLINE int32_t
+get_sample(const unsigned char *ptr, int samplesize)
+{
+	if (samplesize == 16) {
+		return (int16_t) (ptr[0] | (ptr[1] << 8));
+	}
+	return SIGN_EXTENDED32(ptr[0] | (ptr[1] << 8) | (ptr[2] << 16), 24);
+}
+
+/* Returns 1 if the average and difference are cheaper than left and right,
+ * judged by the sums of the first differences of the channels */
+static int
+choose_stereo_mode(const int32_t *left, const int32_t *right, int samples)
+{
+	uint32_t cost_lr = 0, cost_ms = 0;
+	int i;
+
+	for (i=1; i<samples; i++) {
+		int32_t dl = left[i] - left[i-1];
+		int32_t dr = right[i] - right[i-1];
+		int32_t dm = ((left[i] + right[i]) >> 1) - ((left[i-1] + right[i-1]) >> 1);
+		int32_t ds = dl - dr;
+
+		cost_lr += (dl < 0 ? -dl : dl) + (dr < 0 ? -dr : dr);
+		cost_ms += (dm < 0 ? -dm : dm) + (ds < 0 ? -ds : ds);
+	}
+	return cost_ms < cost_lr;
+}
+
+static void
+put_header(alac_bitwriter_t *writer, alac_encoder_t *encoder, int samples, int uncompressed)
+{
+	int partial = (samples != encoder->frame_length);
+
+	put_bits(writer, encoder->numchannels == 2 ? ALAC_ID_CPE : ALAC_ID_SCE, 3);
+	put_bits(writer, 0, 4);  /* element instance */
+	put_bits(writer, 0, 12); /* unused */
+	put_bits(writer, partial, 1);
+	put_bits(writer, 0, 2);  /* no uncompressed low bytes */
+	put_bits(writer, uncompressed, 1);
+	if (partial) {
+		put_bits(writer, samples, 32);
+	}
+}
+
+static int
+encode_uncompressed(alac_encoder_t *encoder, int samples, unsigned char *outbuffer, int outsize)
+{
+	alac_bitwriter_t writer;
+	int i, c;
+
+	memset(&writer, 0, sizeof(writer));
+	writer.ptr = outbuffer;
+	writer.end = outbuffer + outsize;
+
+	put_header(&writer, encoder, samples, 1);
+	for (i=0; i<samples; i++) {
+		for (c=0; c<encoder->numchannels; c++) {
+			uint32_t mask = 0xffffffff >> (32 - encoder->samplesize);
+			put_bits(&writer, (uint32_t) encoder->channel[c][i] & mask, encoder->samplesize);
+		}
+	}
+	put_bits(&writer, ALAC_ID_END, 3);
+	return flush_bits(&writer, outbuffer);
+}
+
+static int
+get_uncompressed_bytes(alac_encoder_t *encoder, int samples)
+{
+	int bits = 23 + 3;
+
+	if (samples != encoder->frame_length) {
+		bits += 32;
+	}
+	bits += samples * encoder->numchannels * encoder->samplesize;
+	return (bits + 7) / 8;
+}
+
+alac_encoder_t *
+alac_encoder_init(int samplesize, int numchannels, int frame_length, int samplerate)
+{
+	alac_encoder_t *encoder;
+	int mode, c;
+
+	/* Zero runs are at most 16 bits, longer frames could need one more */
+	if ((samplesize != 16 && samplesize != 24) ||
+	    (numchannels != 1 && numchannels != 2) ||
+	    frame_length <= 0 || frame_length > 0xffff) {
+		return NULL;
+	}
+
+	encoder = calloc(1, sizeof(alac_encoder_t));
+	if (!encoder) {
+		return NULL;
+	}
+	encoder->samplesize = samplesize;
+	encoder->numchannels = numchannels;
+	encoder->frame_length = frame_length;
+	encoder->samplerate = samplerate;
+
+	encoder->channel[0] = malloc(frame_length * 3 * sizeof(int32_t));
+	if (!encoder->channel[0]) {
+		free(encoder);
+		return NULL;
+	}
+	encoder->channel[1] = encoder->channel[0] + frame_length;
+	encoder->residual = encoder->channel[1] + frame_length;
+
+	/* Start from predicting the previous sample */
+	for (mode=0; mode<2; mode++) {
+		for (c=0; c<2; c++) {
+			encoder->coefs[mode][c][0] = 1 << ALAC_ENCODER_QUANTIZATION;
+		}
+	}
+	return encoder;
+}
+
+void
+alac_encoder_get_info(alac_encoder_t *encoder, char *decoder_info)
+{
+	unsigned char *info = (unsigned char *) decoder_info;
+
+	assert(encoder);
+	assert(decoder_info);
+
+	/* Same layout as set_decoder_info of raop_buffer */
+	memset(info, 0, 48);
+	info[24] = encoder->frame_length >> 24;
+	info[25] = encoder->frame_length >> 16;
+	info[26] = encoder->frame_length >> 8;
+	info[27] = encoder->frame_length;
+	info[29] = encoder->samplesize;
+	info[30] = ALAC_ENCODER_HISTORYMULT;
+	info[31] = ALAC_ENCODER_INITIALHISTORY;
+	info[32] = ALAC_ENCODER_KMODIFIER;
+	info[33] = encoder->numchannels;
+	info[35] = ALAC_ENCODER_MAXRUN;
+	info[44] = encoder->samplerate >> 24;
+	info[45] = encoder->samplerate >> 16;
+	info[46] = encoder->samplerate >> 8;
+	info[47] = encoder->samplerate;
+}
+
+int
+alac_encoder_get_fmtp(alac_encoder_t *encoder, char *fmtp, int fmtplen)
+{
+	int ret;
+
+	assert(encoder);
+	assert(fmtp);
+
+	ret = snprintf(fmtp, fmtplen, "96 %d 0 %d %d %d %d %d %d 0 0 %d",
+	               encoder->frame_length, encoder->samplesize,
+	               ALAC_ENCODER_HISTORYMULT, ALAC_ENCODER_INITIALHISTORY,
+	               ALAC_ENCODER_KMODIFIER, encoder->numchannels,
+	               ALAC_ENCODER_MAXRUN, encoder->samplerate);
+	if (ret < 0 || ret >= fmtplen) {
+		return -1;
+	}
+	return ret;
+}
+
+int
+alac_encoder_get_max_frame_bytes(alac_encoder_t *encoder)
+{
+	assert(encoder);
+
+	/* A frame that does not compress is stored as it is, a partial
+	 * frame has fewer samples but 32 bits more for their count */
+	return get_uncompressed_bytes(encoder, encoder->frame_length) + 4;
+}
+
+int
+alac_encoder_encode(alac_encoder_t *encoder,
+                    const void *inbuffer, int samples,
+                    unsigned char *outbuffer, int outsize)
+{
+	const unsigned char *input = inbuffer;
+	int samplebytes, bits, mode;
+	int uncompressed_bytes;
+	alac_bitwriter_t writer;
+	int i, c, ret;
+
+	assert(encoder);
+	assert(inbuffer);
+	assert(outbuffer);
+
+	if (samples <= 0 || samples > encoder->frame_length) {
+		return -1;
+	}
+	uncompressed_bytes = get_uncompressed_bytes(encoder, samples);
+	if (outsize < uncompressed_bytes) {
+		return -1;
+	}
+
+	samplebytes = encoder->samplesize / 8;
+	for (i=0; i<samples; i++) {
+		for (c=0; c<encoder->numchannels; c++) {
+			encoder->channel[c][i] = get_sample(input, encoder->samplesize);
+			input += samplebytes;
+		}
+	}
+
+	/* The difference of two channels needs one more bit */
+	bits = encoder->samplesize + encoder->numchannels - 1;
+	mode = 0;
+	if (encoder->numchannels == 2) {
+		mode = choose_stereo_mode(encoder->channel[0], encoder->channel[1], samples);
+	}
+
+	memset(&writer, 0, sizeof(writer));
+	writer.ptr = outbuffer;
+	writer.end = outbuffer + uncompressed_bytes;
+
+	put_header(&writer, encoder, samples, 0);
+	put_bits(&writer, mode ? ALAC_ENCODER_MIXBITS : 0, 8);
+	put_bits(&writer, mode ? ALAC_ENCODER_MIXRES : 0, 8);
+	for (c=0; c<encoder->numchannels; c++) {
+		int16_t *coefs = encoder->coefs[mode][c];
+
+		put_bits(&writer, 0, 4); /* adaptive FIR */
+		put_bits(&writer, ALAC_ENCODER_QUANTIZATION, 4);
+		put_bits(&writer, ALAC_ENCODER_RICEMODIFIER, 3);
+		put_bits(&writer, ALAC_ENCODER_ORDER, 5);
+		for (i=0; i<ALAC_ENCODER_ORDER; i++) {
+			put_bits(&writer, (uint16_t) coefs[i], 16);
+		}
+	}
+
+	if (mode) {
+		/* Undone by the weighted interlacing of deinterlace_16 */
+		int32_t *left = encoder->channel[0];
+		int32_t *right = encoder->channel[1];
+		int weight = ALAC_ENCODER_MIXRES;
+		int other = (1 << ALAC_ENCODER_MIXBITS) - weight;
+
+		for (i=0; i<samples; i++) {
+			int32_t l = left[i];
+			int32_t r = right[i];
+
+			left[i] = (l * weight + r * other) >> ALAC_ENCODER_MIXBITS;
+			right[i] = l - r;
+		}
+	}
+
+	/* The coefficients were written above, the channels adapt them next */
+	for (c=0; c<encoder->numchannels && !writer.overflow; c++) {
+		predict_fir_adapt(encoder->channel[c], encoder->residual, samples, bits,
+		                  encoder->coefs[mode][c], ALAC_ENCODER_ORDER,
+		                  ALAC_ENCODER_QUANTIZATION);
+		put_rice(&writer, encoder->residual, samples, bits,
+		         ALAC_ENCODER_RICEMODIFIER * ALAC_ENCODER_HISTORYMULT / 4);
+	}
+	put_bits(&writer, ALAC_ID_END, 3);
+
+	ret = flush_bits(&writer, outbuffer);
+	if (ret < 0 || ret >= uncompressed_bytes) {
+		/* Undo the mixing, the predictor does not change the channels */
+		if (mode) {
+			int32_t *left = encoder->channel[0];
+			int32_t *right = encoder->channel[1];
+
+			for (i=0; i<samples; i++) {
+				int32_t r = left[i] - ((right[i] * ALAC_ENCODER_MIXRES) >> ALAC_ENCODER_MIXBITS);
+				left[i] = r + right[i];
+				right[i] = r;
+			}
+		}
+		ret = encode_uncompressed(encoder, samples, outbuffer, outsize);
+	}
+	return ret;
+}
+
+void
+alac_encoder_destroy(alac_encoder_t *encoder)
+{
+	if (encoder) {
+		free(encoder->channel[0]);
+		free(encoder);
+	}
+}
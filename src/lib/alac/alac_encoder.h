@@ -0,0 +1,41 @@
+/**
+ *  Copyright (C) 2011-2012  Juho Vähä-Herttua
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+#ifndef ALAC_ENCODER_H
+#define ALAC_ENCODER_H
+
+typedef struct alac_encoder_s alac_encoder_t;
+
+/* Creates an encoder for 16 or 24-bit mono or stereo audio, frames are
+ * coded with the rice parameters used by RAOP senders (pb=40 mb=10 kb=14) */
+alac_encoder_t *alac_encoder_init(int samplesize, int numchannels,
+                                  int frame_length, int samplerate);
+
+/* Fills the 48 bytes given to alac_set_info, and the fmtp of the SDP */
+void alac_encoder_get_info(alac_encoder_t *encoder, char *decoder_info);
+int alac_encoder_get_fmtp(alac_encoder_t *encoder, char *fmtp, int fmtplen);
+
+/* Size of the output buffer that any frame fits in */
+int alac_encoder_get_max_frame_bytes(alac_encoder_t *encoder);
+
+/* Encodes up to frame_length samples of interleaved little endian PCM,
+ * the same layout that decode_frame outputs. Returns the frame size or
+ * -1 if the output buffer is smaller than the maximum frame size. */
+int alac_encoder_encode(alac_encoder_t *encoder,
+                        const void *inbuffer, int samples,
+                        unsigned char *outbuffer, int outsize);
+
+void alac_encoder_destroy(alac_encoder_t *encoder);
+
+#endif
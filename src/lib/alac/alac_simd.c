@@ -0,0 +1,670 @@
+/**
+ *  Copyright (C) 2011-2012  Juho Vähä-Herttua
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+/**
+ * Vector kernels for the ALAC decoder. They produce exactly the same output
+ * as the scalar code in alac.c and are only used when the CPU supports them.
+ *
+ * The adaptive FIR kernels keep the sample window and the coefficients in
+ * registers. With n coefficients in L lanes, lane L-n+m holds sample m+1 of
+ * the window and coefficient n-1-m, the lanes below are zero padding. The
+ * newest sample is kept in a scalar until the next one has been predicted,
+ * and the adapted coefficients are kept as the old ones plus a -1/0/1 delta,
+ * so the prediction only waits for an add and a psign on the previous
+ * sample instead of a full vector multiply.
+ *
+ * The sign adaptation of the scalar loop stops at the first step that
+ * flips the sign of the remaining error. Every step moves the error towards
+ * zero, so step m runs exactly when the error minus the steps before it
+ * still has the original sign, which is a prefix sum and a compare.
+ */
+
+#include <string.h>
+
+#include "alac_simd.h"
+
+#define SIGN_EXTENDED32(val, bits) ((val << (32 - bits)) >> (32 - bits))
+
+#if defined(ALAC_SIMD_X86) || defined(ALAC_SIMD_NEON)
+
+/* The prefix sums fit in 32 bits up to 8 coefficients of this many bits */
+#define FIR_MAXBITS 25
+
+static int
+fir_in_range(const int32_t *buffer_out, int output_size, int readsamplesize,
+             const int16_t *predictor_coef_table, int predictor_coef_num)
+{
+    int m;
+
+    if (readsamplesize > FIR_MAXBITS)
+        return 0;
+    if (SIGN_EXTENDED32(buffer_out[0], readsamplesize) != buffer_out[0])
+        return 0;
+
+    /* Coefficients move by one per sample, int16 wrapping is not handled */
+    for (m = 0; m < predictor_coef_num; m++)
+    {
+        if (predictor_coef_table[m] > 32767 - output_size ||
+            predictor_coef_table[m] < -32768 + output_size)
+            return 0;
+    }
+    return 1;
+}
+
+/* Lays out the coefficients, samples and step weights for the lanes */
+static void
+fir_load(int32_t *coef, int32_t *hist, int32_t *weight, int lanes,
+         const int32_t *buffer_out, const int16_t *predictor_coef_table,
+         int predictor_coef_num)
+{
+    int pad = lanes - predictor_coef_num;
+    int m;
+
+    memset(coef, 0, lanes * sizeof(int32_t));
+    memset(hist, 0, lanes * sizeof(int32_t));
+    memset(weight, 0, lanes * sizeof(int32_t));
+    for (m = 0; m < predictor_coef_num; m++)
+    {
+        coef[pad+m] = predictor_coef_table[predictor_coef_num-1-m];
+        hist[pad+m] = buffer_out[1+m];
+        weight[pad+m] = m + 1;
+    }
+
+    /* The newest sample is passed separately */
+    hist[lanes-1] = 0;
+}
+
+static void
+fir_store(const int32_t *coef, int lanes,
+          int16_t *predictor_coef_table, int predictor_coef_num)
+{
+    int pad = lanes - predictor_coef_num;
+    int m;
+
+    for (m = 0; m < predictor_coef_num; m++)
+        predictor_coef_table[predictor_coef_num-1-m] = (int16_t)coef[pad+m];
+}
+
+static int32_t
+fir_output(int32_t sum, int32_t b0, int32_t error_val,
+           int readsamplesize, int predictor_quantitization)
+{
+    int32_t outval;
+
+    outval = (1 << (predictor_quantitization-1)) + sum;
+    outval = outval >> predictor_quantitization;
+    outval = outval + b0 + error_val;
+    return SIGN_EXTENDED32(outval, readsamplesize);
+}
+
+#endif
+
+#if defined(ALAC_SIMD_X86)
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SSE41_TARGET
+#else
+#include <cpuid.h>
+#define SSE41_TARGET __attribute__((target("sse4.1")))
+#endif
+#include <smmintrin.h>
+
+SSE41_TARGET
+static int
+predictor_fir_4_sse41(const int32_t *error_buffer, int32_t *buffer_out,
+                      int output_size, int readsamplesize,
+                      int16_t *predictor_coef_table, int predictor_coef_num,
+                      int predictor_quantitization)
+{
+    int32_t lanes[3][4];
+    __m128i coef, delta, hist, weight, valid, shift;
+    int32_t last;
+    int i;
+
+    if (!fir_in_range(buffer_out, output_size, readsamplesize,
+                      predictor_coef_table, predictor_coef_num))
+        return 0;
+
+    fir_load(lanes[0], lanes[1], lanes[2], 4, buffer_out,
+             predictor_coef_table, predictor_coef_num);
+    coef = _mm_loadu_si128((const __m128i *)lanes[0]);
+    hist = _mm_loadu_si128((const __m128i *)lanes[1]);
+    weight = _mm_loadu_si128((const __m128i *)lanes[2]);
+    valid = _mm_cmpgt_epi32(weight, _mm_setzero_si128());
+    delta = _mm_setzero_si128();
+    shift = _mm_cvtsi32_si128(predictor_quantitization);
+    last = buffer_out[predictor_coef_num];
+
+    for (i = predictor_coef_num + 1; i < output_size; i++)
+    {
+        int32_t error_val = error_buffer[i];
+        int32_t b0 = buffer_out[i-predictor_coef_num-1];
+        int32_t outval;
+        __m128i base, diff, prod, signv, step, prefix, mask;
+
+        base = _mm_set1_epi32(b0);
+        diff = _mm_sub_epi32(hist, base);
+        prod = _mm_add_epi32(_mm_mullo_epi32(diff, coef), _mm_sign_epi32(diff, delta));
+        prod = _mm_add_epi32(prod, _mm_shuffle_epi32(prod, _MM_SHUFFLE(1,0,3,2)));
+        prod = _mm_add_epi32(prod, _mm_shuffle_epi32(prod, _MM_SHUFFLE(2,3,0,1)));
+        coef = _mm_add_epi32(coef, delta);
+
+        outval = fir_output(_mm_cvtsi128_si32(prod) + _mm_extract_epi32(coef, 3) * last,
+                            b0, error_val, readsamplesize, predictor_quantitization);
+        buffer_out[i] = outval;
+
+        hist = _mm_insert_epi32(hist, last, 3);
+        diff = _mm_sub_epi32(hist, base);
+        signv = _mm_set1_epi32((error_val > 0) - (error_val < 0));
+        step = _mm_sign_epi32(_mm_abs_epi32(diff), signv);
+        step = _mm_mullo_epi32(_mm_sra_epi32(step, shift), weight);
+        prefix = _mm_slli_si128(step, 4);
+        prefix = _mm_add_epi32(prefix, _mm_slli_si128(prefix, 4));
+        prefix = _mm_add_epi32(prefix, _mm_slli_si128(prefix, 8));
+        prefix = _mm_sub_epi32(_mm_set1_epi32(error_val), prefix);
+        mask = _mm_and_si128(_mm_cmpgt_epi32(_mm_sign_epi32(signv, prefix), _mm_setzero_si128()), valid);
+        delta = _mm_and_si128(_mm_sign_epi32(signv, diff), mask);
+
+        hist = _mm_srli_si128(hist, 4);
+        last = outval;
+    }
+
+    coef = _mm_add_epi32(coef, delta);
+    _mm_storeu_si128((__m128i *)lanes[0], coef);
+    fir_store(lanes[0], 4, predictor_coef_table, predictor_coef_num);
+    return 1;
+}
+
+SSE41_TARGET
+static int
+predictor_fir_8_sse41(const int32_t *error_buffer, int32_t *buffer_out,
+                      int output_size, int readsamplesize,
+                      int16_t *predictor_coef_table, int predictor_coef_num,
+                      int predictor_quantitization)
+{
+    int32_t lanes[3][8];
+    __m128i coef_lo, coef_hi, delta_lo, delta_hi, hist_lo, hist_hi;
+    __m128i weight_lo, weight_hi, valid_lo, valid_hi, shift;
+    int32_t last;
+    int i;
+
+    if (!fir_in_range(buffer_out, output_size, readsamplesize,
+                      predictor_coef_table, predictor_coef_num))
+        return 0;
+
+    fir_load(lanes[0], lanes[1], lanes[2], 8, buffer_out,
+             predictor_coef_table, predictor_coef_num);
+    coef_lo = _mm_loadu_si128((const __m128i *)lanes[0]);
+    coef_hi = _mm_loadu_si128((const __m128i *)(lanes[0] + 4));
+    hist_lo = _mm_loadu_si128((const __m128i *)lanes[1]);
+    hist_hi = _mm_loadu_si128((const __m128i *)(lanes[1] + 4));
+    weight_lo = _mm_loadu_si128((const __m128i *)lanes[2]);
+    weight_hi = _mm_loadu_si128((const __m128i *)(lanes[2] + 4));
+    valid_lo = _mm_cmpgt_epi32(weight_lo, _mm_setzero_si128());
+    valid_hi = _mm_cmpgt_epi32(weight_hi, _mm_setzero_si128());
+    delta_lo = _mm_setzero_si128();
+    delta_hi = _mm_setzero_si128();
+    shift = _mm_cvtsi32_si128(predictor_quantitization);
+    last = buffer_out[predictor_coef_num];
+
+    for (i = predictor_coef_num + 1; i < output_size; i++)
+    {
+        int32_t error_val = error_buffer[i];
+        int32_t b0 = buffer_out[i-predictor_coef_num-1];
+        int32_t outval;
+        __m128i base, diff_lo, diff_hi, prod, signv, errv;
+        __m128i step_lo, step_hi, prefix_lo, prefix_hi, mask_lo, mask_hi;
+
+        base = _mm_set1_epi32(b0);
+        diff_lo = _mm_sub_epi32(hist_lo, base);
+        diff_hi = _mm_sub_epi32(hist_hi, base);
+        prod = _mm_add_epi32(_mm_mullo_epi32(diff_lo, coef_lo), _mm_sign_epi32(diff_lo, delta_lo));
+        prod = _mm_add_epi32(prod, _mm_mullo_epi32(diff_hi, coef_hi));
+        prod = _mm_add_epi32(prod, _mm_sign_epi32(diff_hi, delta_hi));
+        prod = _mm_add_epi32(prod, _mm_shuffle_epi32(prod, _MM_SHUFFLE(1,0,3,2)));
+        prod = _mm_add_epi32(prod, _mm_shuffle_epi32(prod, _MM_SHUFFLE(2,3,0,1)));
+        coef_lo = _mm_add_epi32(coef_lo, delta_lo);
+        coef_hi = _mm_add_epi32(coef_hi, delta_hi);
+
+        outval = fir_output(_mm_cvtsi128_si32(prod) + _mm_extract_epi32(coef_hi, 3) * last,
+                            b0, error_val, readsamplesize, predictor_quantitization);
+        buffer_out[i] = outval;
+
+        hist_hi = _mm_insert_epi32(hist_hi, last, 3);
+        diff_hi = _mm_sub_epi32(hist_hi, base);
+        signv = _mm_set1_epi32((error_val > 0) - (error_val < 0));
+        step_lo = _mm_sign_epi32(_mm_abs_epi32(diff_lo), signv);
+        step_lo = _mm_mullo_epi32(_mm_sra_epi32(step_lo, shift), weight_lo);
+        step_hi = _mm_sign_epi32(_mm_abs_epi32(diff_hi), signv);
+        step_hi = _mm_mullo_epi32(_mm_sra_epi32(step_hi, shift), weight_hi);
+
+        /* Inclusive prefix sums, the upper half continues from the lower */
+        prefix_lo = _mm_add_epi32(step_lo, _mm_slli_si128(step_lo, 4));
+        prefix_lo = _mm_add_epi32(prefix_lo, _mm_slli_si128(prefix_lo, 8));
+        prefix_hi = _mm_add_epi32(step_hi, _mm_slli_si128(step_hi, 4));
+        prefix_hi = _mm_add_epi32(prefix_hi, _mm_slli_si128(prefix_hi, 8));
+        prefix_hi = _mm_add_epi32(prefix_hi, _mm_shuffle_epi32(prefix_lo, _MM_SHUFFLE(3,3,3,3)));
+
+        errv = _mm_set1_epi32(error_val);
+        prefix_lo = _mm_add_epi32(_mm_sub_epi32(errv, prefix_lo), step_lo);
+        prefix_hi = _mm_add_epi32(_mm_sub_epi32(errv, prefix_hi), step_hi);
+        mask_lo = _mm_and_si128(_mm_cmpgt_epi32(_mm_sign_epi32(signv, prefix_lo), _mm_setzero_si128()), valid_lo);
+        mask_hi = _mm_and_si128(_mm_cmpgt_epi32(_mm_sign_epi32(signv, prefix_hi), _mm_setzero_si128()), valid_hi);
+        delta_lo = _mm_and_si128(_mm_sign_epi32(signv, diff_lo), mask_lo);
+        delta_hi = _mm_and_si128(_mm_sign_epi32(signv, diff_hi), mask_hi);
+
+        hist_lo = _mm_alignr_epi8(hist_hi, hist_lo, 4);
+        hist_hi = _mm_srli_si128(hist_hi, 4);
+        last = outval;
+    }
+
+    coef_lo = _mm_add_epi32(coef_lo, delta_lo);
+    coef_hi = _mm_add_epi32(coef_hi, delta_hi);
+    _mm_storeu_si128((__m128i *)lanes[0], coef_lo);
+    _mm_storeu_si128((__m128i *)(lanes[0] + 4), coef_hi);
+    fir_store(lanes[0], 8, predictor_coef_table, predictor_coef_num);
+    return 1;
+}
+
+/* Decorrelates four stereo samples in place, left holds midright and right
+ * the difference on entry */
+#define SSE41_DECORRELATE(left, right, weight, shift) do { \
+        __m128i difference = (right); \
+        (right) = _mm_sub_epi32((left), _mm_sra_epi32(_mm_mullo_epi32(difference, (weight)), (shift))); \
+        (left) = _mm_add_epi32((right), difference); \
+    } while (0)
+
+SSE41_TARGET
+static int
+deinterlace_16_sse41(const int32_t *buffer_a, const int32_t *buffer_b,
+                     int16_t *buffer_out, int numsamples,
+                     uint8_t interlacing_shift, uint8_t interlacing_leftweight)
+{
+    __m128i weight = _mm_set1_epi32(interlacing_leftweight);
+    __m128i shift = _mm_cvtsi32_si128(interlacing_shift);
+    __m128i lowmask = _mm_set1_epi32(0xFFFF);
+    int i;
+
+    /* Shifts of 32 or more are undefined in C, leave them to the scalar
+     * code so the output matches it on every compiler */
+    if (interlacing_leftweight && interlacing_shift >= 32)
+        return 0;
+
+    for (i = 0; i + 4 <= numsamples; i += 4)
+    {
+        __m128i left = _mm_loadu_si128((const __m128i *)(buffer_a + i));
+        __m128i right = _mm_loadu_si128((const __m128i *)(buffer_b + i));
+
+        if (interlacing_leftweight)
+            SSE41_DECORRELATE(left, right, weight, shift);
+
+        /* Low halves of left and right make one little endian pair */
+        left = _mm_or_si128(_mm_and_si128(left, lowmask), _mm_slli_epi32(right, 16));
+        _mm_storeu_si128((__m128i *)(buffer_out + i * 2), left);
+    }
+    return i;
+}
+
+SSE41_TARGET
+static int
+deinterlace_24_sse41(const int32_t *buffer_a, const int32_t *buffer_b,
+                     int uncompressed_bytes,
+                     const int32_t *uncompressed_bytes_buffer_a,
+                     const int32_t *uncompressed_bytes_buffer_b,
+                     uint8_t *buffer_out, int numsamples,
+                     uint8_t interlacing_shift, uint8_t interlacing_leftweight)
+{
+    __m128i weight = _mm_set1_epi32(interlacing_leftweight);
+    __m128i shift = _mm_cvtsi32_si128(interlacing_shift);
+    __m128i ushift = _mm_cvtsi32_si128(uncompressed_bytes * 8);
+    __m128i umask = _mm_set1_epi32(~(0xFFFFFFFF << (uncompressed_bytes * 8)));
+    /* Low three bytes of each lane, the last four bytes are don't care */
+    __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14,
+                                 -1, -1, -1, -1);
+    int i;
+
+    if (interlacing_leftweight && interlacing_shift >= 32)
+        return 0;
+
+    /* Each 12 byte half is written with a 16 byte store that the next one
+     * overwrites, so the last sample is always left to the scalar code */
+    for (i = 0; i + 4 < numsamples; i += 4)
+    {
+        __m128i left = _mm_loadu_si128((const __m128i *)(buffer_a + i));
+        __m128i right = _mm_loadu_si128((const __m128i *)(buffer_b + i));
+        __m128i lo, hi;
+
+        if (interlacing_leftweight)
+            SSE41_DECORRELATE(left, right, weight, shift);
+
+        if (uncompressed_bytes)
+        {
+            left = _mm_or_si128(_mm_sll_epi32(left, ushift),
+                                _mm_and_si128(_mm_loadu_si128((const __m128i *)(uncompressed_bytes_buffer_a + i)), umask));
+            right = _mm_or_si128(_mm_sll_epi32(right, ushift),
+                                 _mm_and_si128(_mm_loadu_si128((const __m128i *)(uncompressed_bytes_buffer_b + i)), umask));
+        }
+
+        lo = _mm_shuffle_epi8(_mm_unpacklo_epi32(left, right), pack);
+        hi = _mm_shuffle_epi8(_mm_unpackhi_epi32(left, right), pack);
+        _mm_storeu_si128((__m128i *)(buffer_out + i * 6), lo);
+        _mm_storeu_si128((__m128i *)(buffer_out + i * 6 + 12), hi);
+    }
+    return i;
+}
+
+/**
+ * Check from CPUID that SSE4.1 is available.
+ */
+static int
+sse41_available(void)
+{
+    unsigned int ecx = 0;
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    ecx = info[2];
+#else
+    unsigned int eax, ebx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        ecx = 0;
+#endif
+    /* Bit 19 is SSE4.1 */
+    return (ecx & (1 << 19)) != 0;
+}
+
+void
+alac_simd_init(alac_simd_t *simd)
+{
+    memset(simd, 0, sizeof(alac_simd_t));
+    if (sse41_available())
+    {
+        simd->predictor_fir_4 = predictor_fir_4_sse41;
+        simd->predictor_fir_8 = predictor_fir_8_sse41;
+        simd->deinterlace_16 = deinterlace_16_sse41;
+        simd->deinterlace_24 = deinterlace_24_sse41;
+    }
+}
+
+#elif defined(ALAC_SIMD_NEON)
+
+#include <arm_neon.h>
+
+/* Returns -1, 0 or 1 for each lane */
+static int32x4_t
+neon_sign(int32x4_t v)
+{
+    int32x4_t zero = vdupq_n_s32(0);
+    return vsubq_s32(vreinterpretq_s32_u32(vcltq_s32(v, zero)),
+                     vreinterpretq_s32_u32(vcgtq_s32(v, zero)));
+}
+
+/* Exclusive prefix sum over the four lanes */
+static int32x4_t
+neon_prefix(int32x4_t v)
+{
+    int32x4_t zero = vdupq_n_s32(0);
+    v = vextq_s32(zero, v, 3);
+    v = vaddq_s32(v, vextq_s32(zero, v, 3));
+    return vaddq_s32(v, vextq_s32(zero, v, 2));
+}
+
+/* Coefficient deltas of the sign adaptation for four lanes, carry holds
+ * the sum of the steps in the lanes before these */
+static int32x4_t
+neon_adapt(int32x4_t diff, int32x4_t signv, int32x4_t errv, int32x4_t weight,
+           int32x4_t valid, int32x4_t shift, int32x4_t *carry)
+{
+    int32x4_t step, prefix;
+    uint32x4_t mask;
+
+    step = vmulq_s32(vabsq_s32(diff), signv);
+    step = vmulq_s32(vshlq_s32(step, shift), weight);
+    prefix = vsubq_s32(vsubq_s32(errv, *carry), neon_prefix(step));
+    *carry = vaddq_s32(*carry, vdupq_n_s32(vaddvq_s32(step)));
+    mask = vcgtq_s32(vmulq_s32(neon_sign(prefix), signv), vdupq_n_s32(0));
+    return vandq_s32(vmulq_s32(neon_sign(diff), signv),
+                     vandq_s32(vreinterpretq_s32_u32(mask), valid));
+}
+
+static int
+predictor_fir_4_neon(const int32_t *error_buffer, int32_t *buffer_out,
+                     int output_size, int readsamplesize,
+                     int16_t *predictor_coef_table, int predictor_coef_num,
+                     int predictor_quantitization)
+{
+    int32_t lanes[3][4];
+    int32x4_t coef, delta, hist, weight, valid, shift, zero;
+    int32_t last;
+    int i;
+
+    if (!fir_in_range(buffer_out, output_size, readsamplesize,
+                      predictor_coef_table, predictor_coef_num))
+        return 0;
+
+    fir_load(lanes[0], lanes[1], lanes[2], 4, buffer_out,
+             predictor_coef_table, predictor_coef_num);
+    zero = vdupq_n_s32(0);
+    coef = vld1q_s32(lanes[0]);
+    hist = vld1q_s32(lanes[1]);
+    weight = vld1q_s32(lanes[2]);
+    valid = vreinterpretq_s32_u32(vcgtq_s32(weight, zero));
+    delta = zero;
+    shift = vdupq_n_s32(-predictor_quantitization);
+    last = buffer_out[predictor_coef_num];
+
+    for (i = predictor_coef_num + 1; i < output_size; i++)
+    {
+        int32_t error_val = error_buffer[i];
+        int32_t b0 = buffer_out[i-predictor_coef_num-1];
+        int32_t outval;
+        int32x4_t base, diff, prod, carry;
+
+        base = vdupq_n_s32(b0);
+        diff = vsubq_s32(hist, base);
+        prod = vmlaq_s32(vmulq_s32(diff, coef), diff, delta);
+        coef = vaddq_s32(coef, delta);
+
+        outval = fir_output(vaddvq_s32(prod) + vgetq_lane_s32(coef, 3) * last,
+                            b0, error_val, readsamplesize, predictor_quantitization);
+        buffer_out[i] = outval;
+
+        hist = vsetq_lane_s32(last, hist, 3);
+        diff = vsubq_s32(hist, base);
+        carry = zero;
+        delta = neon_adapt(diff, vdupq_n_s32((error_val > 0) - (error_val < 0)),
+                           vdupq_n_s32(error_val), weight, valid, shift, &carry);
+
+        hist = vextq_s32(hist, zero, 1);
+        last = outval;
+    }
+
+    vst1q_s32(lanes[0], vaddq_s32(coef, delta));
+    fir_store(lanes[0], 4, predictor_coef_table, predictor_coef_num);
+    return 1;
+}
+
+static int
+predictor_fir_8_neon(const int32_t *error_buffer, int32_t *buffer_out,
+                     int output_size, int readsamplesize,
+                     int16_t *predictor_coef_table, int predictor_coef_num,
+                     int predictor_quantitization)
+{
+    int32_t lanes[3][8];
+    int32x4_t coef_lo, coef_hi, delta_lo, delta_hi, hist_lo, hist_hi;
+    int32x4_t weight_lo, weight_hi, valid_lo, valid_hi, shift, zero;
+    int32_t last;
+    int i;
+
+    if (!fir_in_range(buffer_out, output_size, readsamplesize,
+                      predictor_coef_table, predictor_coef_num))
+        return 0;
+
+    fir_load(lanes[0], lanes[1], lanes[2], 8, buffer_out,
+             predictor_coef_table, predictor_coef_num);
+    zero = vdupq_n_s32(0);
+    coef_lo = vld1q_s32(lanes[0]);
+    coef_hi = vld1q_s32(lanes[0] + 4);
+    hist_lo = vld1q_s32(lanes[1]);
+    hist_hi = vld1q_s32(lanes[1] + 4);
+    weight_lo = vld1q_s32(lanes[2]);
+    weight_hi = vld1q_s32(lanes[2] + 4);
+    valid_lo = vreinterpretq_s32_u32(vcgtq_s32(weight_lo, zero));
+    valid_hi = vreinterpretq_s32_u32(vcgtq_s32(weight_hi, zero));
+    delta_lo = zero;
+    delta_hi = zero;
+    shift = vdupq_n_s32(-predictor_quantitization);
+    last = buffer_out[predictor_coef_num];
+
+    for (i = predictor_coef_num + 1; i < output_size; i++)
+    {
+        int32_t error_val = error_buffer[i];
+        int32_t b0 = buffer_out[i-predictor_coef_num-1];
+        int32_t outval;
+        int32x4_t base, diff_lo, diff_hi, prod, signv, errv, carry;
+
+        base = vdupq_n_s32(b0);
+        diff_lo = vsubq_s32(hist_lo, base);
+        diff_hi = vsubq_s32(hist_hi, base);
+        prod = vmlaq_s32(vmulq_s32(diff_lo, coef_lo), diff_lo, delta_lo);
+        prod = vmlaq_s32(prod, diff_hi, coef_hi);
+        prod = vmlaq_s32(prod, diff_hi, delta_hi);
+        coef_lo = vaddq_s32(coef_lo, delta_lo);
+        coef_hi = vaddq_s32(coef_hi, delta_hi);
+
+        outval = fir_output(vaddvq_s32(prod) + vgetq_lane_s32(coef_hi, 3) * last,
+                            b0, error_val, readsamplesize, predictor_quantitization);
+        buffer_out[i] = outval;
+
+        hist_hi = vsetq_lane_s32(last, hist_hi, 3);
+        diff_hi = vsubq_s32(hist_hi, base);
+        signv = vdupq_n_s32((error_val > 0) - (error_val < 0));
+        errv = vdupq_n_s32(error_val);
+        carry = zero;
+        delta_lo = neon_adapt(diff_lo, signv, errv, weight_lo, valid_lo, shift, &carry);
+        delta_hi = neon_adapt(diff_hi, signv, errv, weight_hi, valid_hi, shift, &carry);
+
+        hist_lo = vextq_s32(hist_lo, hist_hi, 1);
+        hist_hi = vextq_s32(hist_hi, zero, 1);
+        last = outval;
+    }
+
+    vst1q_s32(lanes[0], vaddq_s32(coef_lo, delta_lo));
+    vst1q_s32(lanes[0] + 4, vaddq_s32(coef_hi, delta_hi));
+    fir_store(lanes[0], 8, predictor_coef_table, predictor_coef_num);
+    return 1;
+}
+
+/* Same as SSE41_DECORRELATE, negshift is the negated shift count */
+#define NEON_DECORRELATE(left, right, weight, negshift) do { \
+        int32x4_t difference = (right); \
+        (right) = vsubq_s32((left), vshlq_s32(vmulq_s32(difference, (weight)), (negshift))); \
+        (left) = vaddq_s32((right), difference); \
+    } while (0)
+
+static int
+deinterlace_16_neon(const int32_t *buffer_a, const int32_t *buffer_b,
+                    int16_t *buffer_out, int numsamples,
+                    uint8_t interlacing_shift, uint8_t interlacing_leftweight)
+{
+    int32x4_t weight = vdupq_n_s32(interlacing_leftweight);
+    int32x4_t negshift = vdupq_n_s32(-(int32_t)interlacing_shift);
+    int i;
+
+    if (interlacing_leftweight && interlacing_shift >= 32)
+        return 0;
+
+    for (i = 0; i + 4 <= numsamples; i += 4)
+    {
+        int32x4_t left = vld1q_s32(buffer_a + i);
+        int32x4_t right = vld1q_s32(buffer_b + i);
+        int16x4x2_t pair;
+
+        if (interlacing_leftweight)
+            NEON_DECORRELATE(left, right, weight, negshift);
+
+        pair.val[0] = vmovn_s32(left);
+        pair.val[1] = vmovn_s32(right);
+        vst2_s16(buffer_out + i * 2, pair);
+    }
+    return i;
+}
+
+static int
+deinterlace_24_neon(const int32_t *buffer_a, const int32_t *buffer_b,
+                    int uncompressed_bytes,
+                    const int32_t *uncompressed_bytes_buffer_a,
+                    const int32_t *uncompressed_bytes_buffer_b,
+                    uint8_t *buffer_out, int numsamples,
+                    uint8_t interlacing_shift, uint8_t interlacing_leftweight)
+{
+    static const uint8_t pack_bytes[16] = {
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 255, 255, 255, 255
+    };
+    int32x4_t weight = vdupq_n_s32(interlacing_leftweight);
+    int32x4_t negshift = vdupq_n_s32(-(int32_t)interlacing_shift);
+    int32x4_t ushift = vdupq_n_s32(uncompressed_bytes * 8);
+    int32x4_t umask = vdupq_n_s32(~(0xFFFFFFFF << (uncompressed_bytes * 8)));
+    uint8x16_t pack = vld1q_u8(pack_bytes);
+    int i;
+
+    if (interlacing_leftweight && interlacing_shift >= 32)
+        return 0;
+
+    /* Overlapping stores as in deinterlace_24_sse41 */
+    for (i = 0; i + 4 < numsamples; i += 4)
+    {
+        int32x4_t left = vld1q_s32(buffer_a + i);
+        int32x4_t right = vld1q_s32(buffer_b + i);
+        int32x4x2_t pairs;
+
+        if (interlacing_leftweight)
+            NEON_DECORRELATE(left, right, weight, negshift);
+
+        if (uncompressed_bytes)
+        {
+            left = vorrq_s32(vshlq_s32(left, ushift),
+                             vandq_s32(vld1q_s32(uncompressed_bytes_buffer_a + i), umask));
+            right = vorrq_s32(vshlq_s32(right, ushift),
+                              vandq_s32(vld1q_s32(uncompressed_bytes_buffer_b + i), umask));
+        }
+
+        pairs = vzipq_s32(left, right);
+        vst1q_u8(buffer_out + i * 6,
+                 vqtbl1q_u8(vreinterpretq_u8_s32(pairs.val[0]), pack));
+        vst1q_u8(buffer_out + i * 6 + 12,
+                 vqtbl1q_u8(vreinterpretq_u8_s32(pairs.val[1]), pack));
+    }
+    return i;
+}
+
+void
+alac_simd_init(alac_simd_t *simd)
+{
+    simd->predictor_fir_4 = predictor_fir_4_neon;
+    simd->predictor_fir_8 = predictor_fir_8_neon;
+    simd->deinterlace_16 = deinterlace_16_neon;
+    simd->deinterlace_24 = deinterlace_24_neon;
+}
+
+#else
+
+void
+alac_simd_init(alac_simd_t *simd)
+{
+    memset(simd, 0, sizeof(alac_simd_t));
+}
+
+#endif
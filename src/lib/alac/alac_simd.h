@@ -0,0 +1,75 @@
+/**
+ *  Copyright (C) 2011-2012  Juho Vähä-Herttua
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+#ifndef ALAC_SIMD_H
+#define ALAC_SIMD_H
+
+#ifdef _WIN32
+	#include "stdint_win.h"
+#else
+	#include <stdint.h>
+#endif
+
+#if (defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))) || \
+    (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)))
+#define ALAC_SIMD_X86 1
+#elif defined(__ARM_NEON) && defined(__aarch64__) && !defined(__ARM_BIG_ENDIAN)
+#define ALAC_SIMD_NEON 1
+#endif
+
+/* Runs the adaptive FIR after the warm-up samples, arguments are the same
+ * as for predictor_decompress_fir_adapt in alac.c. Returns 0 without
+ * touching the buffers if the frame is outside the range where the kernel
+ * is exact, the scalar code has to be used then. */
+typedef int (*alac_simd_fir_t)(const int32_t *error_buffer,
+                               int32_t *buffer_out,
+                               int output_size,
+                               int readsamplesize,
+                               int16_t *predictor_coef_table,
+                               int predictor_coef_num,
+                               int predictor_quantitization);
+
+/* Stereo decorrelation and interleave to little endian output, arguments
+ * are the same as for deinterlace_16 and deinterlace_24 in alac.c. Returns
+ * the number of samples written, the scalar code finishes the rest. */
+typedef int (*alac_simd_deinterlace_16_t)(const int32_t *buffer_a,
+                                          const int32_t *buffer_b,
+                                          int16_t *buffer_out,
+                                          int numsamples,
+                                          uint8_t interlacing_shift,
+                                          uint8_t interlacing_leftweight);
+typedef int (*alac_simd_deinterlace_24_t)(const int32_t *buffer_a,
+                                          const int32_t *buffer_b,
+                                          int uncompressed_bytes,
+                                          const int32_t *uncompressed_bytes_buffer_a,
+                                          const int32_t *uncompressed_bytes_buffer_b,
+                                          uint8_t *buffer_out,
+                                          int numsamples,
+                                          uint8_t interlacing_shift,
+                                          uint8_t interlacing_leftweight);
+
+typedef struct alac_simd_s {
+	/* Up to 4 and up to 8 coefficients */
+	alac_simd_fir_t predictor_fir_4;
+	alac_simd_fir_t predictor_fir_8;
+
+	/* Two channel output only */
+	alac_simd_deinterlace_16_t deinterlace_16;
+	alac_simd_deinterlace_24_t deinterlace_24;
+} alac_simd_t;
+
+/* Fills in the kernels supported by this CPU, the rest are NULL */
+void alac_simd_init(alac_simd_t *simd);
+
+#endif
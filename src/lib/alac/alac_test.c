@@ -0,0 +1,410 @@
+/**
+ *  Copyright (C) 2011-2012  Juho Vähä-Herttua
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+/* Checks that the vector kernels selected by alac_simd_init give exactly
+ * the output of the scalar loops in alac.c, which is included here to
+ * reach its static functions, and that frames from alac_encoder decode
+ * back to the exact input. Run by make check. */
+
+#include "alac.c"
+#include "alac_encoder.h"
+
+#define TEST_FIR_FRAMES         100000
+#define TEST_DEINTERLACE_FRAMES 20000
+#define TEST_CORPUS_FRAMES      240
+#define TEST_MAX_SAMPLES        4096
+
+/* Bytes past the output that the kernels must leave alone */
+#define TEST_GUARD_BYTES        32
+
+static uint32_t test_state = 2463534242u;
+
+/* xorshift32, the same sequence on every run and platform */
+static uint32_t
+test_random(void)
+{
+	test_state ^= test_state << 13;
+	test_state ^= test_state >> 17;
+	test_state ^= test_state << 5;
+	return test_state;
+}
+
+static int32_t
+test_random_range(int32_t max)
+{
+	return (int32_t) (test_random() % (2 * (uint32_t) max + 1)) - max;
+}
+
+/* Runs the warm-up of predictor_decompress_fir_adapt and then the kernel
+ * alone, returns 0 if the kernel leaves the frame to the scalar loop */
+static int
+test_fir_accepted(alac_simd_fir_t kernel, int32_t *error_buffer, int output_size,
+                  int readsamplesize, const int16_t *coefs, int coef_num, int quantization)
+{
+	static int32_t buffer_out[TEST_MAX_SAMPLES];
+	int16_t table[32];
+	int i;
+
+	memcpy(table, coefs, coef_num * sizeof(int16_t));
+	buffer_out[0] = error_buffer[0];
+	for (i=0; i<coef_num; i++) {
+		int32_t val = buffer_out[i] + error_buffer[i+1];
+		buffer_out[i+1] = SIGN_EXTENDED32(val, readsamplesize);
+	}
+	return kernel(error_buffer, buffer_out, output_size, readsamplesize,
+	              table, coef_num, quantization);
+}
+
+static int
+test_fir(const alac_simd_t *simd)
+{
+	static int32_t error_buffer[TEST_MAX_SAMPLES];
+	static int32_t expected[TEST_MAX_SAMPLES];
+	static int32_t output[TEST_MAX_SAMPLES];
+	alac_simd_t scalar;
+	int accepted = 0, refused = 0;
+	int failures = 0;
+	int frame;
+
+	memset(&scalar, 0, sizeof(scalar));
+	for (frame=0; frame<TEST_FIR_FRAMES; frame++) {
+		int16_t coefs[32], expected_coefs[32], output_coefs[32];
+		alac_simd_fir_t kernel;
+		int coef_num, output_size, readsamplesize, quantization;
+		int32_t error_max;
+		int i;
+
+		/* Mostly the 4 and 8 coefficients of real streams, some of the
+		 * sizes below them and the generic loop above 8 */
+		switch (test_random() % 4) {
+		case 0: coef_num = 4; break;
+		case 1: coef_num = 8; break;
+		case 2: coef_num = 1 + test_random() % 8; break;
+		default: coef_num = 1 + test_random() % 16; break;
+		}
+		output_size = coef_num + 1 + test_random() % 400;
+		if (test_random() % 16 == 0) {
+			output_size = 352;
+		}
+		quantization = 1 + test_random() % 15;
+
+		/* 17 and 25 bits are the stereo 16 and 24-bit streams, the wider
+		 * ones are past the range of the kernels */
+		switch (test_random() % 4) {
+		case 0: readsamplesize = 17; break;
+		case 1: readsamplesize = 16 + test_random() % 10; break;
+		case 2: readsamplesize = 25; break;
+		default: readsamplesize = 16 + test_random() % 17; break;
+		}
+
+		/* Coefficients next to the int16 limits are left to the scalar loop */
+		for (i=0; i<coef_num; i++) {
+			if (test_random() % 32 == 0) {
+				coefs[i] = (test_random() & 1) ? 32767 - test_random() % 800 : -32768 + test_random() % 800;
+			} else {
+				coefs[i] = test_random_range(1000);
+			}
+		}
+
+		error_max = 1 << (test_random() % (readsamplesize - 1));
+		for (i=0; i<output_size; i++) {
+			error_buffer[i] = (test_random() % 4) ? test_random_range(error_max) : 0;
+		}
+		/* A first sample outside the sample size is left to the scalar loop */
+		if (test_random() % 32 == 0) {
+			error_buffer[0] = (int32_t) test_random();
+		} else {
+			error_buffer[0] = SIGN_EXTENDED32(error_buffer[0], readsamplesize);
+		}
+
+		memcpy(expected_coefs, coefs, sizeof(coefs));
+		memcpy(output_coefs, coefs, sizeof(coefs));
+		predictor_decompress_fir_adapt(&scalar, error_buffer, expected, output_size,
+		                               readsamplesize, expected_coefs, coef_num, quantization);
+		predictor_decompress_fir_adapt(simd, error_buffer, output, output_size,
+		                               readsamplesize, output_coefs, coef_num, quantization);
+		if (memcmp(expected, output, output_size * sizeof(int32_t)) ||
+		    memcmp(expected_coefs, output_coefs, coef_num * sizeof(int16_t))) {
+			if (failures++ < 10) {
+				printf("fir: mismatch with %d coefficients, %d samples of %d bits, quantization %d\n",
+				       coef_num, output_size, readsamplesize, quantization);
+			}
+		}
+
+		/* Count the frames each kernel takes to see both paths are run */
+		kernel = (coef_num <= 4 && simd->predictor_fir_4) ? simd->predictor_fir_4 : simd->predictor_fir_8;
+		if (coef_num <= 8 && kernel) {
+			if (test_fir_accepted(kernel, error_buffer, output_size, readsamplesize,
+			                      coefs, coef_num, quantization)) {
+				accepted++;
+			} else {
+				refused++;
+			}
+		}
+	}
+
+	printf("fir: %d frames, %d by the kernels, %d left to the scalar loop, %d mismatches\n",
+	       TEST_FIR_FRAMES, accepted, refused, failures);
+	if (simd->predictor_fir_4 && simd->predictor_fir_8 && (!accepted || !refused)) {
+		printf("fir: the kernel and the scalar fallback were not both tested\n");
+		failures++;
+	}
+	return failures;
+}
+
+/* Fills the channels of a stereo frame of readsamplesize bits, with the
+ * difference small enough that the weighting does not overflow */
+static void
+test_fill_channels(int32_t *buffer_a, int32_t *buffer_b, int numsamples, int readsamplesize)
+{
+	int32_t max = (1 << (readsamplesize - 1)) - 1;
+	int i;
+
+	for (i=0; i<numsamples; i++) {
+		buffer_a[i] = test_random_range(max);
+		buffer_b[i] = test_random_range(max < (1 << 22) ? max : (1 << 22));
+	}
+}
+
+static int
+test_deinterlace(const alac_simd_t *simd)
+{
+	static int32_t buffer_a[TEST_MAX_SAMPLES];
+	static int32_t buffer_b[TEST_MAX_SAMPLES];
+	static int32_t uncompressed_a[TEST_MAX_SAMPLES];
+	static int32_t uncompressed_b[TEST_MAX_SAMPLES];
+	static uint8_t expected[TEST_MAX_SAMPLES * 6 + TEST_GUARD_BYTES];
+	static uint8_t output[TEST_MAX_SAMPLES * 6 + TEST_GUARD_BYTES];
+	alac_simd_t scalar;
+	int failures = 0;
+	int frame;
+
+	memset(&scalar, 0, sizeof(scalar));
+	for (frame=0; frame<TEST_DEINTERLACE_FRAMES; frame++) {
+		int numsamples, uncompressed_bytes, outbytes, i;
+		uint8_t interlacing_shift, interlacing_leftweight;
+
+		/* Lengths that are not a multiple of the vector width too */
+		numsamples = (test_random() % 8) ? (int) (test_random() % 400) : 352;
+		interlacing_shift = test_random() % 32;
+		interlacing_leftweight = (test_random() % 2) ? 0 : 1 + test_random() % 255;
+		if (test_random() % 4 == 0) {
+			interlacing_shift = 2;
+			interlacing_leftweight = 2;
+		}
+
+		if (frame % 2 == 0) {
+			test_fill_channels(buffer_a, buffer_b, numsamples, 17);
+			outbytes = numsamples * 4;
+			memset(expected, 0xaa, outbytes + TEST_GUARD_BYTES);
+			memset(output, 0xaa, outbytes + TEST_GUARD_BYTES);
+			deinterlace_16(&scalar, buffer_a, buffer_b, (int16_t *) expected, 2, numsamples,
+			               interlacing_shift, interlacing_leftweight);
+			deinterlace_16(simd, buffer_a, buffer_b, (int16_t *) output, 2, numsamples,
+			               interlacing_shift, interlacing_leftweight);
+		} else {
+			uncompressed_bytes = test_random() % 3;
+			test_fill_channels(buffer_a, buffer_b, numsamples, 25 - uncompressed_bytes * 8);
+			for (i=0; i<numsamples; i++) {
+				uncompressed_a[i] = (int32_t) test_random();
+				uncompressed_b[i] = (int32_t) test_random();
+			}
+			outbytes = numsamples * 6;
+			memset(expected, 0xaa, outbytes + TEST_GUARD_BYTES);
+			memset(output, 0xaa, outbytes + TEST_GUARD_BYTES);
+			deinterlace_24(&scalar, buffer_a, buffer_b, uncompressed_bytes,
+			               uncompressed_a, uncompressed_b, expected, 2, numsamples,
+			               interlacing_shift, interlacing_leftweight);
+			deinterlace_24(simd, buffer_a, buffer_b, uncompressed_bytes,
+			               uncompressed_a, uncompressed_b, output, 2, numsamples,
+			               interlacing_shift, interlacing_leftweight);
+		}
+		if (memcmp(expected, output, outbytes + TEST_GUARD_BYTES)) {
+			if (failures++ < 10) {
+				printf("deinterlace: mismatch in %d-bit output of %d samples, shift %d, weight %d\n",
+				       (frame % 2) ? 24 : 16, numsamples, interlacing_shift, interlacing_leftweight);
+			}
+		}
+	}
+
+	printf("deinterlace: %d frames, %d mismatches\n", TEST_DEINTERLACE_FRAMES, failures);
+	return failures;
+}
+
+/* Sample of the corpus, the kind of signal changes every 20 frames */
+static int32_t
+test_corpus_sample(int kind, int samplesize, int channel, int position, int32_t *state)
+{
+	int32_t max = (1 << (samplesize - 1)) - 1;
+	int32_t value;
+
+	switch (kind) {
+	case 0:
+		/* Triangle tones, the right channel follows the left one */
+		value = (position * 7) % 512;
+		value = (value < 256 ? value : 511 - value) - 128;
+		value = value * (max / 512);
+		if (channel) {
+			value = value / 4 * 3;
+		}
+		return value + test_random_range(max >> 12);
+	case 1:
+		/* Full scale noise does not compress */
+		return test_random_range(max);
+	case 2:
+		/* Silence with a few clicks gives long runs of zeros */
+		return (test_random() % 64) ? 0 : test_random_range(3);
+	case 3:
+		/* Full scale square waves give rice values past the escape */
+		value = ((position / 50) % 2) ? max : -max;
+		return channel ? -value : value;
+	default:
+		/* Random walk */
+		*state += test_random_range(max >> 10);
+		if (*state > max || *state < -max) {
+			*state /= 2;
+		}
+		return *state;
+	}
+}
+
+static int
+test_corpus_format(const alac_simd_t *simd, int samplesize, int numchannels, int frame_length)
+{
+	static unsigned char input[4096 * 6];
+	static unsigned char output[4096 * 6 + TEST_GUARD_BYTES];
+	alac_encoder_t *encoder;
+	alac_file *decoders[3];
+	unsigned char *frame;
+	char info[48];
+	int32_t state[2] = { 0, 0 };
+	int samplebytes = samplesize / 8;
+	int framebytes, compressed = 0;
+	int failures = 0;
+	int i, d;
+
+	encoder = alac_encoder_init(samplesize, numchannels, frame_length, 44100);
+	if (!encoder) {
+		printf("corpus: could not create encoder\n");
+		return 1;
+	}
+	alac_encoder_get_info(encoder, info);
+	framebytes = alac_encoder_get_max_frame_bytes(encoder);
+	frame = malloc(framebytes);
+
+	/* Kernels and the specialized decoder, kernels alone, scalar only */
+	for (d=0; d<3; d++) {
+		decoders[d] = create_alac(samplesize, numchannels);
+		alac_set_info(decoders[d], info);
+	}
+	memset(&decoders[2]->simd, 0, sizeof(alac_simd_t));
+
+	for (i=0; i<TEST_CORPUS_FRAMES; i++) {
+		int kind = (i / 20) % 5;
+		int samples = frame_length;
+		int position, c, b;
+		int framesize;
+
+		/* Partial frames end each part of the corpus */
+		if (i % 20 == 19) {
+			samples = 1 + test_random() % frame_length;
+		}
+		for (position=0; position<samples; position++) {
+			for (c=0; c<numchannels; c++) {
+				int32_t value = test_corpus_sample(kind, samplesize, c, i * frame_length + position, &state[c]);
+				unsigned char *ptr = input + (position * numchannels + c) * samplebytes;
+
+				for (b=0; b<samplebytes; b++) {
+					ptr[b] = (value >> (b * 8)) & 0xff;
+				}
+			}
+		}
+
+		framesize = alac_encoder_encode(encoder, input, samples, frame, framebytes);
+		if (framesize < 0) {
+			printf("corpus: could not encode frame %d\n", i);
+			failures++;
+			break;
+		}
+		if (framesize < samples * numchannels * samplebytes) {
+			compressed++;
+		}
+
+		for (d=0; d<3; d++) {
+			int outputsize = 0;
+
+			memset(output, 0xaa, sizeof(output));
+			if (d == 0) {
+				decode_frame_stereo16_352(decoders[d], frame, framesize, output, &outputsize);
+			} else {
+				decode_frame(decoders[d], frame, framesize, output, &outputsize);
+			}
+			if (outputsize != samples * numchannels * samplebytes ||
+			    memcmp(input, output, outputsize) ||
+			    output[outputsize] != 0xaa) {
+				if (failures++ < 10) {
+					printf("corpus: %d-bit %d channel frame %d of %d samples differs from the input\n",
+					       samplesize, numchannels, i, samples);
+				}
+			}
+		}
+	}
+
+	printf("corpus: %d-bit %d channel %d sample frames, %d of %d compressed, %d mismatches\n",
+	       samplesize, numchannels, frame_length, compressed, TEST_CORPUS_FRAMES, failures);
+	if (!compressed || compressed == TEST_CORPUS_FRAMES) {
+		printf("corpus: both compressed and uncompressed frames were not tested\n");
+		failures++;
+	}
+
+	for (d=0; d<3; d++) {
+		destroy_alac(decoders[d]);
+	}
+	free(frame);
+	alac_encoder_destroy(encoder);
+	return failures;
+}
+
+static int
+test_corpus(const alac_simd_t *simd)
+{
+	int failures = 0;
+
+	failures += test_corpus_format(simd, 16, 2, 352);
+	failures += test_corpus_format(simd, 16, 1, 352);
+	failures += test_corpus_format(simd, 24, 2, 352);
+	failures += test_corpus_format(simd, 24, 1, 352);
+	failures += test_corpus_format(simd, 16, 2, 4096);
+	failures += test_corpus_format(simd, 24, 2, 4096);
+	return failures;
+}
+
+int
+main(void)
+{
+	alac_simd_t simd;
+	int failures = 0;
+
+	alac_simd_init(&simd);
+	printf("kernels: fir 4 %s, fir 8 %s, deinterlace 16 %s, deinterlace 24 %s\n",
+	       simd.predictor_fir_4 ? "yes" : "no",
+	       simd.predictor_fir_8 ? "yes" : "no",
+	       simd.deinterlace_16 ? "yes" : "no",
+	       simd.deinterlace_24 ? "yes" : "no");
+
+	failures += test_fir(&simd);
+	failures += test_deinterlace(&simd);
+	failures += test_corpus(&simd);
+	return failures ? 1 : 0;
+}
@@ -75,6 +75,7 @@ base64_init(const char *charlist, int use_padding, int skip_spaces)
 	strncpy(base64->charlist, charlist, sizeof(base64->charlist)-1);
 	base64->use_padding = use_padding;
 	base64->skip_spaces = skip_spaces;
+	initialize_charmap(base64);
 
 	return base64;
 }
@@ -159,14 +160,18 @@ base64_encode(base64_t *base64, char *dst, const unsigned char *src, int srclen)
 }
 
 int
-base64_decode(base64_t *base64, unsigned char **dst, const char *src, int srclen)
+base64_decoded_length(base64_t *base64, int srclen)
 {
-	char *inbuf;
-	int inbuflen;
-	unsigned char *outbuf;
-	int outbuflen;
-	char *srcptr;
+	return (srclen+3)/4*3;
+}
+
+int
+base64_decode_buf(base64_t *base64, unsigned char *dst, int dstlen, const char *src, int srclen)
+{
+	unsigned char quad[4];
+	int count, padding;
 	int index;
+	int i;
 
 	if (!base64) {
 		base64 = &default_base64;
@@ -175,106 +180,79 @@ base64_decode(base64_t *base64, unsigned char **dst, const char *src, int srclen
 		initialize_charmap(base64);
 	}
 
-	inbuf = malloc(srclen+4);
-	if (!inbuf) {
-		return -1;
-	}
-	memcpy(inbuf, src, srclen);
-	inbuf[srclen] = '\0';
+	count = 0;
+	padding = 0;
+	index = 0;
+	for (i=0; i<=srclen; i++) {
+		unsigned char c;
 
-	/* Remove all whitespaces from inbuf */
-	if (base64->skip_spaces) {
-		int i, inbuflen = strlen(inbuf);
-		for (i=0; i<inbuflen; i++) {
-			if (inbuf[i] == '\0') {
-				break;
-			} else if (isspace(inbuf[i])) {
-				memmove(inbuf+i, inbuf+i+1, inbuflen-i);
-				inbuflen -= 1;
-				i -= 1;
+		if (i < srclen && src[i]) {
+			if (base64->skip_spaces && isspace((unsigned char)src[i])) {
+				continue;
+			}
+			c = base64->charmap[(unsigned char)src[i]];
+			if (c == BASE64_INVALID) {
+				return -5;
 			}
+		} else if (count%4 == 0) {
+			break;
+		} else if (base64->use_padding) {
+			/* Make sure data is divisible by 4 */
+			return -3;
+		} else if (count%4 == 1) {
+			return -2;
+		} else {
+			/* Add the missing padding */
+			c = BASE64_PADDING;
+			i--;
 		}
-	}
 
-	/* Add padding to inbuf if required */
-	inbuflen = strlen(inbuf);
-	if (!base64->use_padding) {
-		if (inbuflen%4 == 1) {
-			free(inbuf);
-			return -2;
+		if (c == BASE64_PADDING && count%4 < 2) {
+			return -6;
 		}
-		if (inbuflen%4 == 2) {
-			inbuf[inbuflen] = '=';
-			inbuf[inbuflen+1] = '=';
-			inbuf[inbuflen+2] = '\0';
-			inbuflen += 2;
-		} else if (inbuflen%4 == 3) {
-			inbuf[inbuflen] = '=';
-			inbuf[inbuflen+1] = '\0';
-			inbuflen += 1;
+		if (padding && c != BASE64_PADDING) {
+			/* Data is only allowed before the padding */
+			return -7;
+		}
+		if (c == BASE64_PADDING) {
+			padding++;
+		}
+		quad[count++%4] = c;
+		if (count%4) {
+			continue;
 		}
-	}
-
-	/* Make sure data is divisible by 4 */
-	if (inbuflen%4 != 0) {
-		free(inbuf);
-		return -3;
-	}
 
-	/* Calculate the output length without padding */
-	outbuflen = inbuflen/4*3;
-	if (inbuflen >= 4 && inbuf[inbuflen-1] == '=') {
-		outbuflen -= 1;
-		if (inbuf[inbuflen-2] == '=') {
-			outbuflen -= 1;
+		if (index+3-padding > dstlen) {
+			return -4;
+		}
+		dst[index++] = (quad[0] << 2) | ((quad[1] & 0x30) >> 4);
+		if (quad[2] != BASE64_PADDING) {
+			dst[index++] = ((quad[1] & 0x0f) << 4) | ((quad[2] & 0x3c) >> 2);
+		}
+		if (quad[3] != BASE64_PADDING) {
+			dst[index++] = ((quad[2] & 0x03) << 6) | quad[3];
 		}
 	}
+	return index;
+}
+
+int
+base64_decode(base64_t *base64, unsigned char **dst, const char *src, int srclen)
+{
+	unsigned char *outbuf;
+	int outbuflen;
 
 	/* Allocate buffer for outputting data */
-	outbuf = malloc(outbuflen);
+	outbuf = malloc(base64_decoded_length(base64, srclen)+1);
 	if (!outbuf) {
-		free(inbuf);
 		return -4;
 	}
 
-	index = 0;
-	srcptr = inbuf;
-	while (*srcptr) {
-		unsigned char a = base64->charmap[(unsigned char)*(srcptr++)];
-		unsigned char b = base64->charmap[(unsigned char)*(srcptr++)];
-		unsigned char c = base64->charmap[(unsigned char)*(srcptr++)];
-		unsigned char d = base64->charmap[(unsigned char)*(srcptr++)];
-
-		if (a == BASE64_INVALID || b == BASE64_INVALID ||
-		    c == BASE64_INVALID || d == BASE64_INVALID) {
-			return -5;
-		}
-		if (a == BASE64_PADDING || b == BASE64_PADDING) {
-			return -6;
-		}
-
-		/* Update the first byte */
-		outbuf[index++] = (a << 2) | ((b & 0x30) >> 4);
-
-		/* Update the second byte */
-		if (c == BASE64_PADDING) {
-			break;
-		}
-		outbuf[index++] = ((b & 0x0f) << 4) | ((c & 0x3c) >> 2);
-
-		/* Update the third byte */
-		if (d == BASE64_PADDING) {
-			break;
-		}
-		outbuf[index++] = ((c & 0x03) << 6) | d;
-	}
-	if (index != outbuflen) {
-		free(inbuf);
+	outbuflen = base64_decode_buf(base64, outbuf, base64_decoded_length(base64, srclen), src, srclen);
+	if (outbuflen < 0) {
 		free(outbuf);
-		return -7;
+		return outbuflen;
 	}
-
-	free(inbuf);
 	*dst = outbuf;
 	return outbuflen;
 }
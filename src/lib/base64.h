@@ -22,7 +22,10 @@ base64_t *base64_init(const char *charlist, int use_padding, int skip_spaces);
 int base64_encoded_length(base64_t *base64, int srclen);
 
 int base64_encode(base64_t *base64, char *dst, const unsigned char *src, int srclen);
+int base64_decoded_length(base64_t *base64, int srclen);
+
 int base64_decode(base64_t *base64, unsigned char **dst, const char *src, int srclen);
+int base64_decode_buf(base64_t *base64, unsigned char *dst, int dstlen, const char *src, int srclen);
 
 void base64_destroy(base64_t *base64);
 
@@ -32,6 +32,9 @@
  * AES implementation - this is a small code version. There are much faster
  * versions around but they are much larger in size (i.e. they use large 
  * submix tables).
+ *
+ * Decryption uses a single 1KB table combining the inverse S-box and
+ * InvMixColumn, define CONFIG_AES_SMALL to compute everything on the fly.
  */
 
 #include <string.h>
@@ -45,6 +48,12 @@
 #define rot2(x) (((x) << 16) | ((x) >> 16))
 #define rot3(x) (((x) <<  8) | ((x) >> 24))
 
+/* Big endian word access that works for unaligned buffers */
+#define GET_U32(p) (((uint32_t)(p)[0]<<24)|((uint32_t)(p)[1]<<16)|\
+                    ((uint32_t)(p)[2]<<8)|((uint32_t)(p)[3]))
+#define PUT_U32(p,v) ((p)[0]=(uint8_t)((v)>>24),(p)[1]=(uint8_t)((v)>>16),\
+                      (p)[2]=(uint8_t)((v)>>8),(p)[3]=(uint8_t)(v))
+
 /* 
  * This cute trick does 4 'mul by two' at once.  Stolen from
  * Dr B. R. Gladman <brg@gladman.uk.net> but I'm sure the u-(u>>7) is
@@ -153,6 +162,80 @@ static const uint8_t aes_isbox[256] =
     0xe1,0x69,0x14,0x63,0x55,0x21,0x0c,0x7d
 };
 
+#ifndef CONFIG_AES_SMALL
+/*
+ * Inverse round table, the inverse S-box combined with InvMixColumn.
+ * The tables for the other byte positions are rotations of this one.
+ */
+static const uint32_t aes_td0[256] =
+{
+    0x51f4a750,0x7e416553,0x1a17a4c3,0x3a275e96,
+    0x3bab6bcb,0x1f9d45f1,0xacfa58ab,0x4be30393,
+    0x2030fa55,0xad766df6,0x88cc7691,0xf5024c25,
+    0x4fe5d7fc,0xc52acbd7,0x26354480,0xb562a38f,
+    0xdeb15a49,0x25ba1b67,0x45ea0e98,0x5dfec0e1,
+    0xc32f7502,0x814cf012,0x8d4697a3,0x6bd3f9c6,
+    0x038f5fe7,0x15929c95,0xbf6d7aeb,0x955259da,
+    0xd4be832d,0x587421d3,0x49e06929,0x8ec9c844,
+    0x75c2896a,0xf48e7978,0x99583e6b,0x27b971dd,
+    0xbee14fb6,0xf088ad17,0xc920ac66,0x7dce3ab4,
+    0x63df4a18,0xe51a3182,0x97513360,0x62537f45,
+    0xb16477e0,0xbb6bae84,0xfe81a01c,0xf9082b94,
+    0x70486858,0x8f45fd19,0x94de6c87,0x527bf8b7,
+    0xab73d323,0x724b02e2,0xe31f8f57,0x6655ab2a,
+    0xb2eb2807,0x2fb5c203,0x86c57b9a,0xd33708a5,
+    0x302887f2,0x23bfa5b2,0x02036aba,0xed16825c,
+    0x8acf1c2b,0xa779b492,0xf307f2f0,0x4e69e2a1,
+    0x65daf4cd,0x0605bed5,0xd134621f,0xc4a6fe8a,
+    0x342e539d,0xa2f355a0,0x058ae132,0xa4f6eb75,
+    0x0b83ec39,0x4060efaa,0x5e719f06,0xbd6e1051,
+    0x3e218af9,0x96dd063d,0xdd3e05ae,0x4de6bd46,
+    0x91548db5,0x71c45d05,0x0406d46f,0x605015ff,
+    0x1998fb24,0xd6bde997,0x894043cc,0x67d99e77,
+    0xb0e842bd,0x07898b88,0xe7195b38,0x79c8eedb,
+    0xa17c0a47,0x7c420fe9,0xf8841ec9,0x00000000,
+    0x09808683,0x322bed48,0x1e1170ac,0x6c5a724e,
+    0xfd0efffb,0x0f853856,0x3daed51e,0x362d3927,
+    0x0a0fd964,0x685ca621,0x9b5b54d1,0x24362e3a,
+    0x0c0a67b1,0x9357e70f,0xb4ee96d2,0x1b9b919e,
+    0x80c0c54f,0x61dc20a2,0x5a774b69,0x1c121a16,
+    0xe293ba0a,0xc0a02ae5,0x3c22e043,0x121b171d,
+    0x0e090d0b,0xf28bc7ad,0x2db6a8b9,0x141ea9c8,
+    0x57f11985,0xaf75074c,0xee99ddbb,0xa37f60fd,
+    0xf701269f,0x5c72f5bc,0x44663bc5,0x5bfb7e34,
+    0x8b432976,0xcb23c6dc,0xb6edfc68,0xb8e4f163,
+    0xd731dcca,0x42638510,0x13972240,0x84c61120,
+    0x854a247d,0xd2bb3df8,0xaef93211,0xc729a16d,
+    0x1d9e2f4b,0xdcb230f3,0x0d8652ec,0x77c1e3d0,
+    0x2bb3166c,0xa970b999,0x119448fa,0x47e96422,
+    0xa8fc8cc4,0xa0f03f1a,0x567d2cd8,0x223390ef,
+    0x87494ec7,0xd938d1c1,0x8ccaa2fe,0x98d40b36,
+    0xa6f581cf,0xa57ade28,0xdab78e26,0x3fadbfa4,
+    0x2c3a9de4,0x5078920d,0x6a5fcc9b,0x547e4662,
+    0xf68d13c2,0x90d8b8e8,0x2e39f75e,0x82c3aff5,
+    0x9f5d80be,0x69d0937c,0x6fd52da9,0xcf2512b3,
+    0xc8ac993b,0x10187da7,0xe89c636e,0xdb3bbb7b,
+    0xcd267809,0x6e5918f4,0xec9ab701,0x834f9aa8,
+    0xe6956e65,0xaaffe67e,0x21bccf08,0xef15e8e6,
+    0xbae79bd9,0x4a6f36ce,0xea9f09d4,0x29b07cd6,
+    0x31a4b2af,0x2a3f2331,0xc6a59430,0x35a266c0,
+    0x744ebc37,0xfc82caa6,0xe090d0b0,0x33a7d815,
+    0xf104984a,0x41ecdaf7,0x7fcd500e,0x1791f62f,
+    0x764dd68d,0x43efb04d,0xccaa4d54,0xe49604df,
+    0x9ed1b5e3,0x4c6a881b,0xc12c1fb8,0x4665517f,
+    0x9d5eea04,0x018c355d,0xfa877473,0xfb0b412e,
+    0xb3671d5a,0x92dbd252,0xe9105633,0x6dd64713,
+    0x9ad7618c,0x37a10c7a,0x59f8148e,0xeb133c89,
+    0xcea927ee,0xb761c935,0xe11ce5ed,0x7a47b13c,
+    0x9cd2df59,0x55f2733f,0x1814ce79,0x73c737bf,
+    0x53f7cdea,0x5ffdaa5b,0xdf3d6f14,0x7844db86,
+    0xcaaff381,0xb968c43e,0x3824342c,0xc2a3405f,
+    0x161dc372,0xbce2250c,0x283c498b,0xff0d9541,
+    0x39a80171,0x080cb3de,0xd8b4e49c,0x6456c190,
+    0x7bcb8461,0xd532b670,0x486c5c74,0xd0b85742,
+};
+#endif
+
 static const unsigned char Rcon[30]=
 {
 	0x01,0x02,0x04,0x08,0x10,0x20,0x40,0x80,
@@ -307,45 +390,54 @@ void AES_cbc_encrypt(AES_CTX *ctx, const uint8_t *msg, uint8_t *out, int length)
 
 /**
  * Decrypt a byte sequence (with a block size 16) using the AES cipher.
+ * The output may be the same buffer as the input.
  */
 void AES_cbc_decrypt(AES_CTX *ctx, const uint8_t *msg, uint8_t *out, int length)
+{
+#if defined(CONFIG_AES_NI)
+    if (AES_ni_available())
+    {
+        AES_ni_cbc_decrypt(ctx, msg, out, length);
+        return;
+    }
+#endif
+
+    AES_cbc_decrypt_portable(ctx, msg, out, length);
+}
+
+/**
+ * Decrypt with the portable code even if the CPU has faster instructions,
+ * the benchmarks compare the two.
+ */
+void AES_cbc_decrypt_portable(AES_CTX *ctx, const uint8_t *msg, uint8_t *out, int length)
 {
     int i;
-    uint32_t tin[4], xor[4], tout[4], data[4], iv[4];
+    uint32_t tin[4], xor[4], data[4];
 
-    memcpy(iv, ctx->iv, AES_IV_SIZE);
     for (i = 0; i < 4; i++)
-        xor[i] = ntohl(iv[i]);
+        xor[i] = GET_U32(ctx->iv+i*4);
 
-    for (length -= 16; length >= 0; length -= 16)
+    for (; length >= AES_BLOCKSIZE; length -= AES_BLOCKSIZE)
     {
-        uint32_t msg_32[4];
-        uint32_t out_32[4];
-        memcpy(msg_32, msg, AES_BLOCKSIZE);
-        msg += AES_BLOCKSIZE;
-
         for (i = 0; i < 4; i++)
         {
-            tin[i] = ntohl(msg_32[i]);
+            tin[i] = GET_U32(msg+i*4);
             data[i] = tin[i];
         }
+        msg += AES_BLOCKSIZE;
 
         AES_decrypt(ctx, data);
 
         for (i = 0; i < 4; i++)
         {
-            tout[i] = data[i]^xor[i];
+            PUT_U32(out+i*4, data[i]^xor[i]);
             xor[i] = tin[i];
-            out_32[i] = htonl(tout[i]);
         }
-
-        memcpy(out, out_32, AES_BLOCKSIZE);
         out += AES_BLOCKSIZE;
     }
 
     for (i = 0; i < 4; i++)
-        iv[i] = htonl(xor[i]);
-    memcpy(ctx->iv, iv, AES_IV_SIZE);
+        PUT_U32(ctx->iv+i*4, xor[i]);
 }
 
 /**
@@ -398,6 +490,58 @@ static void AES_encrypt(const AES_CTX *ctx, uint32_t *data)
     }
 }
 
+#ifndef CONFIG_AES_SMALL
+/**
+ * Decrypt a single block (16 bytes) of data using the inverse round table
+ */
+static void AES_decrypt(const AES_CTX *ctx, uint32_t *data)
+{
+    uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+    int curr_rnd;
+    int rounds = ctx->rounds;
+    const uint32_t *k = ctx->ks + rounds*4;
+
+    /* pre-round key addition */
+    s0 = data[0] ^ k[0];
+    s1 = data[1] ^ k[1];
+    s2 = data[2] ^ k[2];
+    s3 = data[3] ^ k[3];
+
+    /* All rounds except the last one, keys were converted for these */
+    for (curr_rnd = 1; curr_rnd < rounds; curr_rnd++)
+    {
+        k -= 4;
+        t0 = aes_td0[s0>>24] ^ rot1(aes_td0[(s3>>16)&0xFF]) ^
+             rot2(aes_td0[(s2>>8)&0xFF]) ^ rot3(aes_td0[s1&0xFF]) ^ k[0];
+        t1 = aes_td0[s1>>24] ^ rot1(aes_td0[(s0>>16)&0xFF]) ^
+             rot2(aes_td0[(s3>>8)&0xFF]) ^ rot3(aes_td0[s2&0xFF]) ^ k[1];
+        t2 = aes_td0[s2>>24] ^ rot1(aes_td0[(s1>>16)&0xFF]) ^
+             rot2(aes_td0[(s0>>8)&0xFF]) ^ rot3(aes_td0[s3&0xFF]) ^ k[2];
+        t3 = aes_td0[s3>>24] ^ rot1(aes_td0[(s2>>16)&0xFF]) ^
+             rot2(aes_td0[(s1>>8)&0xFF]) ^ rot3(aes_td0[s0&0xFF]) ^ k[3];
+        s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+    }
+
+    /* Last round has no InvMixColumn */
+    k -= 4;
+    data[0] = ((uint32_t)aes_isbox[s0>>24]<<24 ^
+               (uint32_t)aes_isbox[(s3>>16)&0xFF]<<16 ^
+               (uint32_t)aes_isbox[(s2>>8)&0xFF]<<8 ^
+               (uint32_t)aes_isbox[s1&0xFF]) ^ k[0];
+    data[1] = ((uint32_t)aes_isbox[s1>>24]<<24 ^
+               (uint32_t)aes_isbox[(s0>>16)&0xFF]<<16 ^
+               (uint32_t)aes_isbox[(s3>>8)&0xFF]<<8 ^
+               (uint32_t)aes_isbox[s2&0xFF]) ^ k[1];
+    data[2] = ((uint32_t)aes_isbox[s2>>24]<<24 ^
+               (uint32_t)aes_isbox[(s1>>16)&0xFF]<<16 ^
+               (uint32_t)aes_isbox[(s0>>8)&0xFF]<<8 ^
+               (uint32_t)aes_isbox[s3&0xFF]) ^ k[2];
+    data[3] = ((uint32_t)aes_isbox[s3>>24]<<24 ^
+               (uint32_t)aes_isbox[(s2>>16)&0xFF]<<16 ^
+               (uint32_t)aes_isbox[(s1>>8)&0xFF]<<8 ^
+               (uint32_t)aes_isbox[s0&0xFF]) ^ k[3];
+}
+#else
 /**
  * Decrypt a single block (16 bytes) of data
  */
@@ -455,3 +599,5 @@ static void AES_decrypt(const AES_CTX *ctx, uint32_t *data)
 }
 
 #endif
+
+#endif
@@ -0,0 +1,157 @@
+/**
+ *  Copyright (C) 2011-2012  Juho Vähä-Herttua
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+/**
+ * AES-NI implementation of CBC decryption. It is only used when the CPU
+ * reports support for the AES instructions, otherwise the portable code in
+ * aes.c is used.
+ */
+
+#include <string.h>
+#include "os_port.h"
+#include "crypto.h"
+
+#if defined(CONFIG_AES_NI)
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define AES_NI_TARGET
+#else
+#include <cpuid.h>
+#define AES_NI_TARGET __attribute__((target("aes,ssse3")))
+#endif
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/* Number of blocks decrypted in parallel */
+#define AES_NI_PARALLEL 4
+
+/* Written once by the probe, pthread_once orders it before any reader */
+static int aes_ni_supported;
+
+static void aes_ni_probe(void)
+{
+    unsigned int ecx = 0;
+#if defined(_MSC_VER)
+    int info[4]; __cpuid(info, 1); ecx = info[2];
+#else
+    unsigned int eax, ebx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) ecx = 0;
+#endif
+    /* Bit 25 is AES, bit 9 is SSSE3 */
+    aes_ni_supported = (ecx & (1 << 25)) && (ecx & (1 << 9));
+}
+
+#if defined(_WIN32)
+static INIT_ONCE aes_ni_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK aes_ni_probe_once(PINIT_ONCE once, PVOID param, PVOID *context)
+{
+    aes_ni_probe();
+    return TRUE;
+}
+#else
+static pthread_once_t aes_ni_once = PTHREAD_ONCE_INIT;
+#endif
+
+int AES_ni_available(void)
+{
+#if defined(_WIN32)
+    InitOnceExecuteOnce(&aes_ni_once, aes_ni_probe_once, NULL, NULL);
+#else
+    pthread_once(&aes_ni_once, aes_ni_probe);
+#endif
+    return aes_ni_supported;
+}
+
+/**
+ * Decrypt a byte sequence (with a block size 16) using AES-NI. The key
+ * schedule must have been converted with AES_convert_key().
+ */
+AES_NI_TARGET
+void AES_ni_cbc_decrypt(AES_CTX *ctx, const uint8_t *msg, uint8_t *out, int length)
+{
+    __m128i ks[AES_MAXROUNDS+1];
+    __m128i bswap, iv;
+    int rounds = ctx->rounds;
+    int i, j;
+
+    /* The key schedule has big endian words, make them byte strings */
+    bswap = _mm_set_epi8(12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3);
+    for (i = 0; i <= rounds; i++)
+    {
+        ks[i] = _mm_loadu_si128((const __m128i *)&ctx->ks[i*4]);
+        ks[i] = _mm_shuffle_epi8(ks[i], bswap);
+    }
+    iv = _mm_loadu_si128((const __m128i *)ctx->iv);
+
+    /* Blocks are independent in CBC decryption, interleave them */
+    for (; length >= AES_NI_PARALLEL*AES_BLOCKSIZE;
+            length -= AES_NI_PARALLEL*AES_BLOCKSIZE)
+    {
+        __m128i in[AES_NI_PARALLEL], data[AES_NI_PARALLEL];
+
+        for (j = 0; j < AES_NI_PARALLEL; j++)
+        {
+            in[j] = _mm_loadu_si128((const __m128i *)(msg+j*AES_BLOCKSIZE));
+            data[j] = _mm_xor_si128(in[j], ks[rounds]);
+        }
+
+        for (i = rounds-1; i > 0; i--)
+        {
+            for (j = 0; j < AES_NI_PARALLEL; j++)
+                data[j] = _mm_aesdec_si128(data[j], ks[i]);
+        }
+
+        for (j = 0; j < AES_NI_PARALLEL; j++)
+        {
+            data[j] = _mm_aesdeclast_si128(data[j], ks[0]);
+            data[j] = _mm_xor_si128(data[j], iv);
+            iv = in[j];
+        }
+
+        /* Store last, out may be the same buffer as msg */
+        for (j = 0; j < AES_NI_PARALLEL; j++)
+            _mm_storeu_si128((__m128i *)(out+j*AES_BLOCKSIZE), data[j]);
+
+        msg += AES_NI_PARALLEL*AES_BLOCKSIZE;
+        out += AES_NI_PARALLEL*AES_BLOCKSIZE;
+    }
+
+    for (; length >= AES_BLOCKSIZE; length -= AES_BLOCKSIZE)
+    {
+        __m128i in, data;
+
+        in = _mm_loadu_si128((const __m128i *)msg);
+        data = _mm_xor_si128(in, ks[rounds]);
+        for (i = rounds-1; i > 0; i--)
+            data = _mm_aesdec_si128(data, ks[i]);
+        data = _mm_aesdeclast_si128(data, ks[0]);
+        _mm_storeu_si128((__m128i *)out, _mm_xor_si128(data, iv));
+        iv = in;
+
+        msg += AES_BLOCKSIZE;
+        out += AES_BLOCKSIZE;
+    }
+
+    _mm_storeu_si128((__m128i *)ctx->iv, iv);
+}
+
+#endif
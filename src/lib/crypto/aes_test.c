@@ -0,0 +1,121 @@
+/**
+ *  Copyright (C) 2011-2012  Juho Vähä-Herttua
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+/**
+ * Decrypts the CBC-AES128 vector of NIST SP 800-38A F.2.2 with every
+ * decryption path. Built twice by make check, the second time with
+ * CONFIG_AES_SMALL so the on the fly inverse rounds are covered as well.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "os_port.h"
+#include "crypto.h"
+
+#if defined(CONFIG_AES_SMALL)
+#define AES_TEST_TABLES "small"
+#else
+#define AES_TEST_TABLES "table"
+#endif
+
+static const uint8_t test_key[16] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+    0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+};
+
+static const uint8_t test_iv[16] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+};
+
+static const uint8_t test_ciphertext[64] = {
+    0x76, 0x49, 0xab, 0xac, 0x81, 0x19, 0xb2, 0x46,
+    0xce, 0xe9, 0x8e, 0x9b, 0x12, 0xe9, 0x19, 0x7d,
+    0x50, 0x86, 0xcb, 0x9b, 0x50, 0x72, 0x19, 0xee,
+    0x95, 0xdb, 0x11, 0x3a, 0x91, 0x76, 0x78, 0xb2,
+    0x73, 0xbe, 0xd6, 0xb8, 0xe3, 0xc1, 0x74, 0x3b,
+    0x71, 0x16, 0xe6, 0x9e, 0x22, 0x22, 0x95, 0x16,
+    0x3f, 0xf1, 0xca, 0xa1, 0x68, 0x1f, 0xac, 0x09,
+    0x12, 0x0e, 0xca, 0x30, 0x75, 0x86, 0xe1, 0xa7
+};
+
+static const uint8_t test_plaintext[64] = {
+    0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96,
+    0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+    0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c,
+    0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+    0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11,
+    0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+    0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17,
+    0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10
+};
+
+typedef void (*test_decrypt_t)(AES_CTX *ctx, const uint8_t *msg, uint8_t *out, int length);
+
+/**
+ * Decrypts the vector whole, in place, and split at every block boundary
+ * so that the IV carried between calls is checked too.
+ */
+static int test_decrypt(const char *name, test_decrypt_t decrypt)
+{
+    AES_CTX ctx;
+    uint8_t out[sizeof(test_ciphertext)];
+    int split, failures = 0;
+
+    for (split = 0; split <= (int) sizeof(test_ciphertext); split += AES_BLOCKSIZE)
+    {
+        AES_set_key(&ctx, test_key, test_iv, AES_MODE_128);
+        AES_convert_key(&ctx);
+        memcpy(out, test_ciphertext, sizeof(out));
+        decrypt(&ctx, out, out, split);
+        decrypt(&ctx, out + split, out + split, sizeof(out) - split);
+        if (memcmp(out, test_plaintext, sizeof(out)))
+        {
+            printf("%s: %s decryption split at %d bytes differs\n",
+                    AES_TEST_TABLES, name, split);
+            failures++;
+        }
+    }
+
+    AES_set_key(&ctx, test_key, test_iv, AES_MODE_128);
+    AES_convert_key(&ctx);
+    memset(out, 0, sizeof(out));
+    decrypt(&ctx, test_ciphertext, out, sizeof(out));
+    if (memcmp(out, test_plaintext, sizeof(out)))
+    {
+        printf("%s: %s decryption to a separate buffer differs\n",
+                AES_TEST_TABLES, name);
+        failures++;
+    }
+
+    if (!failures)
+        printf("%s: %s decryption ok\n", AES_TEST_TABLES, name);
+    return failures;
+}
+
+int main(void)
+{
+    int failures = 0;
+
+    failures += test_decrypt("portable", AES_cbc_decrypt_portable);
+    failures += test_decrypt("selected", AES_cbc_decrypt);
+#if defined(CONFIG_AES_NI)
+    if (AES_ni_available())
+        failures += test_decrypt("AES-NI", AES_ni_cbc_decrypt);
+    else
+        printf("%s: AES-NI not supported by the CPU, skipped\n", AES_TEST_TABLES);
+#endif
+
+    return failures ? 1 : 0;
+}
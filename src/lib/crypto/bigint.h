@@ -57,6 +57,33 @@ int bi_compare(bigint *bia, bigint *bib);
 void bi_set_mod(BI_CTX *ctx, bigint *bim, int mod_offset);
 void bi_free_mod(BI_CTX *ctx, int mod_offset);
 
+#if defined(CONFIG_BIGINT_MONT64)
+#define BI64_MAX_LIMBS      64  /**< Enough for 4096 bit moduli. */
+
+/**
+ * A modulus with its Montgomery constants, read only after setup.
+ */
+typedef struct
+{
+    int n;                              /**< Number of limbs in use. */
+    uint64_t m[BI64_MAX_LIMBS];         /**< The modulus. */
+    uint64_t rr[BI64_MAX_LIMBS];        /**< R^2 mod m. */
+    uint64_t m0inv;                     /**< -m^-1 mod 2^64 */
+} BI64_MOD;
+
+int bi64_set_mod(BI64_MOD *mod, const uint8_t *data, int size);
+void bi64_import(uint64_t *r, int n, const uint8_t *data, int size);
+void bi64_export(const uint64_t *a, int n, uint8_t *data, int size);
+void bi64_mod(const BI64_MOD *mod, uint64_t *r, const uint64_t *a, int len);
+void bi64_mul(uint64_t *r, const uint64_t *a, int n, const uint64_t *b, int m);
+void bi64_mod_sub(const BI64_MOD *mod, uint64_t *r, const uint64_t *a, const uint64_t *b);
+uint64_t bi64_add_to(uint64_t *a, int n, const uint64_t *b, int m);
+void bi64_mont_mul(const BI64_MOD *mod, uint64_t *r, const uint64_t *a, const uint64_t *b);
+void bi64_mont_sqr(const BI64_MOD *mod, uint64_t *r, const uint64_t *a);
+void bi64_mod_power(const BI64_MOD *mod, uint64_t *r, const uint64_t *a,
+        const uint8_t *exp, int explen);
+#endif
+
 #ifdef CONFIG_SSL_FULL_MODE
 void bi_print(const char *label, bigint *bi);
 bigint *bi_str_import(BI_CTX *ctx, const char *data);
@@ -0,0 +1,427 @@
+/**
+ *  Copyright (C) 2011-2012  Juho Vähä-Herttua
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+/**
+ * Fixed size Montgomery arithmetic with 64-bit limbs. Numbers are arrays
+ * of BI64_MAX_LIMBS little endian limbs on the stack, so nothing here
+ * allocates memory and a BI64_MOD can be shared between threads once it
+ * has been set up with bi64_set_mod().
+ */
+
+#include <string.h>
+#include "os_port.h"
+#include "crypto.h"
+
+#if defined(CONFIG_BIGINT_MONT64)
+
+typedef unsigned __int128 bi64_dbl;
+
+/* Size of the sliding window and its table of odd powers */
+#define BI64_WINDOW     5
+#define BI64_WINDOW_LEN (1 << (BI64_WINDOW-1))
+
+/* Returns a-b into r and the borrow */
+static uint64_t bi64_sub(uint64_t *r, const uint64_t *a, const uint64_t *b, int n)
+{
+    uint64_t borrow = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        uint64_t ai = a[i], bi = b[i];
+        r[i] = ai - bi - borrow;
+        borrow = (ai < bi) || (ai == bi && borrow);
+    }
+
+    return borrow;
+}
+
+/* Returns a+b into r and the carry */
+static uint64_t bi64_add(uint64_t *r, const uint64_t *a, const uint64_t *b, int n)
+{
+    uint64_t carry = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        bi64_dbl t = (bi64_dbl)a[i] + b[i] + carry;
+        r[i] = (uint64_t)t;
+        carry = (uint64_t)(t >> 64);
+    }
+
+    return carry;
+}
+
+static int bi64_compare(const uint64_t *a, const uint64_t *b, int n)
+{
+    int i;
+
+    for (i = n-1; i >= 0; i--)
+    {
+        if (a[i] != b[i])
+            return (a[i] > b[i]) ? 1 : -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Montgomery reduction of a 2n limb number t < m*R, r = t*R^-1 mod m.
+ * The contents of t are destroyed.
+ */
+static void bi64_redc(const BI64_MOD *mod, uint64_t *r, uint64_t *t)
+{
+    int n = mod->n;
+    uint64_t top = 0;
+    int i, j;
+
+    for (i = 0; i < n; i++)
+    {
+        uint64_t u = t[i]*mod->m0inv;
+        uint64_t carry = 0;
+        bi64_dbl s;
+
+        for (j = 0; j < n; j++)
+        {
+            s = (bi64_dbl)u*mod->m[j] + t[i+j] + carry;
+            t[i+j] = (uint64_t)s;
+            carry = (uint64_t)(s >> 64);
+        }
+
+        /* Propagate the carry into the upper half */
+        for (j = i+n; carry && j < 2*n; j++)
+        {
+            s = (bi64_dbl)t[j] + carry;
+            t[j] = (uint64_t)s;
+            carry = (uint64_t)(s >> 64);
+        }
+        top += carry;
+    }
+
+    if (top || bi64_compare(t+n, mod->m, n) >= 0)
+        bi64_sub(r, t+n, mod->m, n);
+    else
+        memcpy(r, t+n, n*sizeof(uint64_t));
+}
+
+/**
+ * Montgomery multiplication, r = a*b*R^-1 mod m. r may alias a or b.
+ */
+void bi64_mont_mul(const BI64_MOD *mod, uint64_t *r, const uint64_t *a, const uint64_t *b)
+{
+    uint64_t t[BI64_MAX_LIMBS+2];
+    int n = mod->n;
+    int i, j;
+
+    memset(t, 0, (n+2)*sizeof(uint64_t));
+    for (i = 0; i < n; i++)
+    {
+        uint64_t carry = 0, u;
+        bi64_dbl s;
+
+        /* t += a*b[i] */
+        for (j = 0; j < n; j++)
+        {
+            s = (bi64_dbl)a[j]*b[i] + t[j] + carry;
+            t[j] = (uint64_t)s;
+            carry = (uint64_t)(s >> 64);
+        }
+        s = (bi64_dbl)t[n] + carry;
+        t[n] = (uint64_t)s;
+        t[n+1] = (uint64_t)(s >> 64);
+
+        /* t = (t + u*m) / 2^64 */
+        u = t[0]*mod->m0inv;
+        s = (bi64_dbl)u*mod->m[0] + t[0];
+        carry = (uint64_t)(s >> 64);
+        for (j = 1; j < n; j++)
+        {
+            s = (bi64_dbl)u*mod->m[j] + t[j] + carry;
+            t[j-1] = (uint64_t)s;
+            carry = (uint64_t)(s >> 64);
+        }
+        s = (bi64_dbl)t[n] + carry;
+        t[n-1] = (uint64_t)s;
+        t[n] = t[n+1] + (uint64_t)(s >> 64);
+    }
+
+    if (t[n] || bi64_compare(t, mod->m, n) >= 0)
+        bi64_sub(r, t, mod->m, n);
+    else
+        memcpy(r, t, n*sizeof(uint64_t));
+}
+
+/**
+ * Montgomery squaring, r = a*a*R^-1 mod m. The cross products are only
+ * computed once, which saves about a quarter of the multiplications.
+ */
+void bi64_mont_sqr(const BI64_MOD *mod, uint64_t *r, const uint64_t *a)
+{
+    uint64_t t[2*BI64_MAX_LIMBS];
+    int n = mod->n;
+    uint64_t carry;
+    bi64_dbl s;
+    int i, j;
+
+    /* Cross products a[i]*a[j] with i < j */
+    memset(t, 0, 2*n*sizeof(uint64_t));
+    for (i = 0; i < n; i++)
+    {
+        carry = 0;
+        for (j = i+1; j < n; j++)
+        {
+            s = (bi64_dbl)a[i]*a[j] + t[i+j] + carry;
+            t[i+j] = (uint64_t)s;
+            carry = (uint64_t)(s >> 64);
+        }
+        t[i+n] = carry;
+    }
+
+    /* Double them */
+    carry = 0;
+    for (i = 0; i < 2*n; i++)
+    {
+        uint64_t top = t[i] >> 63;
+        t[i] = (t[i] << 1) | carry;
+        carry = top;
+    }
+
+    /* Add the squares on the diagonal */
+    carry = 0;
+    for (i = 0; i < n; i++)
+    {
+        s = (bi64_dbl)a[i]*a[i] + t[2*i] + carry;
+        t[2*i] = (uint64_t)s;
+        s = (bi64_dbl)t[2*i+1] + (uint64_t)(s >> 64);
+        t[2*i+1] = (uint64_t)s;
+        carry = (uint64_t)(s >> 64);
+    }
+
+    bi64_redc(mod, r, t);
+}
+
+/**
+ * Set up a modulus given as big endian bytes. Returns -1 if the modulus
+ * is even or too large.
+ */
+int bi64_set_mod(BI64_MOD *mod, const uint8_t *data, int size)
+{
+    uint64_t inv;
+    int n, i;
+
+    while (size > 0 && !data[0])
+    {
+        data++;
+        size--;
+    }
+
+    n = (size+7)/8;
+    if (n == 0 || n > BI64_MAX_LIMBS || !(data[size-1] & 1))
+        return -1;
+
+    memset(mod, 0, sizeof(BI64_MOD));
+    mod->n = n;
+    bi64_import(mod->m, n, data, size);
+
+    /* Newton iteration for m^-1 mod 2^64, each step doubles the bits */
+    inv = 1;
+    for (i = 0; i < 6; i++)
+        inv *= 2 - mod->m[0]*inv;
+    mod->m0inv = (uint64_t)0 - inv;
+
+    /* R^2 mod m by doubling 1 modulo m, 2*64*n times */
+    mod->rr[0] = 1;
+    for (i = 0; i < 2*64*n; i++)
+    {
+        uint64_t carry = bi64_add(mod->rr, mod->rr, mod->rr, n);
+        if (carry || bi64_compare(mod->rr, mod->m, n) >= 0)
+            bi64_sub(mod->rr, mod->rr, mod->m, n);
+    }
+
+    return 0;
+}
+
+/**
+ * Import big endian bytes into n limbs, the number must fit.
+ */
+void bi64_import(uint64_t *r, int n, const uint8_t *data, int size)
+{
+    int i;
+
+    memset(r, 0, n*sizeof(uint64_t));
+    for (i = 0; i < size && i < n*8; i++)
+        r[i/8] |= (uint64_t)data[size-1-i] << (8*(i%8));
+}
+
+/**
+ * Export n limbs as big endian bytes, zero padded to size.
+ */
+void bi64_export(const uint64_t *a, int n, uint8_t *data, int size)
+{
+    int i;
+
+    for (i = 0; i < size; i++)
+        data[size-1-i] = (i < n*8) ? (uint8_t)(a[i/8] >> (8*(i%8))) : 0;
+}
+
+/**
+ * Reduce a number of up to 2n limbs, r = a mod m.
+ */
+void bi64_mod(const BI64_MOD *mod, uint64_t *r, const uint64_t *a, int len)
+{
+    uint64_t t[2*BI64_MAX_LIMBS];
+    int n = mod->n;
+
+    /* Reduction needs a < m*R, reduce the top half first if needed */
+    memset(t, 0, sizeof(t));
+    memcpy(t, a, len*sizeof(uint64_t));
+    if (len > n && bi64_compare(t+n, mod->m, n) >= 0)
+    {
+        uint64_t hi[BI64_MAX_LIMBS];
+        uint64_t one[BI64_MAX_LIMBS];
+
+        /* hi mod m = ((hi*RR)*1) via two Montgomery steps */
+        memset(one, 0, n*sizeof(uint64_t));
+        one[0] = 1;
+        bi64_mont_mul(mod, hi, t+n, mod->rr);
+        bi64_mont_mul(mod, t+n, hi, one);
+    }
+
+    /* a*R^-1, then multiply by R^2 and reduce to get a */
+    bi64_redc(mod, r, t);
+    bi64_mont_mul(mod, r, r, mod->rr);
+}
+
+/**
+ * Multiply an n limb number by an m limb number into n+m limbs.
+ */
+void bi64_mul(uint64_t *r, const uint64_t *a, int n, const uint64_t *b, int m)
+{
+    int i, j;
+
+    memset(r, 0, (n+m)*sizeof(uint64_t));
+    for (i = 0; i < m; i++)
+    {
+        uint64_t carry = 0;
+        for (j = 0; j < n; j++)
+        {
+            bi64_dbl s = (bi64_dbl)a[j]*b[i] + r[i+j] + carry;
+            r[i+j] = (uint64_t)s;
+            carry = (uint64_t)(s >> 64);
+        }
+        r[i+n] = carry;
+    }
+}
+
+/**
+ * Modular subtraction of numbers below m, r = a-b mod m.
+ */
+void bi64_mod_sub(const BI64_MOD *mod, uint64_t *r, const uint64_t *a, const uint64_t *b)
+{
+    if (bi64_sub(r, a, b, mod->n))
+        bi64_add(r, r, mod->m, mod->n);
+}
+
+/**
+ * Add b of m limbs to a of n limbs in place, n >= m. Returns the carry.
+ */
+uint64_t bi64_add_to(uint64_t *a, int n, const uint64_t *b, int m)
+{
+    uint64_t carry = bi64_add(a, a, b, m);
+    int i;
+
+    for (i = m; carry && i < n; i++)
+    {
+        a[i]++;
+        carry = (a[i] == 0);
+    }
+
+    return carry;
+}
+
+static int bi64_exp_bit(const uint8_t *exp, int explen, int bit)
+{
+    return (exp[explen-1-bit/8] >> (bit%8)) & 1;
+}
+
+/**
+ * Sliding window exponentiation, r = a^exp mod m. The base must be
+ * below m and the exponent is given as big endian bytes.
+ */
+void bi64_mod_power(const BI64_MOD *mod, uint64_t *r, const uint64_t *a,
+        const uint8_t *exp, int explen)
+{
+    uint64_t g[BI64_WINDOW_LEN][BI64_MAX_LIMBS];
+    uint64_t acc[BI64_MAX_LIMBS];
+    uint64_t one[BI64_MAX_LIMBS];
+    int n = mod->n;
+    int i, started;
+
+    memset(one, 0, n*sizeof(uint64_t));
+    one[0] = 1;
+
+    /* g[i] = a^(2i+1) in Montgomery form */
+    bi64_mont_mul(mod, g[0], a, mod->rr);
+    bi64_mont_sqr(mod, acc, g[0]);
+    for (i = 1; i < BI64_WINDOW_LEN; i++)
+        bi64_mont_mul(mod, g[i], g[i-1], acc);
+
+    /* acc = 1 in Montgomery form */
+    bi64_mont_mul(mod, acc, one, mod->rr);
+
+    started = 0;
+    i = explen*8-1;
+    while (i >= 0)
+    {
+        int j, value;
+
+        if (!bi64_exp_bit(exp, explen, i))
+        {
+            if (started)
+                bi64_mont_sqr(mod, acc, acc);
+            i--;
+            continue;
+        }
+
+        /* Longest window starting at bit i that ends in a one bit */
+        j = i-BI64_WINDOW+1;
+        if (j < 0)
+            j = 0;
+        while (!bi64_exp_bit(exp, explen, j))
+            j++;
+
+        value = 0;
+        for (; i >= j; i--)
+        {
+            value = (value << 1) | bi64_exp_bit(exp, explen, i);
+            if (started)
+                bi64_mont_sqr(mod, acc, acc);
+        }
+
+        if (started)
+        {
+            bi64_mont_mul(mod, acc, acc, g[value >> 1]);
+        }
+        else
+        {
+            memcpy(acc, g[value >> 1], n*sizeof(uint64_t));
+            started = 1;
+        }
+    }
+
+    /* Back from Montgomery form */
+    bi64_mont_mul(mod, r, acc, one);
+}
+
+#endif
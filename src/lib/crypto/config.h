@@ -4,3 +4,13 @@
 #define CONFIG_BIGINT_SQUARE 1
 #define CONFIG_BIGINT_32BIT 1
 
+/* AES-NI decryption, used when the CPU supports it */
+#if (defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))) || \
+    (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)))
+#define CONFIG_AES_NI 1
+#endif
+
+/* 64-bit limb Montgomery arithmetic for RSA, needs 128-bit products */
+#if defined(__SIZEOF_INT128__)
+#define CONFIG_BIGINT_MONT64 1
+#endif
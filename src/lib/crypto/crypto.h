@@ -77,8 +77,14 @@ void AES_set_key(AES_CTX *ctx, const uint8_t *key,
 void AES_cbc_encrypt(AES_CTX *ctx, const uint8_t *msg, 
         uint8_t *out, int length);
 void AES_cbc_decrypt(AES_CTX *ks, const uint8_t *in, uint8_t *out, int length);
+void AES_cbc_decrypt_portable(AES_CTX *ctx, const uint8_t *msg, uint8_t *out, int length);
 void AES_convert_key(AES_CTX *ctx);
 
+#if defined(CONFIG_AES_NI)
+int AES_ni_available(void);
+void AES_ni_cbc_decrypt(AES_CTX *ctx, const uint8_t *msg, uint8_t *out, int length);
+#endif
+
 /**************************************************************************
  * RC4 declarations 
  **************************************************************************/
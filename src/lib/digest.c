@@ -4,7 +4,7 @@
 #include <string.h>
 
 #include "compat.h"
-#include "utils.h"
+#include "digest.h"
 #include "crypto/crypto.h"
 
 void
@@ -17,36 +17,49 @@ digest_md5_to_hex(const unsigned char *md5buf, char *md5hex)
 	}
 }
 
-void
-digest_get_response(const char *username, const char *realm,
-                    const char *password, const char *nonce,
-                    const char *method, const char *uri,
-                    char *response)
+static void
+digest_get_ha1_len(const char *username, int usernamelen, const char *realm,
+                   const char *password, char *ha1)
 {
 	MD5_CTX md5ctx;
 	unsigned char md5buf[MD5_SIZE];
-	char md5hex[MD5_SIZE*2];
 
-	/* Calculate first inner MD5 hash */
 	MD5_Init(&md5ctx);
-	MD5_Update(&md5ctx, (const unsigned char *)username, strlen(username));
+	MD5_Update(&md5ctx, (const unsigned char *)username, usernamelen);
 	MD5_Update(&md5ctx, (const unsigned char *)":", 1);
 	MD5_Update(&md5ctx, (const unsigned char *)realm, strlen(realm));
 	MD5_Update(&md5ctx, (const unsigned char *)":", 1);
 	MD5_Update(&md5ctx, (const unsigned char *)password, strlen(password));
 	MD5_Final(md5buf, &md5ctx);
-	digest_md5_to_hex(md5buf, md5hex);
+	digest_md5_to_hex(md5buf, ha1);
+}
+
+void
+digest_get_ha1(const char *username, const char *realm,
+               const char *password, char *ha1)
+{
+	digest_get_ha1_len(username, strlen(username), realm, password, ha1);
+}
+
+static void
+digest_get_response(const char *ha1, const char *nonce,
+                    const char *method, const char *uri, int urilen,
+                    char *response)
+{
+	MD5_CTX md5ctx;
+	unsigned char md5buf[MD5_SIZE];
+	char md5hex[MD5_SIZE*2];
 
 	/* Calculate second inner MD5 hash */
 	MD5_Init(&md5ctx);
 	MD5_Update(&md5ctx, (const unsigned char *)method, strlen(method));
 	MD5_Update(&md5ctx, (const unsigned char *)":", 1);
-	MD5_Update(&md5ctx, (const unsigned char *)uri, strlen(uri));
+	MD5_Update(&md5ctx, (const unsigned char *)uri, urilen);
 	MD5_Final(md5buf, &md5ctx);
 
 	/* Calculate outer MD5 hash */
 	MD5_Init(&md5ctx);
-	MD5_Update(&md5ctx, (const unsigned char *)md5hex, sizeof(md5hex));
+	MD5_Update(&md5ctx, (const unsigned char *)ha1, DIGEST_HA1_LEN);
 	MD5_Update(&md5ctx, (const unsigned char *)":", 1);
 	MD5_Update(&md5ctx, (const unsigned char *)nonce, strlen(nonce));
 	MD5_Update(&md5ctx, (const unsigned char *)":", 1);
@@ -77,84 +90,97 @@ digest_generate_nonce(char *result, int resultlen)
 	strncpy(result, md5hex, resultlen-1);
 }
 
+static int
+digest_value_equals(const char *value, int valuelen, const char *str)
+{
+	return (value && valuelen == (int)strlen(str) && !memcmp(value, str, valuelen));
+}
+
 int
 digest_is_valid(const char *our_realm, const char *password,
+                const char *our_username, const char *our_ha1,
                 const char *our_nonce, const char *method,
                 const char *our_uri, const char *authorization)
 {
-	char *auth;
-	char *current;
-	char *value;
-	int success;
+	const char *current;
 
-	/* Get values from authorization */
-	char *username = NULL;
-	char *realm = NULL;
-	char *nonce = NULL;
-	char *uri = NULL;
-	char *response = NULL;
+	/* Values from authorization, they are not null terminated */
+	const char *username = NULL; int usernamelen = 0;
+	const char *realm = NULL; int realmlen = 0;
+	const char *nonce = NULL; int noncelen = 0;
+	const char *uri = NULL; int urilen = 0;
+	const char *response = NULL; int responselen = 0;
 
-	/* Buffer for our response */
-	char our_response[MD5_SIZE*2+1];
+	/* Buffers for HA1 and our response */
+	char ha1[DIGEST_HA1_LEN];
+	char our_response[MD5_SIZE*2];
 
 	if (!authorization) {
 		return 0;
 	}
-	current = auth = strdup(authorization);
-	if (!auth) {
-		return 0;
-	}
 
 	/* Check that the type is digest */
+	current = authorization;
 	if (strncmp("Digest", current, 6)) {
-		free(auth);
 		return 0;
 	}
 	current += 6;
 
-	while ((value = utils_strsep(&current, ",")) != NULL) {
-		char *first, *last;
-
-		/* Find first and last characters */
-		first = value;
-		last = value+strlen(value)-1;
-
-		/* Trim spaces from the value */
-		while (*first == ' ' && first < last) first++;
-		while (*last == ' ' && last > first) last--;
-
-		/* Validate the last character */
-		if (*last != '"') continue;
-		else *last = '\0';
+	/* Parse name="value" pairs in place */
+	while (*current) {
+		const char *name, *value;
+		int namelen, valuelen;
+
+		while (*current == ' ' || *current == ',') current++;
+		name = current;
+		while (*current && *current != '=' && *current != ',') current++;
+		namelen = current-name;
+		if (*current != '=') continue;
+		current++;
+
+		/* Only quoted values are relevant */
+		if (*current != '"') {
+			while (*current && *current != ',') current++;
+			continue;
+		}
+		value = ++current;
+		while (*current && *current != '"') current++;
+		if (*current != '"') break;
+		valuelen = current-value;
+		current++;
 
 		/* Store value if it is relevant */
-		if (!strncmp("username=\"", first, 10))
-			username = first+10;
-		if (!strncmp("realm=\"", first, 7))
-			realm = first+7;
-		if (!strncmp("nonce=\"", first, 7))
-			nonce = first+7;
-		if (!strncmp("uri=\"", first, 5))
-			uri = first+5;
-		if (!strncmp("response=\"", first, 10))
-			response = first+10;
+		if (namelen == 8 && !memcmp("username", name, 8)) {
+			username = value; usernamelen = valuelen;
+		} else if (namelen == 5 && !memcmp("realm", name, 5)) {
+			realm = value; realmlen = valuelen;
+		} else if (namelen == 5 && !memcmp("nonce", name, 5)) {
+			nonce = value; noncelen = valuelen;
+		} else if (namelen == 3 && !memcmp("uri", name, 3)) {
+			uri = value; urilen = valuelen;
+		} else if (namelen == 8 && !memcmp("response", name, 8)) {
+			response = value; responselen = valuelen;
+		}
 	}
 
 	if (!username || !realm || !nonce || !uri || !response) {
 		return 0;
 	}
-	if (strcmp(realm, our_realm) || strcmp(nonce, our_nonce) || strcmp(uri, our_uri)) {
+	if (!digest_value_equals(realm, realmlen, our_realm) ||
+	    !digest_value_equals(nonce, noncelen, our_nonce) ||
+	    !digest_value_equals(uri, urilen, our_uri) ||
+	    responselen != sizeof(our_response)) {
 		return 0;
 	}
 
-	/* Calculate our response */
-	memset(our_response, 0, sizeof(our_response));
-	digest_get_response(username, realm, password, nonce,
-	                    method, uri, our_response);
-	success = !strcmp(response, our_response);
-	free(auth);
+	/* Use the precalculated HA1 if the username matches */
+	if (our_ha1 && our_username && digest_value_equals(username, usernamelen, our_username)) {
+		memcpy(ha1, our_ha1, DIGEST_HA1_LEN);
+	} else {
+		digest_get_ha1_len(username, usernamelen, our_realm, password, ha1);
+	}
 
-	return success;
+	/* Calculate our response */
+	digest_get_response(ha1, our_nonce, method, uri, urilen, our_response);
+	return !memcmp(response, our_response, sizeof(our_response));
 }
-
-
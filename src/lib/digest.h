@@ -1,8 +1,14 @@
 #ifndef DIGEST_H
 #define DIGEST_H
 
+/* Length of the hex encoded MD5 of username:realm:password */
+#define DIGEST_HA1_LEN 32
+
 void digest_generate_nonce(char *result, int resultlen);
+void digest_get_ha1(const char *username, const char *realm,
+                    const char *password, char *ha1);
 int digest_is_valid(const char *our_realm, const char *password,
+                    const char *our_username, const char *our_ha1,
                     const char *our_nonce, const char *method,
                     const char *our_uri, const char *authorization);
 
@@ -15,38 +15,141 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
 
 #include "http_request.h"
 #include "http_parser.h"
 
+/* Initial sizes of the buffers, they grow as needed and are kept on reset */
+#define HTTP_REQUEST_ARENA_SIZE   1024
+#define HTTP_REQUEST_HEADERS_SIZE 32
+
+/* Bodies larger than this are freed on reset instead of kept */
+#define HTTP_REQUEST_DATA_KEEP    65536
+
+/* Largest Content-Length used to size the body buffer */
+#define HTTP_REQUEST_DATA_EXPECTED_MAX (4*1024*1024)
+
+typedef struct {
+	const char *name;
+	int namelen;
+} http_header_name_t;
+
+/* Must be in the same order as http_header_id_t */
+static const http_header_name_t http_header_names[HTTP_HEADER_COUNT] = {
+	{ "CSeq", 4 },
+	{ "Authorization", 13 },
+	{ "Apple-Challenge", 15 },
+	{ "Transport", 9 },
+	{ "Content-Type", 12 },
+	{ "Content-Length", 14 },
+	{ "RTP-Info", 8 },
+	{ "Session", 7 },
+	{ "Connection", 10 },
+	{ "User-Agent", 10 }
+};
+
 struct http_request_s {
 	http_parser parser;
 	http_parser_settings parser_settings;
 
+	/* Bump allocated strings of the current request */
+	char *arena;
+	int arena_size;
+	int arena_used;
+	int arena_last;
+
+	/* Offsets of the strings in the arena, -1 if not set */
 	const char *method;
-	char *url;
+	int url;
 
-	char **headers;
+	int *headers;
 	int headers_size;
 	int headers_index;
 
+	/* Index of the field of each known header in headers, -1 if missing */
+	int known[HTTP_HEADER_COUNT];
+
 	char *data;
+	int data_size;
 	int datalen;
+	int data_expected;
 
 	int complete;
 };
 
+static int
+http_header_equals(const char *a, const char *b, int length)
+{
+	int i;
+
+	for (i=0; i<length; i++) {
+		char ca = a[i], cb = b[i];
+
+		if (ca >= 'A' && ca <= 'Z') ca += 'a'-'A';
+		if (cb >= 'A' && cb <= 'Z') cb += 'a'-'A';
+		if (ca != cb) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static http_header_id_t
+http_header_intern(const char *name, int namelen)
+{
+	int i;
+
+	for (i=0; i<HTTP_HEADER_COUNT; i++) {
+		if (http_header_names[i].namelen == namelen &&
+		    http_header_equals(http_header_names[i].name, name, namelen)) {
+			return i;
+		}
+	}
+	return HTTP_HEADER_UNKNOWN;
+}
+
+/* Appends a parser fragment to the string at offset, allocating a new */
+/* string if offset is not the last string in the arena */
+static int
+http_request_append(http_request_t *request, int offset, const char *at, size_t length)
+{
+	int needed;
+
+	if (offset == -1 || offset != request->arena_last) {
+		/* Start a new string after the terminator of the last one */
+		offset = request->arena_used;
+		request->arena_last = offset;
+		request->arena_used++;
+	}
+
+	needed = request->arena_used+length;
+	if (needed > request->arena_size) {
+		int size = request->arena_size;
+		char *arena;
+
+		while (size < needed) {
+			size *= 2;
+		}
+		arena = realloc(request->arena, size);
+		assert(arena);
+		request->arena = arena;
+		request->arena_size = size;
+	}
+
+	/* Overwrite the previous terminator and terminate again */
+	memcpy(request->arena+request->arena_used-1, at, length);
+	request->arena_used += length;
+	request->arena[request->arena_used-1] = '\0';
+	return offset;
+}
+
 static int
 on_url(http_parser *parser, const char *at, size_t length)
 {
 	http_request_t *request = parser->data;
-	int urllen = request->url ? strlen(request->url) : 0;
-
-	request->url = realloc(request->url, urllen+length+1);
-	assert(request->url);
 
-	request->url[urllen] = '\0';
-	strncat(request->url, at, length);
+	request->url = http_request_append(request, request->url, at, length);
 	return 0;
 }
 
@@ -58,30 +161,21 @@ on_header_field(http_parser *parser, const char *at, size_t length)
 	/* Check if our index is a value */
 	if (request->headers_index%2 == 1) {
 		request->headers_index++;
-	}
-
-	/* Allocate space for new field-value pair */
-	if (request->headers_index == request->headers_size) {
-		request->headers_size += 2;
-		request->headers = realloc(request->headers,
-		                           request->headers_size*sizeof(char*));
-		assert(request->headers);
-		request->headers[request->headers_index] = NULL;
-		request->headers[request->headers_index+1] = NULL;
-	}
 
-	/* Allocate space in the current header string */
-	if (request->headers[request->headers_index] == NULL) {
-		request->headers[request->headers_index] = calloc(1, length+1);
-	} else {
-		request->headers[request->headers_index] = realloc(
-			request->headers[request->headers_index],
-			strlen(request->headers[request->headers_index])+length+1
-		);
+		/* Allocate space for new field-value pair */
+		if (request->headers_index+1 >= request->headers_size) {
+			request->headers_size *= 2;
+			request->headers = realloc(request->headers,
+			                           request->headers_size*sizeof(int));
+			assert(request->headers);
+		}
+		request->headers[request->headers_index] = -1;
+		request->headers[request->headers_index+1] = -1;
 	}
-	assert(request->headers[request->headers_index]);
 
-	strncat(request->headers[request->headers_index], at, length);
+	request->headers[request->headers_index] = http_request_append(
+		request, request->headers[request->headers_index], at, length
+	);
 	return 0;
 }
 
@@ -92,21 +186,35 @@ on_header_value(http_parser *parser, const char *at, size_t length)
 
 	/* Check if our index is a field */
 	if (request->headers_index%2 == 0) {
+		int field = request->headers[request->headers_index];
+		http_header_id_t id;
+
+		/* The field is complete now, add it to the index */
+		id = http_header_intern(request->arena+field,
+		                        request->arena_used-field-1);
+		if (id != HTTP_HEADER_UNKNOWN && request->known[id] == -1) {
+			request->known[id] = request->headers_index;
+		}
 		request->headers_index++;
 	}
 
-	/* Allocate space in the current header string */
-	if (request->headers[request->headers_index] == NULL) {
-		request->headers[request->headers_index] = calloc(1, length+1);
-	} else {
-		request->headers[request->headers_index] = realloc(
-			request->headers[request->headers_index],
-			strlen(request->headers[request->headers_index])+length+1
-		);
-	}
-	assert(request->headers[request->headers_index]);
+	request->headers[request->headers_index] = http_request_append(
+		request, request->headers[request->headers_index], at, length
+	);
+	return 0;
+}
+
+static int
+on_headers_complete(http_parser *parser)
+{
+	http_request_t *request = parser->data;
+	uint64_t length = parser->content_length;
 
-	strncat(request->headers[request->headers_index], at, length);
+	/* Nothing is allocated before the body arrives, the length only */
+	/* keeps the buffer from growing past the end of the body */
+	if (length <= HTTP_REQUEST_DATA_EXPECTED_MAX) {
+		request->data_expected = length;
+	}
 	return 0;
 }
 
@@ -114,12 +222,29 @@ static int
 on_body(http_parser *parser, const char *at, size_t length)
 {
 	http_request_t *request = parser->data;
+	size_t needed = (size_t) request->datalen + length;
+
+	/* The length of the data is returned as an int */
+	if (length > INT_MAX || needed > INT_MAX) {
+		return -1;
+	}
+	if (needed > (size_t) request->data_size) {
+		int size = request->data_size ? request->data_size : 1024;
 
-	request->data = realloc(request->data, request->datalen+length);
-	assert(request->data);
+		/* Grow with the data received, up to the announced length */
+		while ((size_t) size < needed) {
+			size = (size > INT_MAX/2) ? (int) needed : size*2;
+		}
+		if (size > request->data_expected && (size_t) request->data_expected >= needed) {
+			size = request->data_expected;
+		}
+		request->data = realloc(request->data, size);
+		assert(request->data);
+		request->data_size = size;
+	}
 
 	memcpy(request->data+request->datalen, at, length);
-	request->datalen += length;
+	request->datalen = (int) needed;
 	return 0;
 }
 
@@ -130,6 +255,9 @@ on_message_complete(http_parser *parser)
 
 	request->method = http_method_str(request->parser.method);
 	request->complete = 1;
+
+	/* Stop here, data after the message belongs to the next request */
+	http_parser_pause(parser, 1);
 	return 0;
 }
 
@@ -142,28 +270,64 @@ http_request_init(void)
 	if (!request) {
 		return NULL;
 	}
-	http_parser_init(&request->parser, HTTP_REQUEST);
-	request->parser.data = request;
+	request->arena_size = HTTP_REQUEST_ARENA_SIZE;
+	request->arena = malloc(request->arena_size);
+	request->headers_size = HTTP_REQUEST_HEADERS_SIZE;
+	request->headers = malloc(request->headers_size*sizeof(int));
+	if (!request->arena || !request->headers) {
+		free(request->arena);
+		free(request->headers);
+		free(request);
+		return NULL;
+	}
 
 	request->parser_settings.on_url = &on_url;
 	request->parser_settings.on_header_field = &on_header_field;
 	request->parser_settings.on_header_value = &on_header_value;
+	request->parser_settings.on_headers_complete = &on_headers_complete;
 	request->parser_settings.on_body = &on_body;
 	request->parser_settings.on_message_complete = &on_message_complete;
 
+	http_request_reset(request);
 	return request;
 }
 
 void
-http_request_destroy(http_request_t *request)
+http_request_reset(http_request_t *request)
 {
 	int i;
 
+	assert(request);
+
+	http_parser_init(&request->parser, HTTP_REQUEST);
+	request->parser.data = request;
+
+	request->arena_used = 0;
+	request->arena_last = -1;
+	request->method = NULL;
+	request->url = -1;
+	request->headers[0] = -1;
+	request->headers[1] = -1;
+	request->headers_index = 0;
+	for (i=0; i<HTTP_HEADER_COUNT; i++) {
+		request->known[i] = -1;
+	}
+	request->datalen = 0;
+	request->data_expected = 0;
+	request->complete = 0;
+
+	if (request->data_size > HTTP_REQUEST_DATA_KEEP) {
+		free(request->data);
+		request->data = NULL;
+		request->data_size = 0;
+	}
+}
+
+void
+http_request_destroy(http_request_t *request)
+{
 	if (request) {
-		free(request->url);
-		for (i=0; i<request->headers_size; i++) {
-			free(request->headers[i]);
-		}
+		free(request->arena);
 		free(request->headers);
 		free(request->data);
 		free(request);
@@ -194,7 +358,8 @@ int
 http_request_has_error(http_request_t *request)
 {
 	assert(request);
-	return (HTTP_PARSER_ERRNO(&request->parser) != HPE_OK);
+	return (HTTP_PARSER_ERRNO(&request->parser) != HPE_OK &&
+	        HTTP_PARSER_ERRNO(&request->parser) != HPE_PAUSED);
 }
 
 const char *
@@ -218,23 +383,57 @@ http_request_get_method(http_request_t *request)
 	return request->method;
 }
 
+/* Returns the parsed enum http_method, or -1 if not complete */
+int
+http_request_get_method_id(http_request_t *request)
+{
+	assert(request);
+	return request->complete ? (int)request->parser.method : -1;
+}
+
 const char *
 http_request_get_url(http_request_t *request)
 {
 	assert(request);
-	return request->url;
+	return (request->url != -1) ? request->arena+request->url : NULL;
+}
+
+const char *
+http_request_get_header_id(http_request_t *request, http_header_id_t id)
+{
+	int field;
+
+	assert(request);
+	assert(id >= 0 && id < HTTP_HEADER_COUNT);
+
+	field = request->known[id];
+	if (field == -1 || request->headers[field+1] == -1) {
+		return NULL;
+	}
+	return request->arena+request->headers[field+1];
 }
 
 const char *
 http_request_get_header(http_request_t *request, const char *name)
 {
+	http_header_id_t id;
+	int namelen;
 	int i;
 
 	assert(request);
+	assert(name);
 
-	for (i=0; i<request->headers_size; i+=2) {
-		if (!strcmp(request->headers[i], name)) {
-			return request->headers[i+1];
+	namelen = strlen(name);
+	id = http_header_intern(name, namelen);
+	if (id != HTTP_HEADER_UNKNOWN) {
+		return http_request_get_header_id(request, id);
+	}
+
+	for (i=0; i<=request->headers_index && request->headers[i] != -1; i+=2) {
+		const char *field = request->arena+request->headers[i];
+
+		if (http_header_equals(field, name, namelen) && field[namelen] == '\0') {
+			return (request->headers[i+1] != -1) ? request->arena+request->headers[i+1] : NULL;
 		}
 	}
 	return NULL;
@@ -250,3 +449,24 @@ http_request_get_data(http_request_t *request, int *datalen)
 	}
 	return request->data;
 }
+
+char *
+http_request_take_data(http_request_t *request, int *datalen)
+{
+	char *data;
+
+	assert(request);
+	assert(datalen);
+
+	data = request->data;
+	*datalen = request->datalen;
+	if (!data || !request->datalen) {
+		return NULL;
+	}
+
+	/* The next request allocates a new body buffer */
+	request->data = NULL;
+	request->data_size = 0;
+	request->datalen = 0;
+	return data;
+}
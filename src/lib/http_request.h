@@ -17,8 +17,25 @@
 
 typedef struct http_request_s http_request_t;
 
+/* Headers interned while parsing, looked up without string compares */
+typedef enum {
+	HTTP_HEADER_CSEQ,
+	HTTP_HEADER_AUTHORIZATION,
+	HTTP_HEADER_APPLE_CHALLENGE,
+	HTTP_HEADER_TRANSPORT,
+	HTTP_HEADER_CONTENT_TYPE,
+	HTTP_HEADER_CONTENT_LENGTH,
+	HTTP_HEADER_RTP_INFO,
+	HTTP_HEADER_SESSION,
+	HTTP_HEADER_CONNECTION,
+	HTTP_HEADER_USER_AGENT,
+	HTTP_HEADER_COUNT,
+	HTTP_HEADER_UNKNOWN = HTTP_HEADER_COUNT
+} http_header_id_t;
+
 
 http_request_t *http_request_init(void);
+void http_request_reset(http_request_t *request);
 
 int http_request_add_data(http_request_t *request, const char *data, int datalen);
 int http_request_is_complete(http_request_t *request);
@@ -27,9 +44,12 @@ int http_request_has_error(http_request_t *request);
 const char *http_request_get_error_name(http_request_t *request);
 const char *http_request_get_error_description(http_request_t *request);
 const char *http_request_get_method(http_request_t *request);
+int http_request_get_method_id(http_request_t *request);
 const char *http_request_get_url(http_request_t *request);
 const char *http_request_get_header(http_request_t *request, const char *name);
+const char *http_request_get_header_id(http_request_t *request, http_header_id_t id);
 const char *http_request_get_data(http_request_t *request, int *datalen);
+char *http_request_take_data(http_request_t *request, int *datalen);
 
 void http_request_destroy(http_request_t *request);
 
@@ -20,19 +20,46 @@
 #include "http_response.h"
 #include "compat.h"
 
+typedef struct {
+	/* Static fragment, or NULL if the segment is in the data buffer */
+	const char *data;
+	int offset;
+	int length;
+} http_response_part_t;
+
 struct http_response_s {
 	int complete;
 	int disconnect;
 
+	/* Dynamically formatted parts of the response */
 	char *data;
 	int data_size;
 	int data_length;
+
+	http_response_part_t parts[HTTP_RESPONSE_MAX_SEGMENTS];
+	int parts_count;
+
+	http_response_segment_t segments[HTTP_RESPONSE_MAX_SEGMENTS];
 };
 
+typedef struct {
+	const char *protocol;
+	int code;
+	const char *message;
+	const char *line;
+} http_response_status_t;
+
+static const http_response_status_t http_response_statuses[] = {
+	{ "RTSP/1.0", 200, "OK", "RTSP/1.0 200 OK\r\n" },
+	{ "RTSP/1.0", 401, "Unauthorized", "RTSP/1.0 401 Unauthorized\r\n" },
+	{ "HTTP/1.1", 200, "OK", "HTTP/1.1 200 OK\r\n" },
+	{ NULL, 0, NULL, NULL }
+};
 
 static void
 http_response_add_data(http_response_t *response, const char *data, int datalen)
 {
+	http_response_part_t *part;
 	int newdatasize;
 
 	assert(response);
@@ -40,29 +67,45 @@ http_response_add_data(http_response_t *response, const char *data, int datalen)
 	assert(datalen > 0);
 
 	newdatasize = response->data_size;
-	while (response->data_size+datalen > newdatasize) {
+	while (response->data_length+datalen > newdatasize) {
 		newdatasize *= 2;
 	}
 	if (newdatasize != response->data_size) {
 		response->data = realloc(response->data, newdatasize);
 		assert(response->data);
+		response->data_size = newdatasize;
 	}
 	memcpy(response->data+response->data_length, data, datalen);
+
+	/* Extend the last segment if it is the end of the data buffer */
+	part = NULL;
+	if (response->parts_count > 0) {
+		part = &response->parts[response->parts_count-1];
+		if (part->data || part->offset+part->length != response->data_length) {
+			part = NULL;
+		}
+	}
+	if (!part) {
+		/* Static data leaves the last segment free for this */
+		assert(response->parts_count < HTTP_RESPONSE_MAX_SEGMENTS);
+		part = &response->parts[response->parts_count++];
+		part->data = NULL;
+		part->offset = response->data_length;
+		part->length = 0;
+	}
+	part->length += datalen;
 	response->data_length += datalen;
 }
 
 http_response_t *
 http_response_init(const char *protocol, int code, const char *message)
 {
+	const http_response_status_t *status;
 	http_response_t *response;
 	char codestr[4];
 
 	assert(code >= 100 && code < 1000);
 
-	/* Convert code into string */
-	memset(codestr, 0, sizeof(codestr));
-	snprintf(codestr, sizeof(codestr), "%u", code);
-
 	response = calloc(1, sizeof(http_response_t));
 	if (!response) {
 		return NULL;
@@ -76,6 +119,19 @@ http_response_init(const char *protocol, int code, const char *message)
 		return NULL;
 	}
 
+	/* Use a precomputed status line if there is one */
+	for (status=http_response_statuses; status->protocol; status++) {
+		if (status->code == code && !strcmp(status->protocol, protocol) &&
+		    !strcmp(status->message, message)) {
+			http_response_add_static(response, status->line, strlen(status->line));
+			return response;
+		}
+	}
+
+	/* Convert code into string */
+	memset(codestr, 0, sizeof(codestr));
+	snprintf(codestr, sizeof(codestr), "%u", code);
+
 	/* Add first line of response to the data array */
 	http_response_add_data(response, protocol, strlen(protocol));
 	http_response_add_data(response, " ", 1);
@@ -109,6 +165,27 @@ http_response_add_header(http_response_t *response, const char *name, const char
 	http_response_add_data(response, "\r\n", 2);
 }
 
+void
+http_response_add_static(http_response_t *response, const char *data, int datalen)
+{
+	http_response_part_t *part;
+
+	assert(response);
+	assert(data);
+	assert(datalen > 0);
+
+	/* Keep the last segment free for dynamic data */
+	if (response->parts_count >= HTTP_RESPONSE_MAX_SEGMENTS-1) {
+		http_response_add_data(response, data, datalen);
+		return;
+	}
+
+	part = &response->parts[response->parts_count++];
+	part->data = data;
+	part->offset = 0;
+	part->length = datalen;
+}
+
 void
 http_response_finish(http_response_t *response, const char *data, int datalen)
 {
@@ -153,13 +230,26 @@ http_response_get_disconnect(http_response_t *response)
 	return response->disconnect;
 }
 
-const char *
-http_response_get_data(http_response_t *response, int *datalen)
+const http_response_segment_t *
+http_response_get_segments(http_response_t *response, int *count)
 {
+	int i;
+
 	assert(response);
-	assert(datalen);
+	assert(count);
 	assert(response->complete);
 
-	*datalen = response->data_length;
-	return response->data;
+	/* Data buffer does not move any more, resolve the offsets */
+	for (i=0; i<response->parts_count; i++) {
+		const http_response_part_t *part = &response->parts[i];
+
+		if (part->data) {
+			response->segments[i].data = part->data;
+		} else {
+			response->segments[i].data = response->data+part->offset;
+		}
+		response->segments[i].datalen = part->length;
+	}
+	*count = response->parts_count;
+	return response->segments;
 }
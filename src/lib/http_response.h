@@ -15,17 +15,27 @@
 #ifndef HTTP_RESPONSE_H
 #define HTTP_RESPONSE_H
 
+/* Static data after this many segments is copied instead */
+#define HTTP_RESPONSE_MAX_SEGMENTS 16
+
 typedef struct http_response_s http_response_t;
 
+typedef struct {
+	const char *data;
+	int datalen;
+} http_response_segment_t;
+
 http_response_t *http_response_init(const char *protocol, int code, const char *message);
 
 void http_response_add_header(http_response_t *response, const char *name, const char *value);
+/* Adds preformatted header lines, data must stay valid until the response is destroyed */
+void http_response_add_static(http_response_t *response, const char *data, int datalen);
 void http_response_finish(http_response_t *response, const char *data, int datalen);
 
 void http_response_set_disconnect(http_response_t *response, int disconnect);
 int http_response_get_disconnect(http_response_t *response);
 
-const char *http_response_get_data(http_response_t *response, int *datalen);
+const http_response_segment_t *http_response_get_segments(http_response_t *response, int *count);
 
 void http_response_destroy(http_response_t *response);
 
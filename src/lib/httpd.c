@@ -23,12 +23,67 @@
 #include "compat.h"
 #include "logger.h"
 
+/* Use epoll where available, it only reports the sockets that are ready */
+#if defined(__linux__) && !defined(HTTPD_USE_SELECT)
+# define HTTPD_USE_EPOLL
+# include <sys/epoll.h>
+#endif
+
+/* Request workers need a pipe to wake up the httpd thread */
+#if !defined(WIN32)
+# define HTTPD_USE_WORKERS
+#endif
+
+/* Responses are written with one writev call where available */
+#if !defined(WIN32)
+# define HTTPD_USE_WRITEV
+# include <sys/uio.h>
+#endif
+
+/* Maximum number of ready sockets handled per poll wakeup */
+#define HTTPD_MAX_EVENTS 64
+
+/* Events a socket is polled for */
+#define HTTPD_POLL_READ  0x01
+#define HTTPD_POLL_WRITE 0x02
+
+/* Send buffers up to this size are kept when a connection is closed */
+#define HTTPD_SENDBUF_KEEP 4096
+
+/* Initial and maximum size of the receive ring buffer */
+#define HTTPD_RECVBUF_KEEP 4096
+#define HTTPD_RECVBUF_MAX  65536
+
 struct http_connection_s {
 	int connected;
 
 	int socket_fd;
 	void *user_data;
 	http_request_t *request;
+
+	/* Set while a worker owns the request, socket is not read */
+	int processing;
+	/* Set when the connection failed while a worker owned it */
+	int close_pending;
+	http_response_t *response;
+	struct http_connection_s *next;
+
+	/* Events the socket is currently polled for */
+	int events;
+
+	/* Ring buffer of received data not parsed yet */
+	char *recvbuf;
+	int recvbuf_size;
+	int recvbuf_head;
+	int recvbuf_len;
+
+	/* Outbound data the socket has not accepted yet */
+	char *sendbuf;
+	int sendbuf_size;
+	int sendbuf_len;
+	int sendbuf_pos;
+	unsigned int blocked_since;
+	int close_after_send;
 };
 typedef struct http_connection_s http_connection_t;
 
@@ -40,6 +95,38 @@ struct httpd_s {
 	int open_connections;
 	http_connection_t *connections;
 
+	/* Stack of unused indexes in the connections array */
+	int *free_slots;
+	int free_count;
+
+	/* Set when server fds are polled for new connections */
+	int accepting;
+#if defined(HTTPD_USE_EPOLL)
+	int epoll_fd;
+#else
+	/* Slot where the next scan of ready connections starts */
+	int poll_start;
+#endif
+
+	/* Request worker pool, with no workers requests are handled inline */
+	int num_workers;
+#if defined(HTTPD_USE_WORKERS)
+	thread_handle_t *workers;
+	int wakeup_fds[2];
+
+	/* These variables only edited work_mutex locked */
+	int workers_running;
+	http_connection_t *pending_head;
+	http_connection_t *pending_tail;
+	http_connection_t *finished;
+	mutex_handle_t work_mutex;
+	cond_handle_t work_cond;
+#endif
+
+	/* Send statistics, only edited stats_mutex locked */
+	httpd_stats_t stats;
+	mutex_handle_t stats_mutex;
+
 	/* These variables only edited mutex locked */
 	int running;
 	int joined;
@@ -68,7 +155,10 @@ httpd_init(logger_t *logger, httpd_callbacks_t *callbacks, int max_connections)
 
 	httpd->max_connections = max_connections;
 	httpd->connections = calloc(max_connections, sizeof(http_connection_t));
-	if (!httpd->connections) {
+	httpd->free_slots = calloc(max_connections, sizeof(int));
+	if (!httpd->connections || !httpd->free_slots) {
+		free(httpd->connections);
+		free(httpd->free_slots);
 		free(httpd);
 		return NULL;
 	}
@@ -83,6 +173,15 @@ httpd_init(logger_t *logger, httpd_callbacks_t *callbacks, int max_connections)
 	httpd->running = 0;
 	httpd->joined = 1;
 
+	MUTEX_CREATE(httpd->run_mutex);
+	MUTEX_CREATE(httpd->stats_mutex);
+#if defined(HTTPD_USE_WORKERS)
+	MUTEX_CREATE(httpd->work_mutex);
+	COND_CREATE(httpd->work_cond);
+	httpd->wakeup_fds[0] = -1;
+	httpd->wakeup_fds[1] = -1;
+#endif
+
 	return httpd;
 }
 
@@ -90,35 +189,332 @@ void
 httpd_destroy(httpd_t *httpd)
 {
 	if (httpd) {
+		int i;
+
 		httpd_stop(httpd);
 
+		for (i=0; i<httpd->max_connections; i++) {
+			http_request_destroy(httpd->connections[i].request);
+			free(httpd->connections[i].recvbuf);
+			free(httpd->connections[i].sendbuf);
+		}
+		MUTEX_DESTROY(httpd->run_mutex);
+		MUTEX_DESTROY(httpd->stats_mutex);
+#if defined(HTTPD_USE_WORKERS)
+		MUTEX_DESTROY(httpd->work_mutex);
+		COND_DESTROY(httpd->work_cond);
+#endif
 		free(httpd->connections);
+		free(httpd->free_slots);
 		free(httpd);
 	}
 }
 
+void
+httpd_get_stats(httpd_t *httpd, httpd_stats_t *stats)
+{
+	assert(httpd);
+	assert(stats);
+
+	MUTEX_LOCK(httpd->stats_mutex);
+	memcpy(stats, &httpd->stats, sizeof(httpd_stats_t));
+	MUTEX_UNLOCK(httpd->stats_mutex);
+}
+
+int
+httpd_set_workers(httpd_t *httpd, int workers)
+{
+	assert(httpd);
+
+	if (workers < 0) {
+		return -1;
+	}
+#if !defined(HTTPD_USE_WORKERS)
+	if (workers > 0) {
+		return -1;
+	}
+#endif
+
+	MUTEX_LOCK(httpd->run_mutex);
+	if (httpd->running || !httpd->joined) {
+		MUTEX_UNLOCK(httpd->run_mutex);
+		return -1;
+	}
+	httpd->num_workers = workers;
+	MUTEX_UNLOCK(httpd->run_mutex);
+
+	return 0;
+}
+
+#if defined(HTTPD_USE_EPOLL)
+
+static int
+httpd_poll_init(httpd_t *httpd)
+{
+	httpd->epoll_fd = epoll_create(HTTPD_MAX_EVENTS);
+	return (httpd->epoll_fd == -1) ? -1 : 0;
+}
+
 static void
-httpd_add_connection(httpd_t *httpd, int fd, unsigned char *local, int local_len, unsigned char *remote, int remote_len)
+httpd_poll_destroy(httpd_t *httpd)
 {
-	int i;
+	closesocket(httpd->epoll_fd);
+	httpd->epoll_fd = -1;
+}
+
+static void
+httpd_poll_set(httpd_t *httpd, int fd, void *ptr, int old_events, int new_events)
+{
+	struct epoll_event ev;
+	int op;
+
+	if (old_events == new_events) {
+		return;
+	} else if (!new_events) {
+		op = EPOLL_CTL_DEL;
+	} else if (!old_events) {
+		op = EPOLL_CTL_ADD;
+	} else {
+		op = EPOLL_CTL_MOD;
+	}
+
+	/* Event pointer is ignored on delete but must be non-NULL on old kernels */
+	memset(&ev, 0, sizeof(ev));
+	ev.events = ((new_events & HTTPD_POLL_READ) ? EPOLLIN : 0) |
+	            ((new_events & HTTPD_POLL_WRITE) ? EPOLLOUT : 0);
+	ev.data.ptr = ptr;
+	if (epoll_ctl(httpd->epoll_fd, op, fd, &ev) == -1) {
+		logger_log(httpd->logger, LOGGER_ERR, "Error updating socket %d in epoll", fd);
+	}
+}
+
+static int
+httpd_poll_fits(httpd_t *httpd, int fd)
+{
+	return 1;
+}
+
+static int
+httpd_poll_wait(httpd_t *httpd, void **ready, int *events, int timeout)
+{
+	struct epoll_event epoll_events[HTTPD_MAX_EVENTS];
+	int ret, i;
+
+	ret = epoll_wait(httpd->epoll_fd, epoll_events, HTTPD_MAX_EVENTS, timeout);
+	if (ret == -1 && SOCKET_GET_ERROR() == EINTR) {
+		return 0;
+	}
+	for (i=0; i<ret; i++) {
+		ready[i] = epoll_events[i].data.ptr;
+		events[i] = 0;
+		/* Errors and hangups are reported to the reader */
+		if (epoll_events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+			events[i] |= HTTPD_POLL_READ;
+		}
+		if (epoll_events[i].events & EPOLLOUT) {
+			events[i] |= HTTPD_POLL_WRITE;
+		}
+	}
+	return ret;
+}
+
+#else
+
+static int
+httpd_poll_init(httpd_t *httpd)
+{
+	return 0;
+}
+
+static void
+httpd_poll_destroy(httpd_t *httpd)
+{
+}
+
+static void
+httpd_poll_set(httpd_t *httpd, int fd, void *ptr, int old_events, int new_events)
+{
+	/* The fd_sets are rebuilt from the connections array on every wait */
+}
 
+static int
+httpd_poll_fits(httpd_t *httpd, int fd)
+{
+#if defined(WIN32)
+	/* Winsock fd_sets hold FD_SETSIZE sockets of any value, two are servers */
+	return httpd->open_connections < FD_SETSIZE-2;
+#else
+	/* Other fd_sets are bitmaps indexed by the fd */
+	return fd < FD_SETSIZE;
+#endif
+}
+
+static int
+httpd_poll_wait(httpd_t *httpd, void **ready, int *events, int timeout)
+{
+	fd_set rfds, wfds;
+	struct timeval tv;
+	int nfds=0;
+	int nready=0;
+	int ret, i, n;
+
+	tv.tv_sec = timeout/1000;
+	tv.tv_usec = (timeout%1000)*1000;
+
+	/* Get the correct nfds value and set rfds and wfds */
+	FD_ZERO(&rfds);
+	FD_ZERO(&wfds);
+	if (httpd->accepting) {
+		FD_SET(httpd->server_fd4, &rfds);
+		nfds = httpd->server_fd4+1;
+		if (httpd->server_fd6 != -1) {
+			FD_SET(httpd->server_fd6, &rfds);
+			if (nfds <= httpd->server_fd6) {
+				nfds = httpd->server_fd6+1;
+			}
+		}
+	}
+#if defined(HTTPD_USE_WORKERS)
+	if (httpd->wakeup_fds[0] != -1) {
+		FD_SET(httpd->wakeup_fds[0], &rfds);
+		if (nfds <= httpd->wakeup_fds[0]) {
+			nfds = httpd->wakeup_fds[0]+1;
+		}
+	}
+#endif
 	for (i=0; i<httpd->max_connections; i++) {
-		if (!httpd->connections[i].connected) {
-			break;
+		http_connection_t *connection = &httpd->connections[i];
+		int socket_fd;
+
+		if (!connection->connected || !connection->events) {
+			continue;
+		}
+		socket_fd = connection->socket_fd;
+		if (connection->events & HTTPD_POLL_READ) {
+			FD_SET(socket_fd, &rfds);
+		}
+		if (connection->events & HTTPD_POLL_WRITE) {
+			FD_SET(socket_fd, &wfds);
+		}
+		if (nfds <= socket_fd) {
+			nfds = socket_fd+1;
 		}
 	}
-	if (i == httpd->max_connections) {
-		/* This code should never be reached, we do not select server_fds when full */
+
+	ret = select(nfds, &rfds, &wfds, NULL, &tv);
+	if (ret <= 0) {
+		return ret;
+	}
+
+	if (httpd->accepting && FD_ISSET(httpd->server_fd4, &rfds)) {
+		events[nready] = HTTPD_POLL_READ;
+		ready[nready++] = &httpd->server_fd4;
+	}
+	if (httpd->accepting && httpd->server_fd6 != -1 && FD_ISSET(httpd->server_fd6, &rfds)) {
+		events[nready] = HTTPD_POLL_READ;
+		ready[nready++] = &httpd->server_fd6;
+	}
+#if defined(HTTPD_USE_WORKERS)
+	if (httpd->wakeup_fds[0] != -1 && FD_ISSET(httpd->wakeup_fds[0], &rfds)) {
+		events[nready] = HTTPD_POLL_READ;
+		ready[nready++] = &httpd->wakeup_fds[0];
+	}
+#endif
+	/* Scan from where the last capped scan stopped so every slot gets served */
+	for (n=0; n<httpd->max_connections && nready<HTTPD_MAX_EVENTS; n++) {
+		http_connection_t *connection;
+
+		i = (httpd->poll_start+n)%httpd->max_connections;
+		connection = &httpd->connections[i];
+
+		/* Sockets not reported now stay ready for the next wait */
+		if (!connection->connected || !connection->events) {
+			continue;
+		}
+		events[nready] = 0;
+		if ((connection->events & HTTPD_POLL_READ) && FD_ISSET(connection->socket_fd, &rfds)) {
+			events[nready] |= HTTPD_POLL_READ;
+		}
+		if ((connection->events & HTTPD_POLL_WRITE) && FD_ISSET(connection->socket_fd, &wfds)) {
+			events[nready] |= HTTPD_POLL_WRITE;
+		}
+		if (events[nready]) {
+			ready[nready++] = connection;
+		}
+	}
+	httpd->poll_start = (httpd->poll_start+n)%httpd->max_connections;
+	return nready;
+}
+
+#endif
+
+static void
+httpd_set_accepting(httpd_t *httpd, int accepting)
+{
+	int old_events, new_events;
+
+	if (httpd->accepting == accepting) {
+		return;
+	}
+	old_events = httpd->accepting ? HTTPD_POLL_READ : 0;
+	new_events = accepting ? HTTPD_POLL_READ : 0;
+	httpd_poll_set(httpd, httpd->server_fd4, &httpd->server_fd4, old_events, new_events);
+	if (httpd->server_fd6 != -1) {
+		httpd_poll_set(httpd, httpd->server_fd6, &httpd->server_fd6, old_events, new_events);
+	}
+	httpd->accepting = accepting;
+}
+
+static void
+httpd_update_events(httpd_t *httpd, http_connection_t *connection)
+{
+	int events = 0;
+
+	/* Requests are not read while one is processed, its response is */
+	/* still queued or the socket is closing */
+	if (!connection->processing && !connection->close_after_send &&
+	    !connection->close_pending &&
+	    connection->sendbuf_pos == connection->sendbuf_len) {
+		events |= HTTPD_POLL_READ;
+	}
+	if (!connection->close_pending &&
+	    connection->sendbuf_pos < connection->sendbuf_len) {
+		events |= HTTPD_POLL_WRITE;
+	}
+	httpd_poll_set(httpd, connection->socket_fd, connection, connection->events, events);
+	connection->events = events;
+}
+
+static void
+httpd_add_connection(httpd_t *httpd, int fd, unsigned char *local, int local_len, unsigned char *remote, int remote_len)
+{
+	http_connection_t *connection;
+
+	if (httpd->free_count == 0) {
+		/* This code should never be reached, we do not poll server_fds when full */
 		logger_log(httpd->logger, LOGGER_INFO, "Max connections reached");
 		shutdown(fd, SHUT_RDWR);
 		closesocket(fd);
 		return;
 	}
+	connection = &httpd->connections[httpd->free_slots[--httpd->free_count]];
 
 	httpd->open_connections++;
-	httpd->connections[i].socket_fd = fd;
-	httpd->connections[i].connected = 1;
-	httpd->connections[i].user_data = httpd->callbacks.conn_init(httpd->callbacks.opaque, local, local_len, remote, remote_len);
+	connection->socket_fd = fd;
+	connection->connected = 1;
+	connection->events = 0;
+	connection->recvbuf_head = 0;
+	connection->recvbuf_len = 0;
+	connection->sendbuf_len = 0;
+	connection->sendbuf_pos = 0;
+	connection->close_after_send = 0;
+	connection->close_pending = 0;
+	connection->user_data = httpd->callbacks.conn_init(httpd->callbacks.opaque, local, local_len, remote, remote_len);
+	httpd_update_events(httpd, connection);
+
+	if (httpd->open_connections == httpd->max_connections) {
+		httpd_set_accepting(httpd, 0);
+	}
 }
 
 static int
@@ -146,6 +542,18 @@ httpd_accept_connection(httpd_t *httpd, int server_fd, int is_ipv6)
 		return 0;
 	}
 
+	if (!httpd_poll_fits(httpd, fd)) {
+		logger_log(httpd->logger, LOGGER_WARNING, "Socket %d can not be polled, closing it", fd);
+		closesocket(fd);
+		return 0;
+	}
+
+	/* Responses are queued when the peer does not read them */
+	if (netutils_set_nonblocking(fd) == -1) {
+		closesocket(fd);
+		return 0;
+	}
+
 	logger_log(httpd->logger, LOGGER_INFO, "Accepted %s client on socket %d",
 	           (is_ipv6 ? "IPv6"  : "IPv4"), fd);
 	local = netutils_get_address(&local_saddr, &local_len);
@@ -159,29 +567,650 @@ static void
 httpd_remove_connection(httpd_t *httpd, http_connection_t *connection)
 {
 	if (connection->request) {
-		http_request_destroy(connection->request);
-		connection->request = NULL;
+		/* Request is kept for the next client of this slot */
+		http_request_reset(connection->request);
+	}
+	if (connection->response) {
+		http_response_destroy(connection->response);
+		connection->response = NULL;
+	}
+	if (connection->sendbuf_pos < connection->sendbuf_len) {
+		unsigned int now;
+
+		SYSTEM_GET_TIME(now);
+		MUTEX_LOCK(httpd->stats_mutex);
+		httpd->stats.blocked_ms += now-connection->blocked_since;
+		httpd->stats.blocked_connections--;
+		MUTEX_UNLOCK(httpd->stats_mutex);
 	}
 	httpd->callbacks.conn_destroy(connection->user_data);
+	httpd_poll_set(httpd, connection->socket_fd, connection, connection->events, 0);
 	shutdown(connection->socket_fd, SHUT_WR);
 	closesocket(connection->socket_fd);
 	connection->connected = 0;
+	connection->processing = 0;
+	connection->close_pending = 0;
+	connection->events = 0;
+	connection->sendbuf_len = 0;
+	connection->sendbuf_pos = 0;
 	httpd->open_connections--;
+	httpd->free_slots[httpd->free_count++] = connection - httpd->connections;
+
+	/* Keep the buffers of a normal sized connection for the next client */
+	if (connection->recvbuf_size > HTTPD_RECVBUF_KEEP) {
+		free(connection->recvbuf);
+		connection->recvbuf = NULL;
+		connection->recvbuf_size = 0;
+	}
+	if (connection->sendbuf_size > HTTPD_SENDBUF_KEEP) {
+		free(connection->sendbuf);
+		connection->sendbuf = NULL;
+		connection->sendbuf_size = 0;
+	}
+
+	if (httpd->open_connections < httpd->max_connections) {
+		httpd_set_accepting(httpd, 1);
+	}
+}
+
+/* A connection owned by a worker is removed when its request finishes */
+static void
+httpd_close_connection(httpd_t *httpd, http_connection_t *connection)
+{
+	if (connection->processing) {
+		connection->close_pending = 1;
+		httpd_update_events(httpd, connection);
+		return;
+	}
+	httpd_remove_connection(httpd, connection);
+}
+
+/* Returns number of bytes sent, or -1 if the connection failed */
+static int
+httpd_send_data(httpd_t *httpd, http_connection_t *connection, const char *data, int datalen)
+{
+	int written = 0;
+
+	while (written < datalen) {
+		int ret = send(connection->socket_fd, data+written, datalen-written, 0);
+		if (ret == -1) {
+			int error = SOCKET_GET_ERROR();
+			if (error == SOCKET_ERRORNAME(EAGAIN) || error == SOCKET_ERRORNAME(EWOULDBLOCK)) {
+				break;
+			} else if (error == SOCKET_ERRORNAME(EINTR)) {
+				continue;
+			}
+			logger_log(httpd->logger, LOGGER_INFO, "Error in sending data on socket %d", connection->socket_fd);
+			return -1;
+		}
+		written += ret;
+	}
+
+	MUTEX_LOCK(httpd->stats_mutex);
+	httpd->stats.bytes_sent += written;
+	MUTEX_UNLOCK(httpd->stats_mutex);
+	return written;
+}
+
+/* Returns number of bytes sent, or -1 if the connection failed */
+static int
+httpd_send_segments(httpd_t *httpd, http_connection_t *connection, const http_response_segment_t *segments, int count)
+{
+#if defined(HTTPD_USE_WRITEV)
+	struct iovec iov[HTTP_RESPONSE_MAX_SEGMENTS];
+	int written = 0;
+	int i, first;
+
+	assert(count <= HTTP_RESPONSE_MAX_SEGMENTS);
+
+	for (i=0; i<count; i++) {
+		iov[i].iov_base = (void *)segments[i].data;
+		iov[i].iov_len = segments[i].datalen;
+	}
+
+	first = 0;
+	while (first < count) {
+		int ret = writev(connection->socket_fd, iov+first, count-first);
+		if (ret == -1) {
+			int error = SOCKET_GET_ERROR();
+			if (error == SOCKET_ERRORNAME(EAGAIN) || error == SOCKET_ERRORNAME(EWOULDBLOCK)) {
+				break;
+			} else if (error == SOCKET_ERRORNAME(EINTR)) {
+				continue;
+			}
+			logger_log(httpd->logger, LOGGER_INFO, "Error in sending data on socket %d", connection->socket_fd);
+			return -1;
+		}
+		written += ret;
+
+		/* Skip the segments written completely */
+		while (first < count && (size_t)ret >= iov[first].iov_len) {
+			ret -= iov[first].iov_len;
+			first++;
+		}
+		if (first < count) {
+			iov[first].iov_base = (char *)iov[first].iov_base+ret;
+			iov[first].iov_len -= ret;
+		}
+	}
+
+	MUTEX_LOCK(httpd->stats_mutex);
+	httpd->stats.bytes_sent += written;
+	MUTEX_UNLOCK(httpd->stats_mutex);
+	return written;
+#else
+	int written = 0;
+	int i;
+
+	for (i=0; i<count; i++) {
+		int ret = httpd_send_data(httpd, connection, segments[i].data, segments[i].datalen);
+		if (ret == -1) {
+			return -1;
+		}
+		written += ret;
+		if (ret < segments[i].datalen) {
+			break;
+		}
+	}
+	return written;
+#endif
+}
+
+/* Returns -1 if the connection failed and was removed */
+static int
+httpd_queue_segments(httpd_t *httpd, http_connection_t *connection, const http_response_segment_t *segments, int count)
+{
+	int queued, datalen, skip, ret, i;
+
+	datalen = 0;
+	for (i=0; i<count; i++) {
+		datalen += segments[i].datalen;
+	}
+
+	/* Write directly unless earlier data is still waiting */
+	skip = 0;
+	if (connection->sendbuf_pos == connection->sendbuf_len) {
+		ret = httpd_send_segments(httpd, connection, segments, count);
+		if (ret == -1) {
+			httpd_close_connection(httpd, connection);
+			return -1;
+		} else if (ret == datalen) {
+			return 0;
+		}
+		skip = ret;
+		datalen -= ret;
+
+		/* Socket is full, wait until it is writable again */
+		connection->sendbuf_len = connection->sendbuf_pos = 0;
+		SYSTEM_GET_TIME(connection->blocked_since);
+		MUTEX_LOCK(httpd->stats_mutex);
+		httpd->stats.blocked_connections++;
+		MUTEX_UNLOCK(httpd->stats_mutex);
+	}
+
+	queued = connection->sendbuf_len-connection->sendbuf_pos;
+	if (connection->sendbuf_pos > 0) {
+		/* Move the unsent data to the beginning of the buffer */
+		memmove(connection->sendbuf, connection->sendbuf+connection->sendbuf_pos, queued);
+		connection->sendbuf_pos = 0;
+		connection->sendbuf_len = queued;
+	}
+	if (connection->sendbuf_size < queued+datalen) {
+		char *sendbuf;
+		int size;
+
+		size = connection->sendbuf_size ? connection->sendbuf_size : HTTPD_SENDBUF_KEEP;
+		while (size < queued+datalen) {
+			size *= 2;
+		}
+		sendbuf = realloc(connection->sendbuf, size);
+		if (!sendbuf) {
+			logger_log(httpd->logger, LOGGER_ERR, "Error allocating send buffer for socket %d", connection->socket_fd);
+			httpd_close_connection(httpd, connection);
+			return -1;
+		}
+		connection->sendbuf = sendbuf;
+		connection->sendbuf_size = size;
+	}
+
+	/* Copy what was not written, skipping the bytes already sent */
+	for (i=0; i<count; i++) {
+		const char *data = segments[i].data;
+		int length = segments[i].datalen;
+
+		if (skip >= length) {
+			skip -= length;
+			continue;
+		}
+		data += skip;
+		length -= skip;
+		skip = 0;
+
+		memcpy(connection->sendbuf+connection->sendbuf_len, data, length);
+		connection->sendbuf_len += length;
+	}
+
+	MUTEX_LOCK(httpd->stats_mutex);
+	httpd->stats.bytes_queued += datalen;
+	if (httpd->stats.max_queued < connection->sendbuf_len) {
+		httpd->stats.max_queued = connection->sendbuf_len;
+	}
+	MUTEX_UNLOCK(httpd->stats_mutex);
+
+	httpd_update_events(httpd, connection);
+	return 0;
+}
+
+static void httpd_parse_buffered(httpd_t *httpd, http_connection_t *connection);
+
+static void
+httpd_flush_connection(httpd_t *httpd, http_connection_t *connection)
+{
+	unsigned int now;
+	int ret;
+
+	ret = httpd_send_data(httpd, connection,
+	                      connection->sendbuf+connection->sendbuf_pos,
+	                      connection->sendbuf_len-connection->sendbuf_pos);
+	if (ret == -1) {
+		httpd_close_connection(httpd, connection);
+		return;
+	}
+	connection->sendbuf_pos += ret;
+	if (connection->sendbuf_pos < connection->sendbuf_len) {
+		return;
+	}
+
+	/* Everything written, the socket is not blocked any more */
+	connection->sendbuf_len = connection->sendbuf_pos = 0;
+	SYSTEM_GET_TIME(now);
+	MUTEX_LOCK(httpd->stats_mutex);
+	httpd->stats.blocked_ms += now-connection->blocked_since;
+	httpd->stats.blocked_connections--;
+	MUTEX_UNLOCK(httpd->stats_mutex);
+
+	if (connection->close_after_send) {
+		logger_log(httpd->logger, LOGGER_INFO, "Disconnecting on software request");
+		httpd_close_connection(httpd, connection);
+		return;
+	}
+	httpd_update_events(httpd, connection);
+
+	/* Continue with requests that arrived while the socket was blocked */
+	httpd_parse_buffered(httpd, connection);
+}
+
+static void
+httpd_finish_request(httpd_t *httpd, http_connection_t *connection)
+{
+	http_response_t *response = connection->response;
+
+	http_request_reset(connection->request);
+	connection->response = NULL;
+	connection->processing = 0;
+
+	if (connection->close_pending) {
+		/* Socket failed while the request was processed, drop the response */
+		logger_log(httpd->logger, LOGGER_INFO, "Removing failed connection for socket %d", connection->socket_fd);
+		httpd_remove_connection(httpd, connection);
+		http_response_destroy(response);
+		return;
+	}
+
+	if (response) {
+		const http_response_segment_t *segments;
+		int count;
+
+		/* Get response data as segments */
+		segments = http_response_get_segments(response, &count);
+		if (http_response_get_disconnect(response)) {
+			connection->close_after_send = 1;
+		}
+
+		if (httpd_queue_segments(httpd, connection, segments, count) == -1) {
+			/* Connection was removed */
+		} else if (connection->close_after_send && connection->sendbuf_pos == connection->sendbuf_len) {
+			logger_log(httpd->logger, LOGGER_INFO, "Disconnecting on software request");
+			httpd_remove_connection(httpd, connection);
+		} else {
+			httpd_update_events(httpd, connection);
+		}
+	} else {
+		logger_log(httpd->logger, LOGGER_INFO, "Didn't get response");
+		if (connection->close_after_send && connection->sendbuf_pos == connection->sendbuf_len) {
+			httpd_remove_connection(httpd, connection);
+		} else {
+			httpd_update_events(httpd, connection);
+		}
+	}
+	http_response_destroy(response);
+}
+
+#if defined(HTTPD_USE_WORKERS)
+
+static THREAD_RETVAL
+httpd_worker_thread(void *arg)
+{
+	httpd_t *httpd = arg;
+
+	assert(httpd);
+
+	MUTEX_LOCK(httpd->work_mutex);
+	while (1) {
+		http_connection_t *connection;
+
+		while (httpd->workers_running && !httpd->pending_head) {
+			COND_WAIT(httpd->work_cond, httpd->work_mutex);
+		}
+		if (!httpd->workers_running) {
+			break;
+		}
+
+		/* Take the oldest pending request from the queue */
+		connection = httpd->pending_head;
+		httpd->pending_head = connection->next;
+		if (!httpd->pending_head) {
+			httpd->pending_tail = NULL;
+		}
+		MUTEX_UNLOCK(httpd->work_mutex);
+
+		httpd->callbacks.conn_request(connection->user_data, connection->request, &connection->response);
+
+		/* Hand the connection back and wake up the httpd thread */
+		MUTEX_LOCK(httpd->work_mutex);
+		connection->next = httpd->finished;
+		httpd->finished = connection;
+		if (write(httpd->wakeup_fds[1], "", 1) == -1) {
+			/* Pipe is full, httpd thread is already going to wake up */
+		}
+	}
+	MUTEX_UNLOCK(httpd->work_mutex);
+
+	return 0;
+}
+
+static int
+httpd_start_workers(httpd_t *httpd)
+{
+	int i;
+
+	if (!httpd->num_workers) {
+		return 0;
+	}
+	if (pipe(httpd->wakeup_fds) == -1) {
+		return -1;
+	}
+	if (!httpd_poll_fits(httpd, httpd->wakeup_fds[0])) {
+		close(httpd->wakeup_fds[0]);
+		close(httpd->wakeup_fds[1]);
+		httpd->wakeup_fds[0] = httpd->wakeup_fds[1] = -1;
+		return -1;
+	}
+	/* Workers must not block on the pipe, one byte is enough to wake up */
+	netutils_set_nonblocking(httpd->wakeup_fds[0]);
+	netutils_set_nonblocking(httpd->wakeup_fds[1]);
+
+	httpd->workers = calloc(httpd->num_workers, sizeof(thread_handle_t));
+	if (!httpd->workers) {
+		close(httpd->wakeup_fds[0]);
+		close(httpd->wakeup_fds[1]);
+		httpd->wakeup_fds[0] = httpd->wakeup_fds[1] = -1;
+		return -1;
+	}
+	httpd_poll_set(httpd, httpd->wakeup_fds[0], &httpd->wakeup_fds[0], 0, HTTPD_POLL_READ);
+
+	httpd->workers_running = 1;
+	httpd->pending_head = httpd->pending_tail = NULL;
+	httpd->finished = NULL;
+	for (i=0; i<httpd->num_workers; i++) {
+		THREAD_CREATE(httpd->workers[i], httpd_worker_thread, httpd);
+		if (!httpd->workers[i]) {
+			break;
+		}
+	}
+
+	/* Handle requests with the workers that started, only they are joined */
+	if (i < httpd->num_workers) {
+		logger_log(httpd->logger, LOGGER_WARNING, "Started %d of %d request workers", i, httpd->num_workers);
+		httpd->num_workers = i;
+	}
+	if (!httpd->num_workers) {
+		httpd->workers_running = 0;
+		free(httpd->workers);
+		httpd->workers = NULL;
+		httpd_poll_set(httpd, httpd->wakeup_fds[0], &httpd->wakeup_fds[0], HTTPD_POLL_READ, 0);
+		close(httpd->wakeup_fds[0]);
+		close(httpd->wakeup_fds[1]);
+		httpd->wakeup_fds[0] = httpd->wakeup_fds[1] = -1;
+		return -1;
+	}
+	return 0;
+}
+
+static void
+httpd_handle_finished(httpd_t *httpd)
+{
+	http_connection_t *connection;
+	char buffer[64];
+
+	while (read(httpd->wakeup_fds[0], buffer, sizeof(buffer)) > 0);
+
+	MUTEX_LOCK(httpd->work_mutex);
+	connection = httpd->finished;
+	httpd->finished = NULL;
+	MUTEX_UNLOCK(httpd->work_mutex);
+
+	while (connection) {
+		http_connection_t *next = connection->next;
+
+		/* Slots of processed requests are not removed or reused */
+		assert(connection->connected && connection->processing);
+		connection->next = NULL;
+		httpd_finish_request(httpd, connection);
+
+		/* Continue with requests that arrived during processing */
+		httpd_parse_buffered(httpd, connection);
+		connection = next;
+	}
+}
+
+static void
+httpd_stop_workers(httpd_t *httpd)
+{
+	int i;
+
+	if (!httpd->workers) {
+		return;
+	}
+
+	/* Workers finish their current request before exiting */
+	MUTEX_LOCK(httpd->work_mutex);
+	httpd->workers_running = 0;
+	COND_BROADCAST(httpd->work_cond);
+	MUTEX_UNLOCK(httpd->work_mutex);
+	for (i=0; i<httpd->num_workers; i++) {
+		THREAD_JOIN(httpd->workers[i]);
+	}
+	free(httpd->workers);
+	httpd->workers = NULL;
+
+	/* Responses that were not sent are freed with their connections */
+	httpd->pending_head = httpd->pending_tail = NULL;
+	httpd->finished = NULL;
+
+	httpd_poll_set(httpd, httpd->wakeup_fds[0], &httpd->wakeup_fds[0], HTTPD_POLL_READ, 0);
+	close(httpd->wakeup_fds[0]);
+	close(httpd->wakeup_fds[1]);
+	httpd->wakeup_fds[0] = httpd->wakeup_fds[1] = -1;
+}
+
+#endif
+
+static void
+httpd_dispatch_request(httpd_t *httpd, http_connection_t *connection)
+{
+#if defined(HTTPD_USE_WORKERS)
+	if (httpd->workers) {
+		/* Connection is not read again until the response is queued, */
+		/* this keeps responses in order within a connection */
+		connection->processing = 1;
+		connection->next = NULL;
+		httpd_update_events(httpd, connection);
+
+		MUTEX_LOCK(httpd->work_mutex);
+		if (httpd->pending_tail) {
+			httpd->pending_tail->next = connection;
+		} else {
+			httpd->pending_head = connection;
+		}
+		httpd->pending_tail = connection;
+		COND_SIGNAL(httpd->work_cond);
+		MUTEX_UNLOCK(httpd->work_mutex);
+		return;
+	}
+#endif
+
+	httpd->callbacks.conn_request(connection->user_data, connection->request, &connection->response);
+	httpd_finish_request(httpd, connection);
+}
+
+static void
+httpd_parse_buffered(httpd_t *httpd, http_connection_t *connection)
+{
+	/* The next request waits until the previous response is sent */
+	while (connection->connected && !connection->processing &&
+	       !connection->close_after_send && connection->recvbuf_len > 0 &&
+	       connection->sendbuf_pos == connection->sendbuf_len) {
+		int datalen, ret;
+
+		/* Requests are allocated once per slot and reset after use */
+		if (!connection->request) {
+			connection->request = http_request_init();
+			assert(connection->request);
+		}
+
+		/* Parse the contiguous data from the head of the ring buffer */
+		datalen = connection->recvbuf_size-connection->recvbuf_head;
+		if (datalen > connection->recvbuf_len) {
+			datalen = connection->recvbuf_len;
+		}
+		ret = http_request_add_data(connection->request, connection->recvbuf+connection->recvbuf_head, datalen);
+		if (http_request_has_error(connection->request)) {
+			logger_log(httpd->logger, LOGGER_INFO, "Error in parsing: %s", http_request_get_error_name(connection->request));
+			httpd_remove_connection(httpd, connection);
+			return;
+		}
+		connection->recvbuf_head = (connection->recvbuf_head+ret)%connection->recvbuf_size;
+		connection->recvbuf_len -= ret;
+		if (!connection->recvbuf_len) {
+			connection->recvbuf_head = 0;
+		}
+
+		/* If request is finished, process and deallocate */
+		if (http_request_is_complete(connection->request)) {
+			httpd_dispatch_request(httpd, connection);
+		} else if (!connection->recvbuf_len) {
+			logger_log(httpd->logger, LOGGER_DEBUG, "Request not complete, waiting for more data...");
+		}
+	}
+}
+
+/* Returns number of bytes received, 0 on end of stream and -1 on error */
+static int
+httpd_receive_data(httpd_t *httpd, http_connection_t *connection)
+{
+	int tail, space, ret;
+
+	if (connection->recvbuf_len == connection->recvbuf_size) {
+		char *recvbuf;
+		int size, first;
+
+		/* Grow and linearize the full ring buffer */
+		size = connection->recvbuf_size ? connection->recvbuf_size*2 : HTTPD_RECVBUF_KEEP;
+		recvbuf = malloc(size);
+		if (!recvbuf) {
+			return -1;
+		}
+		first = connection->recvbuf_size-connection->recvbuf_head;
+		if (first > connection->recvbuf_len) {
+			first = connection->recvbuf_len;
+		}
+		if (connection->recvbuf_len) {
+			memcpy(recvbuf, connection->recvbuf+connection->recvbuf_head, first);
+			memcpy(recvbuf+first, connection->recvbuf, connection->recvbuf_len-first);
+		}
+		free(connection->recvbuf);
+		connection->recvbuf = recvbuf;
+		connection->recvbuf_size = size;
+		connection->recvbuf_head = 0;
+	}
+
+	/* Receive into the contiguous free space after the tail */
+	tail = (connection->recvbuf_head+connection->recvbuf_len)%connection->recvbuf_size;
+	if (tail < connection->recvbuf_head) {
+		space = connection->recvbuf_head-tail;
+	} else {
+		space = connection->recvbuf_size-tail;
+	}
+	ret = recv(connection->socket_fd, connection->recvbuf+tail, space, 0);
+	if (ret > 0) {
+		connection->recvbuf_len += ret;
+	}
+	return ret;
+}
+
+static void
+httpd_handle_connection(httpd_t *httpd, http_connection_t *connection)
+{
+	int closed = 0;
+	int ret;
+
+	logger_log(httpd->logger, LOGGER_DEBUG, "Receiving on socket %d", connection->socket_fd);
+	while (connection->connected && !connection->processing && !connection->close_after_send) {
+		/* Read until the socket is empty or the buffer is at its limit */
+		do {
+			ret = httpd_receive_data(httpd, connection);
+		} while (ret > 0 && (connection->recvbuf_len < connection->recvbuf_size ||
+		                     connection->recvbuf_size < HTTPD_RECVBUF_MAX));
+		if (ret == 0) {
+			closed = 1;
+		} else if (ret == -1 && SOCKET_GET_ERROR() != SOCKET_ERRORNAME(EAGAIN) &&
+		           SOCKET_GET_ERROR() != SOCKET_ERRORNAME(EWOULDBLOCK) &&
+		           SOCKET_GET_ERROR() != SOCKET_ERRORNAME(EINTR)) {
+			closed = 1;
+		}
+
+		/* Parse HTTP requests from data read from connection */
+		httpd_parse_buffered(httpd, connection);
+		if (closed || ret == -1 || connection->recvbuf_len == HTTPD_RECVBUF_MAX) {
+			break;
+		}
+	}
+
+	if (closed && connection->connected) {
+		logger_log(httpd->logger, LOGGER_INFO, "Connection closed for socket %d", connection->socket_fd);
+		if (connection->processing || connection->sendbuf_pos < connection->sendbuf_len) {
+			/* Send the pending response before closing */
+			connection->close_after_send = 1;
+			httpd_update_events(httpd, connection);
+		} else {
+			httpd_remove_connection(httpd, connection);
+		}
+	}
 }
 
 static THREAD_RETVAL
 httpd_thread(void *arg)
 {
 	httpd_t *httpd = arg;
-	char buffer[1024];
+	void *ready[HTTPD_MAX_EVENTS];
+	int events[HTTPD_MAX_EVENTS];
 	int i;
 
 	assert(httpd);
 
 	while (1) {
-		fd_set rfds;
-		struct timeval tv;
-		int nfds=0;
+		int nready;
 		int ret;
 
 		MUTEX_LOCK(httpd->run_mutex);
@@ -191,134 +1220,60 @@ httpd_thread(void *arg)
 		}
 		MUTEX_UNLOCK(httpd->run_mutex);
 
-		/* Set timeout value to 5ms */
-		tv.tv_sec = 1;
-		tv.tv_usec = 5000;
-
-		/* Get the correct nfds value and set rfds */
-		FD_ZERO(&rfds);
-		if (httpd->open_connections < httpd->max_connections) {
-			FD_SET(httpd->server_fd4, &rfds);
-			nfds = httpd->server_fd4+1;
-			if (httpd->server_fd6 != -1) {
-				FD_SET(httpd->server_fd6, &rfds);
-				if (nfds <= httpd->server_fd6) {
-					nfds = httpd->server_fd6+1;
-				}
-			}
-		}
-		for (i=0; i<httpd->max_connections; i++) {
-			int socket_fd;
-			if (!httpd->connections[i].connected) {
-				continue;
-			}
-			socket_fd = httpd->connections[i].socket_fd;
-			FD_SET(socket_fd, &rfds);
-			if (nfds <= socket_fd) {
-				nfds = socket_fd+1;
-			}
-		}
-
-		ret = select(nfds, &rfds, NULL, NULL, &tv);
-		if (ret == 0) {
+		/* Wake up at least once a second to check the running flag */
+		nready = httpd_poll_wait(httpd, ready, events, 1005);
+		if (nready == 0) {
 			/* Timeout happened */
 			continue;
-		} else if (ret == -1) {
+		} else if (nready == -1) {
 			/* FIXME: Error happened */
-			logger_log(httpd->logger, LOGGER_INFO, "Error in select");
+			logger_log(httpd->logger, LOGGER_INFO, "Error in polling sockets");
 			break;
 		}
 
-		if (FD_ISSET(httpd->server_fd4, &rfds)) {
-			ret = httpd_accept_connection(httpd, httpd->server_fd4, 0);
-			if (ret == -1) {
-				break;
-			} else if (ret == 0) {
-				continue;
-			}
-		}
-		if (httpd->server_fd6 != -1 && FD_ISSET(httpd->server_fd6, &rfds)) {
-			ret = httpd_accept_connection(httpd, httpd->server_fd6, 1);
-			if (ret == -1) {
-				break;
-			} else if (ret == 0) {
-				continue;
-			}
-		}
-		for (i=0; i<httpd->max_connections; i++) {
-			http_connection_t *connection = &httpd->connections[i];
+		/* Handle connections first, accepting could reuse a removed slot */
+		for (i=0; i<nready; i++) {
+			http_connection_t *connection;
 
-			if (!connection->connected) {
+			if (ready[i] == &httpd->server_fd4 || ready[i] == &httpd->server_fd6) {
 				continue;
 			}
-			if (!FD_ISSET(connection->socket_fd, &rfds)) {
+#if defined(HTTPD_USE_WORKERS)
+			if (ready[i] == &httpd->wakeup_fds[0]) {
+				httpd_handle_finished(httpd);
 				continue;
 			}
+#endif
 
-			/* If not in the middle of request, allocate one */
-			if (!connection->request) {
-				connection->request = http_request_init();
-				assert(connection->request);
-			}
-
-			logger_log(httpd->logger, LOGGER_DEBUG, "Receiving on socket %d", connection->socket_fd);
-			ret = recv(connection->socket_fd, buffer, sizeof(buffer), 0);
-			if (ret == 0) {
-				logger_log(httpd->logger, LOGGER_INFO, "Connection closed for socket %d", connection->socket_fd);
-				httpd_remove_connection(httpd, connection);
-				continue;
+			/* Connection might have been removed earlier in this batch */
+			connection = ready[i];
+			if (connection->connected && (events[i] & HTTPD_POLL_WRITE) &&
+			    (connection->events & HTTPD_POLL_WRITE)) {
+				httpd_flush_connection(httpd, connection);
 			}
-
-			/* Parse HTTP request from data read from connection */
-			http_request_add_data(connection->request, buffer, ret);
-			if (http_request_has_error(connection->request)) {
-				logger_log(httpd->logger, LOGGER_INFO, "Error in parsing: %s", http_request_get_error_name(connection->request));
-				httpd_remove_connection(httpd, connection);
-				continue;
+			if (connection->connected && (events[i] & HTTPD_POLL_READ) &&
+			    (connection->events & HTTPD_POLL_READ)) {
+				httpd_handle_connection(httpd, connection);
 			}
+		}
 
-			/* If request is finished, process and deallocate */
-			if (http_request_is_complete(connection->request)) {
-				http_response_t *response = NULL;
-
-				httpd->callbacks.conn_request(connection->user_data, connection->request, &response);
-				http_request_destroy(connection->request);
-				connection->request = NULL;
-
-				if (response) {
-					const char *data;
-					int datalen;
-					int written;
-					int ret;
-
-					/* Get response data and datalen */
-					data = http_response_get_data(response, &datalen);
-
-					written = 0;
-					while (written < datalen) {
-						ret = send(connection->socket_fd, data+written, datalen-written, 0);
-						if (ret == -1) {
-							/* FIXME: Error happened */
-							logger_log(httpd->logger, LOGGER_INFO, "Error in sending data");
-							break;
-						}
-						written += ret;
-					}
-
-					if (http_response_get_disconnect(response)) {
-						logger_log(httpd->logger, LOGGER_INFO, "Disconnecting on software request");
-						httpd_remove_connection(httpd, connection);
-					}
-				} else {
-					logger_log(httpd->logger, LOGGER_INFO, "Didn't get response");
-				}
-				http_response_destroy(response);
-			} else {
-				logger_log(httpd->logger, LOGGER_DEBUG, "Request not complete, waiting for more data...");
+		ret = 0;
+		for (i=0; i<nready && ret != -1; i++) {
+			if (ready[i] == &httpd->server_fd4) {
+				ret = httpd_accept_connection(httpd, httpd->server_fd4, 0);
+			} else if (ready[i] == &httpd->server_fd6) {
+				ret = httpd_accept_connection(httpd, httpd->server_fd6, 1);
 			}
 		}
+		if (ret == -1) {
+			break;
+		}
 	}
 
+#if defined(HTTPD_USE_WORKERS)
+	httpd_stop_workers(httpd);
+#endif
+
 	/* Remove all connections that are still connected */
 	for (i=0; i<httpd->max_connections; i++) {
 		http_connection_t *connection = &httpd->connections[i];
@@ -331,6 +1286,7 @@ httpd_thread(void *arg)
 	}
 
 	/* Close server sockets since they are not used any more */
+	httpd_set_accepting(httpd, 0);
 	if (httpd->server_fd4 != -1) {
 		closesocket(httpd->server_fd4);
 		httpd->server_fd4 = -1;
@@ -339,6 +1295,7 @@ httpd_thread(void *arg)
 		closesocket(httpd->server_fd6);
 		httpd->server_fd6 = -1;
 	}
+	httpd_poll_destroy(httpd);
 
 	logger_log(httpd->logger, LOGGER_INFO, "Exiting HTTP thread");
 
@@ -348,6 +1305,8 @@ httpd_thread(void *arg)
 int
 httpd_start(httpd_t *httpd, unsigned short *port)
 {
+	int i;
+
 	assert(httpd);
 	assert(port);
 
@@ -385,6 +1344,42 @@ httpd_start(httpd_t *httpd, unsigned short *port)
 	}
 	logger_log(httpd->logger, LOGGER_INFO, "Initialized server socket(s)");
 
+	if (!httpd_poll_fits(httpd, httpd->server_fd4) ||
+	    (httpd->server_fd6 != -1 && !httpd_poll_fits(httpd, httpd->server_fd6))) {
+		logger_log(httpd->logger, LOGGER_ERR, "Server sockets can not be polled");
+		closesocket(httpd->server_fd4);
+		closesocket(httpd->server_fd6);
+		MUTEX_UNLOCK(httpd->run_mutex);
+		return -2;
+	}
+	if (httpd_poll_init(httpd) == -1) {
+		logger_log(httpd->logger, LOGGER_ERR, "Error initialising socket polling %d", SOCKET_GET_ERROR());
+		closesocket(httpd->server_fd4);
+		closesocket(httpd->server_fd6);
+		MUTEX_UNLOCK(httpd->run_mutex);
+		return -2;
+	}
+
+	/* All connection slots are free and we accept new clients */
+	for (i=0; i<httpd->max_connections; i++) {
+		httpd->free_slots[i] = httpd->max_connections-i-1;
+	}
+	httpd->free_count = httpd->max_connections;
+	httpd->accepting = 0;
+	httpd_set_accepting(httpd, 1);
+
+#if defined(HTTPD_USE_WORKERS)
+	if (httpd_start_workers(httpd) == -1) {
+		logger_log(httpd->logger, LOGGER_ERR, "Error starting request workers");
+		httpd_set_accepting(httpd, 0);
+		httpd_poll_destroy(httpd);
+		closesocket(httpd->server_fd4);
+		closesocket(httpd->server_fd6);
+		MUTEX_UNLOCK(httpd->run_mutex);
+		return -2;
+	}
+#endif
+
 	/* Set values correctly and create new thread */
 	httpd->running = 1;
 	httpd->joined = 0;
@@ -29,10 +29,21 @@ struct httpd_callbacks_s {
 };
 typedef struct httpd_callbacks_s httpd_callbacks_t;
 
+struct httpd_stats_s {
+	unsigned long long bytes_sent;
+	unsigned long long bytes_queued;
+	unsigned long long blocked_ms;
+	int blocked_connections;
+	int max_queued;
+};
+typedef struct httpd_stats_s httpd_stats_t;
+
 
 httpd_t *httpd_init(logger_t *logger, httpd_callbacks_t *callbacks, int max_connections);
 
+int httpd_set_workers(httpd_t *httpd, int workers);
 int httpd_is_running(httpd_t *httpd);
+void httpd_get_stats(httpd_t *httpd, httpd_stats_t *stats);
 
 int httpd_start(httpd_t *httpd, unsigned short *port);
 void httpd_stop(httpd_t *httpd);
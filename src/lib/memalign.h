@@ -23,6 +23,13 @@
 	ret = si.dwPageSize;\
 } while(0)
 #define SYSTEM_GET_TIME(ret) ret = timeGetTime()
+#define SYSTEM_GET_TIME_US(ret) do {\
+	LARGE_INTEGER count, freq;\
+	QueryPerformanceCounter(&count);\
+	QueryPerformanceFrequency(&freq);\
+	ret = (unsigned long long)(count.QuadPart/freq.QuadPart*1000000 +\
+	                           count.QuadPart%freq.QuadPart*1000000/freq.QuadPart);\
+} while(0)
 
 #define ALIGNED_MALLOC(memptr, alignment, size) do {\
 	char *ptr = malloc(sizeof(void*) + (size) + (alignment)-1);\
@@ -44,6 +51,11 @@
 	gettimeofday(&tv, NULL);\
 	ret = (unsigned int)(tv.tv_sec*1000 + tv.tv_usec/1000);\
 } while(0)
+#define SYSTEM_GET_TIME_US(ret) do {\
+	struct timeval tv;\
+	gettimeofday(&tv, NULL);\
+	ret = (unsigned long long)tv.tv_sec*1000000 + tv.tv_usec;\
+} while(0)
 
 #define ALIGNED_MALLOC(memptr, alignment, size) if (posix_memalign((void **)&memptr, alignment, size)) memptr = NULL
 #define ALIGNED_FREE(memptr) free(memptr)
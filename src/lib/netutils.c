@@ -18,6 +18,10 @@
 
 #include "compat.h"
 
+#ifndef WIN32
+# include <fcntl.h>
+#endif
+
 int
 netutils_init()
 {
@@ -124,6 +128,24 @@ cleanup:
 	return -1;
 }
 
+int
+netutils_set_nonblocking(int fd)
+{
+#ifdef WIN32
+	u_long nonblocking = 1;
+
+	return ioctlsocket(fd, FIONBIO, &nonblocking) ? -1 : 0;
+#else
+	int flags;
+
+	flags = fcntl(fd, F_GETFL, 0);
+	if (flags == -1) {
+		return -1;
+	}
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+#endif
+}
+
 unsigned char *
 netutils_get_address(void *sockaddr, int *length)
 {
@@ -29,6 +29,7 @@
 #include "netutils.h"
 #include "logger.h"
 #include "compat.h"
+#include "http_parser.h"
 
 /* Actually 345 bytes for 2048-bit key */
 #define MAX_SIGNATURE_LEN 512
@@ -39,6 +40,17 @@
 /* MD5 as hex fits here */
 #define MAX_NONCE_LEN 32
 
+/* Username sent by iTunes and the realm we announce, the HA1 of the
+ * pair is calculated in raop_start */
+#define RAOP_DIGEST_USERNAME "iTunes"
+#define RAOP_DIGEST_REALM "AppleTV"
+
+/* Constant header lines sent without formatting them per request */
+static const char raop_header_jack_status[] = "Apple-Jack-Status: connected; type=analog\r\n";
+static const char raop_header_public[] = "Public: ANNOUNCE, SETUP, RECORD, PAUSE, FLUSH, TEARDOWN, OPTIONS, GET_PARAMETER, SET_PARAMETER\r\n";
+static const char raop_header_session[] = "Session: DEADBEEF\r\n";
+static const char raop_header_close[] = "Connection: close\r\n";
+
 struct raop_s {
 	/* Callbacks for audio */
 	raop_callbacks_t callbacks;
@@ -56,11 +68,21 @@ struct raop_s {
 
 	/* Password information */
 	char password[MAX_PASSWORD_LEN+1];
+	char password_ha1[DIGEST_HA1_LEN];
+
+	/* Request latencies by RAOP_METHOD_* */
+	mutex_handle_t stats_mutex;
+	raop_method_stats_t method_stats[RAOP_METHOD_COUNT];
+
+	/* Open connections for the memory statistics */
+	mutex_handle_t conns_mutex;
+	struct raop_conn_s *conns;
 };
 
 struct raop_conn_s {
 	raop_t *raop;
 	raop_rtp_t *raop_rtp;
+	struct raop_conn_s *next;
 
 	unsigned char *local;
 	int locallen;
@@ -72,6 +94,13 @@ struct raop_conn_s {
 };
 typedef struct raop_conn_s raop_conn_t;
 
+typedef void (*raop_handler_t)(raop_conn_t *conn, http_request_t *request, http_response_t *response);
+
+typedef struct {
+	int http_method;
+	raop_handler_t handler;
+} raop_handler_entry_t;
+
 static void *
 conn_init(void *opaque, unsigned char *local, int locallen, unsigned char *remote, int remotelen)
 {
@@ -117,9 +146,248 @@ conn_init(void *opaque, unsigned char *local, int locallen, unsigned char *remot
 	conn->remotelen = remotelen;
 
 	digest_generate_nonce(conn->nonce, sizeof(conn->nonce));
+
+	MUTEX_LOCK(conn->raop->conns_mutex);
+	conn->next = conn->raop->conns;
+	conn->raop->conns = conn;
+	MUTEX_UNLOCK(conn->raop->conns_mutex);
 	return conn;
 }
 
+/* The session is replaced under the lock, the statistics may read it */
+static void
+conn_set_rtp(raop_conn_t *conn, raop_rtp_t *raop_rtp)
+{
+	raop_rtp_t *old_rtp;
+
+	MUTEX_LOCK(conn->raop->conns_mutex);
+	old_rtp = conn->raop_rtp;
+	conn->raop_rtp = raop_rtp;
+	MUTEX_UNLOCK(conn->raop->conns_mutex);
+
+	/* Destroying stops the session first */
+	raop_rtp_destroy(old_rtp);
+}
+
+static void
+raop_handler_options(raop_conn_t *conn, http_request_t *request, http_response_t *response)
+{
+	http_response_add_static(response, raop_header_public, sizeof(raop_header_public)-1);
+}
+
+static void
+raop_handler_announce(raop_conn_t *conn, http_request_t *request, http_response_t *response)
+{
+	raop_t *raop = conn->raop;
+	const char *data;
+	int datalen;
+
+	unsigned char aeskey[16];
+	unsigned char aesiv[16];
+	int aeskeylen, aesivlen;
+
+	data = http_request_get_data(request, &datalen);
+	if (data) {
+		sdp_t *sdp;
+		const char *remotestr, *rtpmapstr, *fmtpstr, *aeskeystr, *aesivstr;
+
+		sdp = sdp_init(data, datalen);
+		remotestr = sdp_get_connection(sdp);
+		rtpmapstr = sdp_get_rtpmap(sdp);
+		fmtpstr = sdp_get_fmtp(sdp);
+		aeskeystr = sdp_get_rsaaeskey(sdp);
+		aesivstr = sdp_get_aesiv(sdp);
+
+		logger_log(conn->raop->logger, LOGGER_DEBUG, "connection: %s", remotestr);
+		logger_log(conn->raop->logger, LOGGER_DEBUG, "rtpmap: %s", rtpmapstr);
+		logger_log(conn->raop->logger, LOGGER_DEBUG, "fmtp: %s", fmtpstr);
+		logger_log(conn->raop->logger, LOGGER_DEBUG, "rsaaeskey: %s", aeskeystr);
+		logger_log(conn->raop->logger, LOGGER_DEBUG, "aesiv: %s", aesivstr);
+
+		aeskeylen = rsakey_decrypt(raop->rsakey, aeskey, sizeof(aeskey), aeskeystr);
+		aesivlen = rsakey_parseiv(raop->rsakey, aesiv, sizeof(aesiv), aesivstr);
+		logger_log(conn->raop->logger, LOGGER_DEBUG, "aeskeylen: %d", aeskeylen);
+		logger_log(conn->raop->logger, LOGGER_DEBUG, "aesivlen: %d", aesivlen);
+
+		if (conn->raop_rtp) {
+			/* This should never happen */
+			conn_set_rtp(conn, NULL);
+		}
+		conn_set_rtp(conn, raop_rtp_init(raop->logger, &raop->callbacks, remotestr, rtpmapstr, fmtpstr, aeskey, aesiv));
+		if (!conn->raop_rtp) {
+			logger_log(conn->raop->logger, LOGGER_ERR, "Error initializing the audio decoder");
+			http_response_set_disconnect(response, 1);
+		}
+		sdp_destroy(sdp);
+	}
+}
+
+static void
+raop_handler_setup(raop_conn_t *conn, http_request_t *request, http_response_t *response)
+{
+	unsigned short remote_cport=0, remote_tport=0;
+	unsigned short cport=0, tport=0, dport=0;
+	const char *transport;
+	char buffer[1024];
+	int use_udp;
+
+	transport = http_request_get_header_id(request, HTTP_HEADER_TRANSPORT);
+	assert(transport);
+
+	logger_log(conn->raop->logger, LOGGER_INFO, "Transport: %s", transport);
+	use_udp = strncmp(transport, "RTP/AVP/TCP", 11);
+	if (use_udp) {
+		char *original, *current, *tmpstr;
+
+		current = original = strdup(transport);
+		if (original) {
+			while ((tmpstr = utils_strsep(&current, ";")) != NULL) {
+				unsigned short value;
+				int ret;
+
+				ret = sscanf(tmpstr, "control_port=%hu", &value);
+				if (ret == 1) {
+					logger_log(conn->raop->logger, LOGGER_DEBUG, "Found remote control port: %hu", value);
+					remote_cport = value;
+				}
+				ret = sscanf(tmpstr, "timing_port=%hu", &value);
+				if (ret == 1) {
+					logger_log(conn->raop->logger, LOGGER_DEBUG, "Found remote timing port: %hu", value);
+					remote_tport = value;
+				}
+			}
+		}
+		free(original);
+	}
+	if (conn->raop_rtp) {
+		raop_rtp_start(conn->raop_rtp, use_udp, remote_cport, remote_tport, &cport, &tport, &dport);
+	} else {
+		logger_log(conn->raop->logger, LOGGER_ERR, "RAOP not initialized at SETUP, playing will fail!");
+		http_response_set_disconnect(response, 1);
+	}
+
+	memset(buffer, 0, sizeof(buffer));
+	if (use_udp) {
+		snprintf(buffer, sizeof(buffer)-1,
+		         "RTP/AVP/UDP;unicast;mode=record;timing_port=%hu;events;control_port=%hu;server_port=%hu",
+		         tport, cport, dport);
+	} else {
+		snprintf(buffer, sizeof(buffer)-1,
+		         "RTP/AVP/TCP;unicast;interleaved=0-1;mode=record;server_port=%u",
+		         dport);
+	}
+	logger_log(conn->raop->logger, LOGGER_INFO, "Responding with %s", buffer);
+	http_response_add_header(response, "Transport", buffer);
+	http_response_add_static(response, raop_header_session, sizeof(raop_header_session)-1);
+}
+
+static void
+raop_handler_set_parameter(raop_conn_t *conn, http_request_t *request, http_response_t *response)
+{
+	const char *content_type;
+	const char *data;
+	int datalen;
+
+	content_type = http_request_get_header_id(request, HTTP_HEADER_CONTENT_TYPE);
+	data = http_request_get_data(request, &datalen);
+	if (!content_type) {
+		logger_log(conn->raop->logger, LOGGER_WARNING, "SET_PARAMETER without Content-Type");
+	} else if (!strcmp(content_type, "text/parameters")) {
+		char *datastr;
+		datastr = calloc(1, datalen+1);
+		if (data && datastr && conn->raop_rtp) {
+			memcpy(datastr, data, datalen);
+			if (!strncmp(datastr, "volume: ", 8)) {
+				float vol = 0.0;
+				sscanf(datastr+8, "%f", &vol);
+				raop_rtp_set_volume(conn->raop_rtp, vol);
+			}
+		} else if (!conn->raop_rtp) {
+			logger_log(conn->raop->logger, LOGGER_WARNING, "RAOP not initialized at SET_PARAMETER volume");
+		}
+		free(datastr);
+	} else if (!strcmp(content_type, "image/jpeg")) {
+		logger_log(conn->raop->logger, LOGGER_INFO, "Got image data of %d bytes", datalen);
+		if (conn->raop_rtp) {
+			/* Hand the body over without copying it */
+			raop_rtp_set_coverart(conn->raop_rtp, (unsigned char *)http_request_take_data(request, &datalen), datalen);
+		} else {
+			logger_log(conn->raop->logger, LOGGER_WARNING, "RAOP not initialized at SET_PARAMETER coverart");
+		}
+	} else if (!strcmp(content_type, "application/x-dmap-tagged")) {
+		logger_log(conn->raop->logger, LOGGER_INFO, "Got metadata of %d bytes", datalen);
+		if (conn->raop_rtp) {
+			raop_rtp_set_metadata(conn->raop_rtp, (unsigned char *)http_request_take_data(request, &datalen), datalen);
+		} else {
+			logger_log(conn->raop->logger, LOGGER_WARNING, "RAOP not initialized at SET_PARAMETER metadata");
+		}
+	}
+}
+
+static void
+raop_handler_flush(raop_conn_t *conn, http_request_t *request, http_response_t *response)
+{
+	const char *rtpinfo;
+	int next_seq = -1;
+
+	rtpinfo = http_request_get_header_id(request, HTTP_HEADER_RTP_INFO);
+	if (rtpinfo) {
+		logger_log(conn->raop->logger, LOGGER_INFO, "Flush with RTP-Info: %s", rtpinfo);
+		if (!strncmp(rtpinfo, "seq=", 4)) {
+			next_seq = strtol(rtpinfo+4, NULL, 10);
+		}
+	}
+	if (conn->raop_rtp) {
+		raop_rtp_flush(conn->raop_rtp, next_seq);
+	} else {
+		logger_log(conn->raop->logger, LOGGER_WARNING, "RAOP not initialized at FLUSH");
+	}
+}
+
+static void
+raop_handler_teardown(raop_conn_t *conn, http_request_t *request, http_response_t *response)
+{
+	http_response_add_static(response, raop_header_close, sizeof(raop_header_close)-1);
+	if (conn->raop_rtp) {
+		/* Destroy our RTP session */
+		conn_set_rtp(conn, NULL);
+	}
+}
+
+/* Indexed by the RAOP_METHOD_* values of the public header */
+static const raop_handler_entry_t raop_handlers[RAOP_METHOD_COUNT] = {
+	{ HTTP_OPTIONS,       &raop_handler_options },
+	{ HTTP_ANNOUNCE,      &raop_handler_announce },
+	{ HTTP_SETUP,         &raop_handler_setup },
+	{ HTTP_RECORD,        NULL },
+	{ HTTP_PAUSE,         NULL },
+	{ HTTP_FLUSH,         &raop_handler_flush },
+	{ HTTP_TEARDOWN,      &raop_handler_teardown },
+	{ HTTP_GET_PARAMETER, NULL },
+	{ HTTP_SET_PARAMETER, &raop_handler_set_parameter }
+};
+
+static void
+raop_record_latency(raop_t *raop, int method, unsigned long long latency)
+{
+	raop_method_stats_t *stats = &raop->method_stats[method];
+	int bucket = 0;
+
+	/* Bucket i counts latencies below 2^i microseconds */
+	while (bucket < RAOP_LATENCY_BUCKETS-1 && (latency >> bucket) > 0) {
+		bucket++;
+	}
+
+	MUTEX_LOCK(raop->stats_mutex);
+	stats->count++;
+	stats->total_us += latency;
+	if (stats->max_us < latency) {
+		stats->max_us = latency;
+	}
+	stats->buckets[bucket]++;
+	MUTEX_UNLOCK(raop->stats_mutex);
+}
+
 static void
 conn_request(void *ptr, http_request_t *request, http_response_t **response)
 {
@@ -130,34 +398,49 @@ conn_request(void *ptr, http_request_t *request, http_response_t **response)
 	const char *method;
 	const char *cseq;
 	const char *challenge;
+	unsigned long long start, end;
 	int require_auth = 0;
+	int http_method, method_id, i;
+
+	SYSTEM_GET_TIME_US(start);
 
 	method = http_request_get_method(request);
-	cseq = http_request_get_header(request, "CSeq");
+	cseq = http_request_get_header_id(request, HTTP_HEADER_CSEQ);
 	if (!method || !cseq) {
 		return;
 	}
 
+	/* Find the handler by the parsed method */
+	http_method = http_request_get_method_id(request);
+	method_id = -1;
+	for (i=0; i<RAOP_METHOD_COUNT; i++) {
+		if (raop_handlers[i].http_method == http_method) {
+			method_id = i;
+			break;
+		}
+	}
+
 	res = http_response_init("RTSP/1.0", 200, "OK");
 	if (strlen(raop->password)) {
 		const char *authorization;
 
-		authorization = http_request_get_header(request, "Authorization");
+		authorization = http_request_get_header_id(request, HTTP_HEADER_AUTHORIZATION);
 		if (authorization) {
 			logger_log(conn->raop->logger, LOGGER_DEBUG, "Our nonce: %s", conn->nonce);
 			logger_log(conn->raop->logger, LOGGER_DEBUG, "Authorization: %s", authorization);
 		}
-		if (!digest_is_valid("AppleTV", raop->password, conn->nonce, method, http_request_get_url(request), authorization)) {
+		if (!digest_is_valid(RAOP_DIGEST_REALM, raop->password, RAOP_DIGEST_USERNAME, raop->password_ha1,
+		                     conn->nonce, method, http_request_get_url(request), authorization)) {
 			char *authstr;
 			int authstrlen;
 
 			/* Allocate the authenticate string */
-			authstrlen = sizeof("Digest realm=\"AppleTV\", nonce=\"\"") + sizeof(conn->nonce) + 1;
+			authstrlen = sizeof("Digest realm=\"" RAOP_DIGEST_REALM "\", nonce=\"\"") + sizeof(conn->nonce) + 1;
 			authstr = malloc(authstrlen);
 
 			/* Concatenate the authenticate string */
 			memset(authstr, 0, authstrlen);
-			strcat(authstr, "Digest realm=\"AppleTV\", nonce=\"");
+			strcat(authstr, "Digest realm=\"" RAOP_DIGEST_REALM "\", nonce=\"");
 			strcat(authstr, conn->nonce);
 			strcat(authstr, "\"");
 
@@ -174,9 +457,9 @@ conn_request(void *ptr, http_request_t *request, http_response_t **response)
 	}
 
 	http_response_add_header(res, "CSeq", cseq);
-	http_response_add_header(res, "Apple-Jack-Status", "connected; type=analog");
+	http_response_add_static(res, raop_header_jack_status, sizeof(raop_header_jack_status)-1);
 
-	challenge = http_request_get_header(request, "Apple-Challenge");
+	challenge = http_request_get_header_id(request, HTTP_HEADER_APPLE_CHALLENGE);
 	if (!require_auth && challenge) {
 		char signature[MAX_SIGNATURE_LEN];
 
@@ -189,179 +472,35 @@ conn_request(void *ptr, http_request_t *request, http_response_t **response)
 		logger_log(conn->raop->logger, LOGGER_DEBUG, "Got response: %s", signature);
 	}
 
-	if (require_auth) {
-		/* Do nothing in case of authentication request */
-	} else if (!strcmp(method, "OPTIONS")) {
-		http_response_add_header(res, "Public", "ANNOUNCE, SETUP, RECORD, PAUSE, FLUSH, TEARDOWN, OPTIONS, GET_PARAMETER, SET_PARAMETER");
-	} else if (!strcmp(method, "ANNOUNCE")) {
-		const char *data;
-		int datalen;
-
-		unsigned char aeskey[16];
-		unsigned char aesiv[16];
-		int aeskeylen, aesivlen;
-
-		data = http_request_get_data(request, &datalen);
-		if (data) {
-			sdp_t *sdp;
-			const char *remotestr, *rtpmapstr, *fmtpstr, *aeskeystr, *aesivstr;
-
-			sdp = sdp_init(data, datalen);
-			remotestr = sdp_get_connection(sdp);
-			rtpmapstr = sdp_get_rtpmap(sdp);
-			fmtpstr = sdp_get_fmtp(sdp);
-			aeskeystr = sdp_get_rsaaeskey(sdp);
-			aesivstr = sdp_get_aesiv(sdp);
-
-			logger_log(conn->raop->logger, LOGGER_DEBUG, "connection: %s", remotestr);
-			logger_log(conn->raop->logger, LOGGER_DEBUG, "rtpmap: %s", rtpmapstr);
-			logger_log(conn->raop->logger, LOGGER_DEBUG, "fmtp: %s", fmtpstr);
-			logger_log(conn->raop->logger, LOGGER_DEBUG, "rsaaeskey: %s", aeskeystr);
-			logger_log(conn->raop->logger, LOGGER_DEBUG, "aesiv: %s", aesivstr);
-
-			aeskeylen = rsakey_decrypt(raop->rsakey, aeskey, sizeof(aeskey), aeskeystr);
-			aesivlen = rsakey_parseiv(raop->rsakey, aesiv, sizeof(aesiv), aesivstr);
-			logger_log(conn->raop->logger, LOGGER_DEBUG, "aeskeylen: %d", aeskeylen);
-			logger_log(conn->raop->logger, LOGGER_DEBUG, "aesivlen: %d", aesivlen);
-
-			if (conn->raop_rtp) {
-				/* This should never happen */
-				raop_rtp_destroy(conn->raop_rtp);
-				conn->raop_rtp = NULL;
-			}
-			conn->raop_rtp = raop_rtp_init(raop->logger, &raop->callbacks, remotestr, rtpmapstr, fmtpstr, aeskey, aesiv);
-			if (!conn->raop_rtp) {
-				logger_log(conn->raop->logger, LOGGER_ERR, "Error initializing the audio decoder");
-				http_response_set_disconnect(res, 1);
-			}
-			sdp_destroy(sdp);
-		}
-	} else if (!strcmp(method, "SETUP")) {
-		unsigned short remote_cport=0, remote_tport=0;
-		unsigned short cport=0, tport=0, dport=0;
-		const char *transport;
-		char buffer[1024];
-		int use_udp;
-
-		transport = http_request_get_header(request, "Transport");
-		assert(transport);
-
-		logger_log(conn->raop->logger, LOGGER_INFO, "Transport: %s", transport);
-		use_udp = strncmp(transport, "RTP/AVP/TCP", 11);
-		if (use_udp) {
-			char *original, *current, *tmpstr;
-
-			current = original = strdup(transport);
-			if (original) {
-				while ((tmpstr = utils_strsep(&current, ";")) != NULL) {
-					unsigned short value;
-					int ret;
-
-					ret = sscanf(tmpstr, "control_port=%hu", &value);
-					if (ret == 1) {
-						logger_log(conn->raop->logger, LOGGER_DEBUG, "Found remote control port: %hu", value);
-						remote_cport = value;
-					}
-					ret = sscanf(tmpstr, "timing_port=%hu", &value);
-					if (ret == 1) {
-						logger_log(conn->raop->logger, LOGGER_DEBUG, "Found remote timing port: %hu", value);
-						remote_tport = value;
-					}
-				}
-			}
-			free(original);
-		}
-		if (conn->raop_rtp) {
-			raop_rtp_start(conn->raop_rtp, use_udp, remote_cport, remote_tport, &cport, &tport, &dport);
-		} else {
-			logger_log(conn->raop->logger, LOGGER_ERR, "RAOP not initialized at SETUP, playing will fail!");
-			http_response_set_disconnect(res, 1);
-		}
-
-		memset(buffer, 0, sizeof(buffer));
-		if (use_udp) {
-			snprintf(buffer, sizeof(buffer)-1,
-			         "RTP/AVP/UDP;unicast;mode=record;timing_port=%hu;events;control_port=%hu;server_port=%hu",
-			         tport, cport, dport);
-		} else {
-			snprintf(buffer, sizeof(buffer)-1,
-			         "RTP/AVP/TCP;unicast;interleaved=0-1;mode=record;server_port=%u",
-			         dport);
-		}
-		logger_log(conn->raop->logger, LOGGER_INFO, "Responding with %s", buffer);
-		http_response_add_header(res, "Transport", buffer);
-		http_response_add_header(res, "Session", "DEADBEEF");
-	} else if (!strcmp(method, "SET_PARAMETER")) {
-		const char *content_type;
-		const char *data;
-		int datalen;
-
-		content_type = http_request_get_header(request, "Content-Type");
-		data = http_request_get_data(request, &datalen);
-		if (!strcmp(content_type, "text/parameters")) {
-			char *datastr;
-			datastr = calloc(1, datalen+1);
-			if (data && datastr && conn->raop_rtp) {
-				memcpy(datastr, data, datalen);
-				if (!strncmp(datastr, "volume: ", 8)) {
-					float vol = 0.0;
-					sscanf(datastr+8, "%f", &vol);
-					raop_rtp_set_volume(conn->raop_rtp, vol);
-				}
-			} else if (!conn->raop_rtp) {
-				logger_log(conn->raop->logger, LOGGER_WARNING, "RAOP not initialized at SET_PARAMETER volume");
-			}
-			free(datastr);
-		} else if (!strcmp(content_type, "image/jpeg")) {
-			logger_log(conn->raop->logger, LOGGER_INFO, "Got image data of %d bytes", datalen);
-			if (conn->raop_rtp) {
-				raop_rtp_set_coverart(conn->raop_rtp, data, datalen);
-			} else {
-				logger_log(conn->raop->logger, LOGGER_WARNING, "RAOP not initialized at SET_PARAMETER coverart");
-			}
-		} else if (!strcmp(content_type, "application/x-dmap-tagged")) {
-			logger_log(conn->raop->logger, LOGGER_INFO, "Got metadata of %d bytes", datalen);
-			if (conn->raop_rtp) {
-				raop_rtp_set_metadata(conn->raop_rtp, data, datalen);
-			} else {
-				logger_log(conn->raop->logger, LOGGER_WARNING, "RAOP not initialized at SET_PARAMETER metadata");
-			}
-		}
-	} else if (!strcmp(method, "FLUSH")) {
-		const char *rtpinfo;
-		int next_seq = -1;
-
-		rtpinfo = http_request_get_header(request, "RTP-Info");
-		if (rtpinfo) {
-			logger_log(conn->raop->logger, LOGGER_INFO, "Flush with RTP-Info: %s", rtpinfo);
-			if (!strncmp(rtpinfo, "seq=", 4)) {
-				next_seq = strtol(rtpinfo+4, NULL, 10);
-			}
-		}
-		if (conn->raop_rtp) {
-			raop_rtp_flush(conn->raop_rtp, next_seq);
-		} else {
-			logger_log(conn->raop->logger, LOGGER_WARNING, "RAOP not initialized at FLUSH");
-		}
-	} else if (!strcmp(method, "TEARDOWN")) {
-		http_response_add_header(res, "Connection", "close");
-		if (conn->raop_rtp) {
-			/* Destroy our RTP session */
-			raop_rtp_stop(conn->raop_rtp);
-			raop_rtp_destroy(conn->raop_rtp);
-			conn->raop_rtp = NULL;
-		}
+	/* Do nothing in case of authentication request */
+	if (!require_auth && method_id != -1 && raop_handlers[method_id].handler) {
+		raop_handlers[method_id].handler(conn, request, res);
 	}
 	http_response_finish(res, NULL, 0);
 
 	logger_log(conn->raop->logger, LOGGER_DEBUG, "Handled request %s with URL %s", method, http_request_get_url(request));
 	*response = res;
+
+	if (method_id != -1) {
+		SYSTEM_GET_TIME_US(end);
+		raop_record_latency(raop, method_id, end-start);
+	}
 }
 
 static void
 conn_destroy(void *ptr)
 {
 	raop_conn_t *conn = ptr;
+	raop_conn_t **prev;
+
+	MUTEX_LOCK(conn->raop->conns_mutex);
+	for (prev=&conn->raop->conns; *prev; prev=&(*prev)->next) {
+		if (*prev == conn) {
+			*prev = conn->next;
+			break;
+		}
+	}
+	MUTEX_UNLOCK(conn->raop->conns_mutex);
 
 	if (conn->raop_rtp) {
 		/* This is done in case TEARDOWN was not called */
@@ -382,7 +521,6 @@ raop_init(int max_clients, raop_callbacks_t *callbacks, const char *pemkey, int
 
 	assert(callbacks);
 	assert(max_clients > 0);
-	assert(max_clients < 100);
 	assert(pemkey);
 
 	/* Initialize the network */
@@ -433,6 +571,8 @@ raop_init(int max_clients, raop_callbacks_t *callbacks, const char *pemkey, int
 
 	raop->httpd = httpd;
 	raop->rsakey = rsakey;
+	MUTEX_CREATE(raop->stats_mutex);
+	MUTEX_CREATE(raop->conns_mutex);
 
 	return raop;
 }
@@ -460,6 +600,8 @@ raop_destroy(raop_t *raop)
 		httpd_destroy(raop->httpd);
 		rsakey_destroy(raop->rsakey);
 		logger_destroy(raop->logger);
+		MUTEX_DESTROY(raop->stats_mutex);
+		MUTEX_DESTROY(raop->conns_mutex);
 		free(raop);
 
 		/* Cleanup the network */
@@ -475,6 +617,70 @@ raop_is_running(raop_t *raop)
 	return httpd_is_running(raop->httpd);
 }
 
+void
+raop_get_send_stats(raop_t *raop, raop_send_stats_t *stats)
+{
+	httpd_stats_t httpd_stats;
+
+	assert(raop);
+	assert(stats);
+
+	httpd_get_stats(raop->httpd, &httpd_stats);
+	stats->bytes_sent = httpd_stats.bytes_sent;
+	stats->bytes_queued = httpd_stats.bytes_queued;
+	stats->blocked_ms = httpd_stats.blocked_ms;
+	stats->blocked_connections = httpd_stats.blocked_connections;
+	stats->max_queued = httpd_stats.max_queued;
+}
+
+void
+raop_get_key_cache_stats(raop_t *raop, raop_key_cache_stats_t *stats)
+{
+	assert(raop);
+	assert(stats);
+
+	rsakey_get_cache_stats(raop->rsakey, &stats->hits, &stats->misses);
+}
+
+int
+raop_get_method_stats(raop_t *raop, int method, raop_method_stats_t *stats)
+{
+	assert(raop);
+	assert(stats);
+
+	if (method < 0 || method >= RAOP_METHOD_COUNT) {
+		return -1;
+	}
+	MUTEX_LOCK(raop->stats_mutex);
+	memcpy(stats, &raop->method_stats[method], sizeof(raop_method_stats_t));
+	MUTEX_UNLOCK(raop->stats_mutex);
+	return 0;
+}
+
+void
+raop_get_memory_stats(raop_t *raop, raop_memory_stats_t *stats)
+{
+	raop_conn_t *conn;
+
+	assert(raop);
+	assert(stats);
+
+	memset(stats, 0, sizeof(raop_memory_stats_t));
+	MUTEX_LOCK(raop->conns_mutex);
+	for (conn=raop->conns; conn; conn=conn->next) {
+		int bytes, private_bytes;
+
+		if (!conn->raop_rtp) {
+			continue;
+		}
+		raop_rtp_get_memory(conn->raop_rtp, &bytes, &private_bytes);
+		stats->sessions++;
+		stats->bytes += bytes;
+		stats->private_bytes += private_bytes;
+	}
+	MUTEX_UNLOCK(raop->conns_mutex);
+}
+
 void
 raop_set_log_level(raop_t *raop, int level)
 {
@@ -491,6 +697,14 @@ raop_set_log_callback(raop_t *raop, raop_log_callback_t callback, void *cls)
 	logger_set_callback(raop->logger, callback, cls);
 }
 
+int
+raop_set_request_workers(raop_t *raop, int workers)
+{
+	assert(raop);
+
+	return httpd_set_workers(raop->httpd, workers);
+}
+
 int
 raop_start(raop_t *raop, unsigned short *port, const char *hwaddr, int hwaddrlen, const char *password)
 {
@@ -512,6 +726,7 @@ raop_start(raop_t *raop, unsigned short *port, const char *hwaddr, int hwaddrlen
 
 		/* Copy password to the raop structure */
 		strncpy(raop->password, password, MAX_PASSWORD_LEN);
+		digest_get_ha1(RAOP_DIGEST_USERNAME, RAOP_DIGEST_REALM, raop->password, raop->password_ha1);
 	}
 
 	/* Copy hwaddr to the raop structure */
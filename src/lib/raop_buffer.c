@@ -20,6 +20,7 @@
 #include "raop_buffer.h"
 #include "raop_rtp.h"
 #include "utils.h"
+#include "threads.h"
 
 #include <stdint.h>
 #include "crypto/crypto.h"
@@ -27,6 +28,9 @@
 
 #define RAOP_BUFFER_LENGTH 16
 
+/* An ALAC frame is at most its samples and 58 bits of header and end tag */
+#define RAOP_BUFFER_ALAC_OVERHEAD 8
+
 typedef struct {
 	/* Packet available */
 	int available;
@@ -45,13 +49,15 @@ typedef struct {
 } raop_buffer_entry_t;
 
 struct raop_buffer_s {
-	/* AES key and IV */
-	unsigned char aeskey[RAOP_AESKEY_LEN];
+	/* AES decryption key schedule, computed once, and IV */
+	AES_CTX aes_ctx;
 	unsigned char aesiv[RAOP_AESIV_LEN];
 
-	/* ALAC decoder */
+	/* ALAC decoder, not used when frames are passed through */
 	ALACSpecificConfig alacConfig;
 	alac_file *alac;
+	alac_decode_frame_t decode_frame;
+	int passthrough;
 
 	/* First and last seqnum */
 	int is_empty;
@@ -61,7 +67,8 @@ struct raop_buffer_s {
 	/* RTP buffer entries */
 	raop_buffer_entry_t entries[RAOP_BUFFER_LENGTH];
 
-	/* Buffer of all audio buffers */
+	/* Buffer of all audio buffers, only allocated while streaming */
+	mutex_handle_t buffer_mutex;
 	int buffer_size;
 	void *buffer;
 };
@@ -145,6 +152,48 @@ set_decoder_info(alac_file *alac, ALACSpecificConfig *config)
 	alac_set_info(alac, (char *) decoder_info);
 }
 
+static void
+raop_buffer_set_sizes(raop_buffer_t *raop_buffer)
+{
+	ALACSpecificConfig *alacConfig = &raop_buffer->alacConfig;
+	int audio_buffer_size;
+	int i;
+
+	audio_buffer_size = alacConfig->frameLength *
+	                    alacConfig->numChannels *
+	                    alacConfig->bitDepth/8;
+	if (raop_buffer->passthrough) {
+		audio_buffer_size += RAOP_BUFFER_ALAC_OVERHEAD;
+	}
+	raop_buffer->buffer_size = audio_buffer_size *
+	                           RAOP_BUFFER_LENGTH;
+	for (i=0; i<RAOP_BUFFER_LENGTH; i++) {
+		raop_buffer_entry_t *entry = &raop_buffer->entries[i];
+		entry->audio_buffer_size = audio_buffer_size;
+		entry->audio_buffer_len = 0;
+	}
+}
+
+/* An uncompressed frame of zeros stands in for a packet that never came */
+static int
+raop_buffer_silent_frame(raop_buffer_t *raop_buffer, unsigned char *buffer)
+{
+	ALACSpecificConfig *alacConfig = &raop_buffer->alacConfig;
+	int samplebytes;
+
+	samplebytes = alacConfig->frameLength *
+	              alacConfig->numChannels *
+	              alacConfig->bitDepth/8;
+
+	/* 23 bits of header with only the escape bit set, then the end tag */
+	memset(buffer, 0, samplebytes+4);
+	buffer[0] = (alacConfig->numChannels-1) << 5;
+	buffer[2] = 0x02;
+	buffer[samplebytes+2] = 0x01;
+	buffer[samplebytes+3] = 0xc0;
+	return samplebytes+4;
+}
+
 raop_buffer_t *
 raop_buffer_init(const char *rtpmap,
                  const char *fmtp,
@@ -152,9 +201,7 @@ raop_buffer_init(const char *rtpmap,
                  const unsigned char *aesiv)
 {
 	raop_buffer_t *raop_buffer;
-	int audio_buffer_size;
 	ALACSpecificConfig *alacConfig;
-	int i;
 
         assert(rtpmap);
 	assert(fmtp);
@@ -173,40 +220,35 @@ raop_buffer_init(const char *rtpmap,
 		return NULL;
 	}
 
-	/* Allocate the output audio buffers */
-	audio_buffer_size = alacConfig->frameLength *
-	                    alacConfig->numChannels *
-	                    alacConfig->bitDepth/8;
-	raop_buffer->buffer_size = audio_buffer_size *
-	                           RAOP_BUFFER_LENGTH;
-	raop_buffer->buffer = malloc(raop_buffer->buffer_size);
-	if (!raop_buffer->buffer) {
-		free(raop_buffer);
-		return NULL;
-	}
-	for (i=0; i<RAOP_BUFFER_LENGTH; i++) {
-		raop_buffer_entry_t *entry = &raop_buffer->entries[i];
-		entry->audio_buffer_size = audio_buffer_size;
-		entry->audio_buffer_len = 0;
-		entry->audio_buffer = (char *)raop_buffer->buffer+i*audio_buffer_size;
-	}
+	/* The output audio buffers are allocated with the first packet */
+	raop_buffer_set_sizes(raop_buffer);
 
 	/* Initialize ALAC decoder */
 	raop_buffer->alac = create_alac(alacConfig->bitDepth,
 	                                alacConfig->numChannels);
 	if (!raop_buffer->alac) {
-		free(raop_buffer->buffer);
 		free(raop_buffer);
 		return NULL;
 	}
 	set_decoder_info(raop_buffer->alac, alacConfig);
 
+	/* Practically every sender uses this profile, it has its own decoder */
+	if (alacConfig->frameLength == 352 && alacConfig->bitDepth == 16 &&
+	    alacConfig->numChannels == 2 && alacConfig->pb == 40 &&
+	    alacConfig->mb == 10 && alacConfig->kb == 14) {
+		raop_buffer->decode_frame = decode_frame_stereo16_352;
+	} else {
+		raop_buffer->decode_frame = decode_frame;
+	}
+
 	/* Initialize AES keys */
-	memcpy(raop_buffer->aeskey, aeskey, RAOP_AESKEY_LEN);
+	AES_set_key(&raop_buffer->aes_ctx, aeskey, aesiv, AES_MODE_128);
+	AES_convert_key(&raop_buffer->aes_ctx);
 	memcpy(raop_buffer->aesiv, aesiv, RAOP_AESIV_LEN);
 
 	/* Mark buffer as empty */
 	raop_buffer->is_empty = 1;
+	MUTEX_CREATE(raop_buffer->buffer_mutex);
 	return raop_buffer;
 }
 
@@ -215,11 +257,48 @@ raop_buffer_destroy(raop_buffer_t *raop_buffer)
 {
 	if (raop_buffer) {
 		destroy_alac(raop_buffer->alac);
+		MUTEX_DESTROY(raop_buffer->buffer_mutex);
 		free(raop_buffer->buffer);
 		free(raop_buffer);
 	}
 }
 
+static int
+raop_buffer_alloc_audio(raop_buffer_t *raop_buffer)
+{
+	void *buffer;
+	int i;
+
+	buffer = malloc(raop_buffer->buffer_size);
+	if (!buffer) {
+		return -1;
+	}
+	MUTEX_LOCK(raop_buffer->buffer_mutex);
+	raop_buffer->buffer = buffer;
+	MUTEX_UNLOCK(raop_buffer->buffer_mutex);
+	for (i=0; i<RAOP_BUFFER_LENGTH; i++) {
+		raop_buffer_entry_t *entry = &raop_buffer->entries[i];
+		entry->audio_buffer = (char *)buffer+i*entry->audio_buffer_size;
+	}
+	return 0;
+}
+
+static void
+raop_buffer_free_audio(raop_buffer_t *raop_buffer)
+{
+	void *buffer;
+	int i;
+
+	for (i=0; i<RAOP_BUFFER_LENGTH; i++) {
+		raop_buffer->entries[i].audio_buffer = NULL;
+	}
+	MUTEX_LOCK(raop_buffer->buffer_mutex);
+	buffer = raop_buffer->buffer;
+	raop_buffer->buffer = NULL;
+	MUTEX_UNLOCK(raop_buffer->buffer_mutex);
+	free(buffer);
+}
+
 const ALACSpecificConfig *
 raop_buffer_get_config(raop_buffer_t *raop_buffer)
 {
@@ -234,6 +313,23 @@ seqnum_cmp(unsigned short s1, unsigned short s2)
 	return (s1 - s2);
 }
 
+static void
+raop_buffer_reset(raop_buffer_t *raop_buffer, int next_seq)
+{
+	int i;
+
+	for (i=0; i<RAOP_BUFFER_LENGTH; i++) {
+		raop_buffer->entries[i].available = 0;
+		raop_buffer->entries[i].audio_buffer_len = 0;
+	}
+	if (next_seq < 0 || next_seq > 0xffff) {
+		raop_buffer->is_empty = 1;
+	} else {
+		raop_buffer->first_seqnum = next_seq;
+		raop_buffer->last_seqnum = next_seq-1;
+	}
+}
+
 int
 raop_buffer_queue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned short datalen, int use_seqnum)
 {
@@ -241,7 +337,6 @@ raop_buffer_queue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned shor
 	unsigned short seqnum;
 	raop_buffer_entry_t *entry;
 	int encryptedlen;
-	AES_CTX aes_ctx;
 	int outputlen;
 
 	assert(raop_buffer);
@@ -250,6 +345,9 @@ raop_buffer_queue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned shor
 	if (datalen < 12 || datalen > RAOP_PACKET_LEN) {
 		return -1;
 	}
+	if (!raop_buffer->buffer && raop_buffer_alloc_audio(raop_buffer) < 0) {
+		return -1;
+	}
 
 	/* Get correct seqnum for the packet */
 	if (use_seqnum) {
@@ -265,7 +363,7 @@ raop_buffer_queue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned shor
 
 	/* Check that there is always space in the buffer, otherwise flush */
 	if (seqnum_cmp(seqnum, raop_buffer->first_seqnum+RAOP_BUFFER_LENGTH) >= 0) {
-		raop_buffer_flush(raop_buffer, seqnum);
+		raop_buffer_reset(raop_buffer, seqnum);
 	}
 
 	/* Get entry corresponding our seqnum */
@@ -287,14 +385,23 @@ raop_buffer_queue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned shor
 
 	/* Decrypt audio data */
 	encryptedlen = (datalen-12)/16*16;
-	AES_set_key(&aes_ctx, raop_buffer->aeskey, raop_buffer->aesiv, AES_MODE_128);
-	AES_convert_key(&aes_ctx);
-	AES_cbc_decrypt(&aes_ctx, &data[12], packetbuf, encryptedlen);
+	/* Every packet starts from the session IV, CBC decrypt updates it */
+	memcpy(raop_buffer->aes_ctx.iv, raop_buffer->aesiv, RAOP_AESIV_LEN);
+	AES_cbc_decrypt(&raop_buffer->aes_ctx, &data[12], packetbuf, encryptedlen);
 	memcpy(packetbuf+encryptedlen, &data[12+encryptedlen], datalen-12-encryptedlen);
 
-	/* Decode ALAC audio data */
-	outputlen = entry->audio_buffer_size;
-	decode_frame(raop_buffer->alac, packetbuf, entry->audio_buffer, &outputlen);
+	/* Decode ALAC audio data, or keep the frame as it is */
+	if (raop_buffer->passthrough) {
+		/* Only padding can be past the longest possible frame */
+		outputlen = datalen-12;
+		if (outputlen > entry->audio_buffer_size) {
+			outputlen = entry->audio_buffer_size;
+		}
+		memcpy(entry->audio_buffer, packetbuf, outputlen);
+	} else {
+		outputlen = entry->audio_buffer_size;
+		raop_buffer->decode_frame(raop_buffer->alac, packetbuf, datalen-12, entry->audio_buffer, &outputlen);
+	}
 	entry->audio_buffer_len = outputlen;
 
 	/* Update the raop_buffer seqnums */
@@ -319,7 +426,7 @@ raop_buffer_dequeue(raop_buffer_t *raop_buffer, int *length, int no_resend)
 	buflen = seqnum_cmp(raop_buffer->last_seqnum, raop_buffer->first_seqnum)+1;
 
 	/* Cannot dequeue from empty buffer */
-	if (raop_buffer->is_empty || buflen <= 0) {
+	if (raop_buffer->is_empty || buflen <= 0 || !raop_buffer->buffer) {
 		return NULL;
 	}
 
@@ -340,8 +447,12 @@ raop_buffer_dequeue(raop_buffer_t *raop_buffer, int *length, int no_resend)
 	raop_buffer->first_seqnum += 1;
 	if (!entry->available) {
 		/* Return an empty audio buffer to skip audio */
-		*length = entry->audio_buffer_size;
-		memset(entry->audio_buffer, 0, *length);
+		if (raop_buffer->passthrough) {
+			*length = raop_buffer_silent_frame(raop_buffer, entry->audio_buffer);
+		} else {
+			*length = entry->audio_buffer_size;
+			memset(entry->audio_buffer, 0, *length);
+		}
 		return entry->audio_buffer;
 	}
 	entry->available = 0;
@@ -380,18 +491,49 @@ raop_buffer_handle_resends(raop_buffer_t *raop_buffer, raop_resend_cb_t resend_c
 void
 raop_buffer_flush(raop_buffer_t *raop_buffer, int next_seq)
 {
-	int i;
+	assert(raop_buffer);
+
+	/* The audio buffers are kept, playback usually continues soon */
+	raop_buffer_reset(raop_buffer, next_seq);
+}
 
+void
+raop_buffer_release(raop_buffer_t *raop_buffer)
+{
 	assert(raop_buffer);
 
-	for (i=0; i<RAOP_BUFFER_LENGTH; i++) {
-		raop_buffer->entries[i].available = 0;
-		raop_buffer->entries[i].audio_buffer_len = 0;
-	}
-	if (next_seq < 0 || next_seq > 0xffff) {
-		raop_buffer->is_empty = 1;
-	} else {
-		raop_buffer->first_seqnum = next_seq;
-		raop_buffer->last_seqnum = next_seq-1;
-	}
+	/* Stopped and idle sessions keep no audio buffers */
+	raop_buffer_reset(raop_buffer, -1);
+	raop_buffer_free_audio(raop_buffer);
+}
+
+void
+raop_buffer_get_memory(raop_buffer_t *raop_buffer, int *bytes, int *private_bytes)
+{
+	int state_size;
+
+	assert(raop_buffer);
+	assert(bytes);
+	assert(private_bytes);
+
+	/* Compared to every session owning its audio and decoder buffers */
+	state_size = sizeof(raop_buffer_t) + alac_get_state_size(raop_buffer->alac);
+	MUTEX_LOCK(raop_buffer->buffer_mutex);
+	*bytes = state_size + (raop_buffer->buffer ? raop_buffer->buffer_size : 0);
+	*private_bytes = state_size + alac_get_scratch_size(raop_buffer->alac) +
+	                 raop_buffer->buffer_size;
+	MUTEX_UNLOCK(raop_buffer->buffer_mutex);
+}
+
+void
+raop_buffer_set_passthrough(raop_buffer_t *raop_buffer, int passthrough)
+{
+	assert(raop_buffer);
+
+	/* The entries are resized, so the buffer starts over */
+	raop_buffer_release(raop_buffer);
+	MUTEX_LOCK(raop_buffer->buffer_mutex);
+	raop_buffer->passthrough = !!passthrough;
+	raop_buffer_set_sizes(raop_buffer);
+	MUTEX_UNLOCK(raop_buffer->buffer_mutex);
 }
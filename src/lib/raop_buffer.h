@@ -44,6 +44,9 @@ int raop_buffer_queue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned
 const void *raop_buffer_dequeue(raop_buffer_t *raop_buffer, int *length, int no_resend);
 void raop_buffer_handle_resends(raop_buffer_t *raop_buffer, raop_resend_cb_t resend_cb, void *opaque);
 void raop_buffer_flush(raop_buffer_t *raop_buffer, int next_seq);
+void raop_buffer_release(raop_buffer_t *raop_buffer);
+void raop_buffer_set_passthrough(raop_buffer_t *raop_buffer, int passthrough);
+void raop_buffer_get_memory(raop_buffer_t *raop_buffer, int *bytes, int *private_bytes);
 
 void raop_buffer_destroy(raop_buffer_t *raop_buffer);
 
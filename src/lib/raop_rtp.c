@@ -28,6 +28,9 @@
 
 #define NO_FLUSH (-42)
 
+/* Milliseconds without audio before the audio buffers are freed */
+#define RAOP_RTP_IDLE_TIMEOUT 10000
+
 struct raop_rtp_s {
 	logger_t *logger;
 	raop_callbacks_t callbacks;
@@ -72,6 +75,10 @@ struct raop_rtp_s {
 	struct sockaddr_storage control_saddr;
 	socklen_t control_saddr_len;
 	unsigned short control_seqnum;
+
+	/* Time of the last audio packet, only used by the thread */
+	unsigned int packet_time;
+	int idle;
 };
 
 static int
@@ -156,6 +163,16 @@ raop_rtp_init(logger_t *logger, raop_callbacks_t *callbacks, const char *remote,
 	return raop_rtp;
 }
 
+void
+raop_rtp_get_memory(raop_rtp_t *raop_rtp, int *bytes, int *private_bytes)
+{
+	assert(raop_rtp);
+
+	raop_buffer_get_memory(raop_rtp->buffer, bytes, private_bytes);
+	*bytes += sizeof(raop_rtp_t);
+	*private_bytes += sizeof(raop_rtp_t);
+}
+
 void
 raop_rtp_destroy(raop_rtp_t *raop_rtp)
 {
@@ -248,6 +265,29 @@ raop_rtp_resend_callback(void *opaque, unsigned short seqnum, unsigned short cou
 	return 0;
 }
 
+static void
+raop_rtp_packet_queued(raop_rtp_t *raop_rtp)
+{
+	SYSTEM_GET_TIME(raop_rtp->packet_time);
+	raop_rtp->idle = 0;
+}
+
+static void
+raop_rtp_check_idle(raop_rtp_t *raop_rtp)
+{
+	unsigned int now;
+
+	if (raop_rtp->idle) {
+		return;
+	}
+	SYSTEM_GET_TIME(now);
+	if (now - raop_rtp->packet_time >= RAOP_RTP_IDLE_TIMEOUT) {
+		/* Paused for a while, allocated again on the next packet */
+		raop_buffer_release(raop_rtp->buffer);
+		raop_rtp->idle = 1;
+	}
+}
+
 static int
 raop_rtp_process_events(raop_rtp_t *raop_rtp, void *cb_data)
 {
@@ -320,6 +360,52 @@ raop_rtp_process_events(raop_rtp_t *raop_rtp, void *cb_data)
 	return 0;
 }
 
+static void *
+raop_rtp_audio_init(raop_rtp_t *raop_rtp, int *passthrough)
+{
+	const ALACSpecificConfig *config;
+	raop_alac_config_t alac_config;
+	void *cb_data;
+
+	config = raop_buffer_get_config(raop_rtp->buffer);
+	cb_data = raop_rtp->callbacks.audio_init(raop_rtp->callbacks.cls,
+	                               config->bitDepth,
+	                               config->numChannels,
+	                               config->sampleRate);
+
+	/* Sinks that decode ALAC themselves can take the frames as they are */
+	*passthrough = 0;
+	if (raop_rtp->callbacks.audio_passthrough && raop_rtp->callbacks.audio_process_alac) {
+		alac_config.frameLength = config->frameLength;
+		alac_config.compatibleVersion = config->compatibleVersion;
+		alac_config.bitDepth = config->bitDepth;
+		alac_config.pb = config->pb;
+		alac_config.mb = config->mb;
+		alac_config.kb = config->kb;
+		alac_config.numChannels = config->numChannels;
+		alac_config.maxRun = config->maxRun;
+		alac_config.maxFrameBytes = config->maxFrameBytes;
+		alac_config.avgBitRate = config->avgBitRate;
+		alac_config.sampleRate = config->sampleRate;
+		*passthrough = raop_rtp->callbacks.audio_passthrough(raop_rtp->callbacks.cls, cb_data, &alac_config) != 0;
+	}
+	raop_buffer_set_passthrough(raop_rtp->buffer, *passthrough);
+	if (*passthrough) {
+		logger_log(raop_rtp->logger, LOGGER_INFO, "Passing ALAC frames through without decoding");
+	}
+	return cb_data;
+}
+
+static void
+raop_rtp_audio_process(raop_rtp_t *raop_rtp, void *cb_data, int passthrough, const void *buffer, int buflen)
+{
+	if (passthrough) {
+		raop_rtp->callbacks.audio_process_alac(raop_rtp->callbacks.cls, cb_data, buffer, buflen);
+	} else {
+		raop_rtp->callbacks.audio_process(raop_rtp->callbacks.cls, cb_data, buffer, buflen);
+	}
+}
+
 static THREAD_RETVAL
 raop_rtp_thread_udp(void *arg)
 {
@@ -329,16 +415,12 @@ raop_rtp_thread_udp(void *arg)
 	struct sockaddr_storage saddr;
 	socklen_t saddrlen;
 
-	const ALACSpecificConfig *config;
 	void *cb_data = NULL;
+	int passthrough;
 
 	assert(raop_rtp);
 
-	config = raop_buffer_get_config(raop_rtp->buffer);
-	cb_data = raop_rtp->callbacks.audio_init(raop_rtp->callbacks.cls,
-	                               config->bitDepth,
-	                               config->numChannels,
-	                               config->sampleRate);
+	cb_data = raop_rtp_audio_init(raop_rtp, &passthrough);
 
 	while(1) {
 		fd_set rfds;
@@ -349,6 +431,7 @@ raop_rtp_thread_udp(void *arg)
 		if (raop_rtp_process_events(raop_rtp, cb_data)) {
 			break;
 		}
+		raop_rtp_check_idle(raop_rtp);
 
 		/* Set timeout value to 5ms */
 		tv.tv_sec = 0;
@@ -392,6 +475,7 @@ raop_rtp_thread_udp(void *arg)
 					/* Handle resent data packet */
 					int ret = raop_buffer_queue(raop_rtp->buffer, packet+4, packetlen-4, 1);
 					assert(ret >= 0);
+					raop_rtp_packet_queued(raop_rtp);
 				}
 			}
 		} else if (FD_ISSET(raop_rtp->tsock, &rfds)) {
@@ -409,10 +493,11 @@ raop_rtp_thread_udp(void *arg)
 
 				ret = raop_buffer_queue(raop_rtp->buffer, packet, packetlen, 1);
 				assert(ret >= 0);
+				raop_rtp_packet_queued(raop_rtp);
 
 				/* Decode all frames in queue */
 				while ((audiobuf = raop_buffer_dequeue(raop_rtp->buffer, &audiobuflen, no_resend))) {
-					raop_rtp->callbacks.audio_process(raop_rtp->callbacks.cls, cb_data, audiobuf, audiobuflen);
+					raop_rtp_audio_process(raop_rtp, cb_data, passthrough, audiobuf, audiobuflen);
 				}
 
 				/* Handle possible resend requests */
@@ -436,16 +521,12 @@ raop_rtp_thread_tcp(void *arg)
 	unsigned char packet[RAOP_PACKET_LEN];
 	unsigned int packetlen = 0;
 
-	const ALACSpecificConfig *config;
 	void *cb_data = NULL;
+	int passthrough;
 
 	assert(raop_rtp);
 
-	config = raop_buffer_get_config(raop_rtp->buffer);
-	cb_data = raop_rtp->callbacks.audio_init(raop_rtp->callbacks.cls,
-	                               config->bitDepth,
-	                               config->numChannels,
-	                               config->sampleRate);
+	cb_data = raop_rtp_audio_init(raop_rtp, &passthrough);
 
 	while (1) {
 		fd_set rfds;
@@ -456,6 +537,7 @@ raop_rtp_thread_tcp(void *arg)
 		if (raop_rtp_process_events(raop_rtp, cb_data)) {
 			break;
 		}
+		raop_rtp_check_idle(raop_rtp);
 
 		/* Set timeout value to 5ms */
 		tv.tv_sec = 0;
@@ -531,6 +613,7 @@ raop_rtp_thread_tcp(void *arg)
 			/* Packet is valid, process it */
 			ret = raop_buffer_queue(raop_rtp->buffer, packet+4, rtplen, 0);
 			assert(ret >= 0);
+			raop_rtp_packet_queued(raop_rtp);
 
 			/* Remove processed bytes from packet buffer */
 			memmove(packet, packet+4+rtplen, packetlen-rtplen);
@@ -538,7 +621,7 @@ raop_rtp_thread_tcp(void *arg)
 
 			/* Decode the received frame */
 			if ((audiobuf = raop_buffer_dequeue(raop_rtp->buffer, &audiobuflen, 1))) {
-				raop_rtp->callbacks.audio_process(raop_rtp->callbacks.cls, cb_data, audiobuf, audiobuflen);
+				raop_rtp_audio_process(raop_rtp, cb_data, passthrough, audiobuf, audiobuflen);
 			}
 		}
 	}
@@ -586,6 +669,8 @@ raop_rtp_start(raop_rtp_t *raop_rtp, int use_udp, unsigned short control_rport,
 	/* Create the thread and initialize running values */
 	raop_rtp->running = 1;
 	raop_rtp->joined = 0;
+	SYSTEM_GET_TIME(raop_rtp->packet_time);
+	raop_rtp->idle = 0;
 	if (use_udp) {
 		THREAD_CREATE(raop_rtp->thread, raop_rtp_thread_udp, raop_rtp);
 	} else {
@@ -613,45 +698,45 @@ raop_rtp_set_volume(raop_rtp_t *raop_rtp, float volume)
 }
 
 void
-raop_rtp_set_metadata(raop_rtp_t *raop_rtp, const char *data, int datalen)
+raop_rtp_set_metadata(raop_rtp_t *raop_rtp, unsigned char *metadata, int metadata_len)
 {
-	unsigned char *metadata;
+	unsigned char *old;
 
 	assert(raop_rtp);
 
-	if (datalen <= 0) {
+	if (metadata_len <= 0) {
+		free(metadata);
 		return;
 	}
-	metadata = malloc(datalen);
-	assert(metadata);
-	memcpy(metadata, data, datalen);
 
-	/* Set metadata in thread instead */
+	/* Set metadata in thread instead, replacing any not yet handled */
 	MUTEX_LOCK(raop_rtp->run_mutex);
+	old = raop_rtp->metadata;
 	raop_rtp->metadata = metadata;
-	raop_rtp->metadata_len = datalen;
+	raop_rtp->metadata_len = metadata_len;
 	MUTEX_UNLOCK(raop_rtp->run_mutex);
+	free(old);
 }
 
 void
-raop_rtp_set_coverart(raop_rtp_t *raop_rtp, const char *data, int datalen)
+raop_rtp_set_coverart(raop_rtp_t *raop_rtp, unsigned char *coverart, int coverart_len)
 {
-	unsigned char *coverart;
+	unsigned char *old;
 
 	assert(raop_rtp);
 
-	if (datalen <= 0) {
+	if (coverart_len <= 0) {
+		free(coverart);
 		return;
 	}
-	coverart = malloc(datalen);
-	assert(coverart);
-	memcpy(coverart, data, datalen);
 
-	/* Set coverart in thread instead */
+	/* Set coverart in thread instead, replacing any not yet handled */
 	MUTEX_LOCK(raop_rtp->run_mutex);
+	old = raop_rtp->coverart;
 	raop_rtp->coverart = coverart;
-	raop_rtp->coverart_len = datalen;
+	raop_rtp->coverart_len = coverart_len;
 	MUTEX_UNLOCK(raop_rtp->run_mutex);
+	free(old);
 }
 
 void
@@ -686,8 +771,8 @@ raop_rtp_stop(raop_rtp_t *raop_rtp)
 	if (raop_rtp->tsock != -1) closesocket(raop_rtp->tsock);
 	if (raop_rtp->dsock != -1) closesocket(raop_rtp->dsock);
 
-	/* Flush buffer into initial state */
-	raop_buffer_flush(raop_rtp->buffer, -1);
+	/* Flush buffer into initial state, without audio buffers */
+	raop_buffer_release(raop_rtp->buffer);
 
 	/* Mark thread as joined */
 	MUTEX_LOCK(raop_rtp->run_mutex);
@@ -31,9 +31,11 @@ raop_rtp_t *raop_rtp_init(logger_t *logger, raop_callbacks_t *callbacks, const c
 void raop_rtp_start(raop_rtp_t *raop_rtp, int use_udp, unsigned short control_rport, unsigned short timing_rport,
                     unsigned short *control_lport, unsigned short *timing_lport, unsigned short *data_lport);
 void raop_rtp_set_volume(raop_rtp_t *raop_rtp, float volume);
-void raop_rtp_set_metadata(raop_rtp_t *raop_rtp, const char *data, int datalen);
-void raop_rtp_set_coverart(raop_rtp_t *raop_rtp, const char *data, int datalen);
+/* Metadata and coverart buffers are allocated with malloc, ownership is passed */
+void raop_rtp_set_metadata(raop_rtp_t *raop_rtp, unsigned char *metadata, int metadata_len);
+void raop_rtp_set_coverart(raop_rtp_t *raop_rtp, unsigned char *coverart, int coverart_len);
 void raop_rtp_flush(raop_rtp_t *raop_rtp, int next_seq);
+void raop_rtp_get_memory(raop_rtp_t *raop_rtp, int *bytes, int *private_bytes);
 void raop_rtp_stop(raop_rtp_t *raop_rtp);
 void raop_rtp_destroy(raop_rtp_t *raop_rtp);
 
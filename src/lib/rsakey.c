@@ -20,39 +20,227 @@
 #include "rsakey.h"
 #include "rsapem.h"
 #include "base64.h"
+#include "threads.h"
 #include "crypto/crypto.h"
 
 #define RSA_MIN_PADLEN 8
 #define MAX_KEYLEN 512
 
-struct rsakey_s {
-	int keylen;             /* length of modulus in bytes */
+/* Number of bigint contexts, each serves one operation at a time */
+#define RSAKEY_CONTEXTS 4
+
+/* Recently decrypted inputs, senders resend the same key on reconnect */
+#define RSAKEY_CACHE_ENTRIES 8
+#define RSAKEY_CACHE_DATALEN 32
+
+typedef struct rsakey_cache_entry_s {
+	unsigned char hash[SHA1_SIZE];  /* SHA-1 of the decoded input */
+	unsigned char data[RSAKEY_CACHE_DATALEN];
+	int datalen;
+	unsigned int used;              /* last use, 0 if entry is empty */
+} rsakey_cache_entry_t;
+
+typedef struct rsakey_ctx_s {
 	BI_CTX *bi_ctx;         /* bigint context */
+	mutex_handle_t mutex;   /* bigint context is not thread safe */
 
 	bigint *n;              /* modulus */
-	bigint *e;              /* public exponent */
 	bigint *d;              /* private exponent */
 
-	int use_crt;            /* use chinese remainder theorem */
 	bigint *p;              /* p as in m = pq */
 	bigint *q;              /* q as in m = pq */
 	bigint *dP;             /* d mod (p-1) */
 	bigint *dQ;             /* d mod (q-1) */
 	bigint *qInv;           /* q^-1 mod p */
+} rsakey_ctx_t;
+
+struct rsakey_s {
+	int keylen;             /* length of modulus in bytes */
+	int use_crt;            /* use chinese remainder theorem */
+
+	/* Contexts for the bigint code, operations take a free one */
+	rsakey_ctx_t ctx[RSAKEY_CONTEXTS];
+	int num_ctx;
+
+	/* LRU cache of decrypted data, the only mutable state */
+	mutex_handle_t cache_mutex;
+	rsakey_cache_entry_t cache[RSAKEY_CACHE_ENTRIES];
+	unsigned int cache_clock;
+	unsigned long long cache_hits;
+	unsigned long long cache_misses;
+
+#if defined(CONFIG_BIGINT_MONT64)
+	/* Read only copies for 64-bit Montgomery arithmetic */
+	int use_mont64;
+	BI64_MOD mod_n;
+	BI64_MOD mod_p;
+	BI64_MOD mod_q;
+	uint64_t qInvR[BI64_MAX_LIMBS];  /* q^-1*R mod p */
+	unsigned char d_bytes[MAX_KEYLEN];
+	int d_len;
+	unsigned char dP_bytes[MAX_KEYLEN];
+	int dP_len;
+	unsigned char dQ_bytes[MAX_KEYLEN];
+	int dQ_len;
+#endif
 
 	base64_t *base64;
 };
 
-rsakey_t *
-rsakey_init(const unsigned char *modulus, int mod_len,
-            const unsigned char *pub_exp, int pub_len,
-            const unsigned char *priv_exp, int priv_len,
-            /* Optional, used for crt optimization */
-            const unsigned char *p, int p_len,
-            const unsigned char *q, int q_len,
-            const unsigned char *dP, int dP_len,
-            const unsigned char *dQ, int dQ_len,
-            const unsigned char *qInv, int qInv_len)
+#if defined(CONFIG_BIGINT_MONT64)
+static void
+rsakey_init_mont64(rsakey_t *rsakey,
+                   const unsigned char *modulus, int mod_len,
+                   const unsigned char *priv_exp, int priv_len,
+                   const unsigned char *p, int p_len,
+                   const unsigned char *q, int q_len,
+                   const unsigned char *dP, int dP_len,
+                   const unsigned char *dQ, int dQ_len,
+                   const unsigned char *qInv, int qInv_len)
+{
+	uint64_t tmp[BI64_MAX_LIMBS];
+
+	if (priv_len > MAX_KEYLEN || bi64_set_mod(&rsakey->mod_n, modulus, mod_len) < 0) {
+		return;
+	}
+	memcpy(rsakey->d_bytes, priv_exp, priv_len);
+	rsakey->d_len = priv_len;
+
+	if (rsakey->use_crt) {
+		int n;
+
+		if (dP_len > MAX_KEYLEN || dQ_len > MAX_KEYLEN ||
+		    bi64_set_mod(&rsakey->mod_p, p, p_len) < 0 ||
+		    bi64_set_mod(&rsakey->mod_q, q, q_len) < 0) {
+			return;
+		}
+
+		/* Reducing the input needs the primes to be about half of n */
+		n = rsakey->mod_n.n;
+		if (n > 2*rsakey->mod_p.n || n > 2*rsakey->mod_q.n ||
+		    rsakey->mod_q.n > 2*rsakey->mod_p.n) {
+			return;
+		}
+		memcpy(rsakey->dP_bytes, dP, dP_len);
+		rsakey->dP_len = dP_len;
+		memcpy(rsakey->dQ_bytes, dQ, dQ_len);
+		rsakey->dQ_len = dQ_len;
+
+		/* Keep q^-1 premultiplied by R, one Montgomery step gives h*q^-1 */
+		bi64_import(tmp, BI64_MAX_LIMBS, qInv, qInv_len);
+		bi64_mod(&rsakey->mod_p, tmp, tmp, 2*rsakey->mod_p.n);
+		bi64_mont_mul(&rsakey->mod_p, rsakey->qInvR, tmp, rsakey->mod_p.rr);
+	}
+	rsakey->use_mont64 = 1;
+}
+
+/* Same as rsakey_modpow, needs no locking */
+static void
+rsakey_modpow_mont64(rsakey_t *rsakey, unsigned char *buffer)
+{
+	uint64_t c[BI64_MAX_LIMBS];
+	uint64_t m1[BI64_MAX_LIMBS];
+	uint64_t m2[BI64_MAX_LIMBS];
+	uint64_t h[BI64_MAX_LIMBS];
+	uint64_t out[2*BI64_MAX_LIMBS];
+	const BI64_MOD *p = &rsakey->mod_p;
+	const BI64_MOD *q = &rsakey->mod_q;
+	int n = rsakey->mod_n.n;
+
+	bi64_import(c, n, buffer, rsakey->keylen);
+	if (!rsakey->use_crt) {
+		bi64_mod_power(&rsakey->mod_n, out, c, rsakey->d_bytes, rsakey->d_len);
+		bi64_export(out, n, buffer, rsakey->keylen);
+		return;
+	}
+
+	/* m1 = c^dP mod p, m2 = c^dQ mod q */
+	bi64_mod(p, m1, c, n);
+	bi64_mod_power(p, m1, m1, rsakey->dP_bytes, rsakey->dP_len);
+	bi64_mod(q, m2, c, n);
+	bi64_mod_power(q, m2, m2, rsakey->dQ_bytes, rsakey->dQ_len);
+
+	/* h = q^-1*(m1-m2) mod p */
+	bi64_mod(p, h, m2, q->n);
+	bi64_mod_sub(p, h, m1, h);
+	bi64_mont_mul(p, h, h, rsakey->qInvR);
+
+	/* m = m2 + h*q */
+	bi64_mul(out, h, p->n, q->m, q->n);
+	bi64_add_to(out, p->n+q->n, m2, q->n);
+	bi64_export(out, p->n+q->n, buffer, rsakey->keylen);
+}
+#endif
+
+static void
+rsakey_ctx_init(rsakey_t *rsakey, rsakey_ctx_t *ctx,
+                const unsigned char *modulus, int mod_len,
+                const unsigned char *priv_exp, int priv_len,
+                const unsigned char *p, int p_len,
+                const unsigned char *q, int q_len,
+                const unsigned char *dP, int dP_len,
+                const unsigned char *dQ, int dQ_len,
+                const unsigned char *qInv, int qInv_len)
+{
+	ctx->bi_ctx = bi_initialize();
+	MUTEX_CREATE(ctx->mutex);
+
+	/* Import the private key */
+	ctx->n = bi_import(ctx->bi_ctx, modulus, mod_len);
+	ctx->d = bi_import(ctx->bi_ctx, priv_exp, priv_len);
+
+	if (rsakey->use_crt) {
+		/* Import crt optimization keys */
+		ctx->p = bi_import(ctx->bi_ctx, p, p_len);
+		ctx->q = bi_import(ctx->bi_ctx, q, q_len);
+		ctx->dP = bi_import(ctx->bi_ctx, dP, dP_len);
+		ctx->dQ = bi_import(ctx->bi_ctx, dQ, dQ_len);
+		ctx->qInv = bi_import(ctx->bi_ctx, qInv, qInv_len);
+
+		/* Set imported keys either permanent or modulo */
+		bi_permanent(ctx->dP);
+		bi_permanent(ctx->dQ);
+		bi_permanent(ctx->qInv);
+		bi_set_mod(ctx->bi_ctx, ctx->p, BIGINT_P_OFFSET);
+		bi_set_mod(ctx->bi_ctx, ctx->q, BIGINT_Q_OFFSET);
+	}
+
+	/* Add keys to the bigint context */
+	bi_set_mod(ctx->bi_ctx, ctx->n, BIGINT_M_OFFSET);
+	bi_permanent(ctx->d);
+}
+
+static void
+rsakey_ctx_destroy(rsakey_t *rsakey, rsakey_ctx_t *ctx)
+{
+	bi_free_mod(ctx->bi_ctx, BIGINT_M_OFFSET);
+	bi_depermanent(ctx->d);
+	bi_free(ctx->bi_ctx, ctx->d);
+
+	if (rsakey->use_crt) {
+		bi_free_mod(ctx->bi_ctx, BIGINT_P_OFFSET);
+		bi_free_mod(ctx->bi_ctx, BIGINT_Q_OFFSET);
+		bi_depermanent(ctx->dP);
+		bi_depermanent(ctx->dQ);
+		bi_depermanent(ctx->qInv);
+		bi_free(ctx->bi_ctx, ctx->dP);
+		bi_free(ctx->bi_ctx, ctx->dQ);
+		bi_free(ctx->bi_ctx, ctx->qInv);
+	}
+	bi_terminate(ctx->bi_ctx);
+	MUTEX_DESTROY(ctx->mutex);
+}
+
+static rsakey_t *
+rsakey_init_internal(const unsigned char *modulus, int mod_len,
+                     const unsigned char *pub_exp, int pub_len,
+                     const unsigned char *priv_exp, int priv_len,
+                     const unsigned char *p, int p_len,
+                     const unsigned char *q, int q_len,
+                     const unsigned char *dP, int dP_len,
+                     const unsigned char *dQ, int dQ_len,
+                     const unsigned char *qInv, int qInv_len,
+                     int portable)
 {
 	rsakey_t *rsakey;
 	int i;
@@ -74,40 +262,55 @@ rsakey_init(const unsigned char *modulus, int mod_len,
 	/* Initialize structure */
 	for (i=0; !modulus[i] && i<mod_len; i++);
 	rsakey->keylen = mod_len-i;
-	rsakey->bi_ctx = bi_initialize();
-
-	/* Import public and private keys */
-	rsakey->n = bi_import(rsakey->bi_ctx, modulus, mod_len);
-	rsakey->e = bi_import(rsakey->bi_ctx, pub_exp, pub_len);
-	rsakey->d = bi_import(rsakey->bi_ctx, priv_exp, priv_len);
-
-	if (p && q && dP && dQ && qInv) {
-		/* Import crt optimization keys */
-		rsakey->p = bi_import(rsakey->bi_ctx, p, p_len);
-		rsakey->q = bi_import(rsakey->bi_ctx, q, q_len);
-		rsakey->dP = bi_import(rsakey->bi_ctx, dP, dP_len);
-		rsakey->dQ = bi_import(rsakey->bi_ctx, dQ, dQ_len);
-		rsakey->qInv = bi_import(rsakey->bi_ctx, qInv, qInv_len);
-	
-		/* Set imported keys either permanent or modulo */
-		bi_permanent(rsakey->dP);
-		bi_permanent(rsakey->dQ);
-		bi_permanent(rsakey->qInv);
-		bi_set_mod(rsakey->bi_ctx, rsakey->p, BIGINT_P_OFFSET);
-		bi_set_mod(rsakey->bi_ctx, rsakey->q, BIGINT_Q_OFFSET);
+	rsakey->use_crt = (p && q && dP && dQ && qInv);
+	MUTEX_CREATE(rsakey->cache_mutex);
 
-		rsakey->use_crt = 1;
+#if defined(CONFIG_BIGINT_MONT64)
+	if (!portable) {
+		rsakey_init_mont64(rsakey, modulus, mod_len, priv_exp, priv_len,
+		                   p, p_len, q, q_len, dP, dP_len, dQ, dQ_len, qInv, qInv_len);
 	}
+	if (rsakey->use_mont64) {
+		return rsakey;
+	}
+#endif
 
-	/* Add keys to the bigint context */
-	bi_set_mod(rsakey->bi_ctx, rsakey->n, BIGINT_M_OFFSET);
-	bi_permanent(rsakey->e);
-	bi_permanent(rsakey->d);
+	for (i=0; i<RSAKEY_CONTEXTS; i++) {
+		rsakey_ctx_init(rsakey, &rsakey->ctx[i], modulus, mod_len, priv_exp, priv_len,
+		                p, p_len, q, q_len, dP, dP_len, dQ, dQ_len, qInv, qInv_len);
+	}
+	rsakey->num_ctx = RSAKEY_CONTEXTS;
 	return rsakey;
 }
 
+/* Stores through volatile so the clearing is not dropped before free */
+static void
+rsakey_clear(void *ptr, size_t len)
+{
+	volatile unsigned char *p = ptr;
+
+	while (len--) {
+		*p++ = 0;
+	}
+}
+
 rsakey_t *
-rsakey_init_pem(const char *pemstr)
+rsakey_init(const unsigned char *modulus, int mod_len,
+            const unsigned char *pub_exp, int pub_len,
+            const unsigned char *priv_exp, int priv_len,
+            /* Optional, used for crt optimization */
+            const unsigned char *p, int p_len,
+            const unsigned char *q, int q_len,
+            const unsigned char *dP, int dP_len,
+            const unsigned char *dQ, int dQ_len,
+            const unsigned char *qInv, int qInv_len)
+{
+	return rsakey_init_internal(modulus, mod_len, pub_exp, pub_len, priv_exp, priv_len,
+	                            p, p_len, q, q_len, dP, dP_len, dQ, dQ_len, qInv, qInv_len, 0);
+}
+
+static rsakey_t *
+rsakey_init_pem_internal(const char *pemstr, int portable)
 {
 	rsapem_t *rsapem;
 	unsigned char *modulus=NULL; unsigned int mod_len=0;
@@ -138,8 +341,9 @@ rsakey_init_pem(const char *pemstr)
 	
 	if (modulus && pub_exp && priv_exp) {
 		/* Initialize rsakey value */
-		rsakey = rsakey_init(modulus, mod_len, pub_exp, pub_len, priv_exp, priv_len,
-				     p, p_len, q, q_len, dP, dP_len, dQ, dQ_len, qInv, qInv_len);
+		rsakey = rsakey_init_internal(modulus, mod_len, pub_exp, pub_len, priv_exp, priv_len,
+		                              p, p_len, q, q_len, dP, dP_len, dQ, dQ_len, qInv, qInv_len,
+		                              portable);
 	}
 
 	free(modulus);
@@ -154,44 +358,78 @@ rsakey_init_pem(const char *pemstr)
 	return rsakey;
 }
 
+rsakey_t *
+rsakey_init_pem(const char *pemstr)
+{
+	return rsakey_init_pem_internal(pemstr, 0);
+}
+
+rsakey_t *
+rsakey_init_pem_portable(const char *pemstr)
+{
+	return rsakey_init_pem_internal(pemstr, 1);
+}
+
 void
 rsakey_destroy(rsakey_t *rsakey)
 {
 	if (rsakey) {
-		bi_free_mod(rsakey->bi_ctx, BIGINT_M_OFFSET);
-		bi_depermanent(rsakey->e);
-		bi_depermanent(rsakey->d);
-		bi_free(rsakey->bi_ctx, rsakey->e);
-		bi_free(rsakey->bi_ctx, rsakey->d);
-
-		if (rsakey->use_crt) {
-			bi_free_mod(rsakey->bi_ctx, BIGINT_P_OFFSET);
-			bi_free_mod(rsakey->bi_ctx, BIGINT_Q_OFFSET);
-			bi_depermanent(rsakey->dP);
-			bi_depermanent(rsakey->dQ);
-			bi_depermanent(rsakey->qInv);
-			bi_free(rsakey->bi_ctx, rsakey->dP);
-			bi_free(rsakey->bi_ctx, rsakey->dQ);
-			bi_free(rsakey->bi_ctx, rsakey->qInv);
-		}
-		bi_terminate(rsakey->bi_ctx);
+		int i;
 
+		for (i=0; i<rsakey->num_ctx; i++) {
+			rsakey_ctx_destroy(rsakey, &rsakey->ctx[i]);
+		}
+		MUTEX_DESTROY(rsakey->cache_mutex);
 		base64_destroy(rsakey->base64);
+
+		/* Cached session keys and private key copies are secret */
+		rsakey_clear(rsakey, sizeof(rsakey_t));
 		free(rsakey);
 	}
 }
 
-static bigint *
-rsakey_modpow(rsakey_t *rsakey, bigint *msg)
+static rsakey_ctx_t *
+rsakey_ctx_acquire(rsakey_t *rsakey)
 {
+	int i;
+
+	/* Take the first free context or wait for the first one */
+	for (i=0; i<rsakey->num_ctx; i++) {
+		if (MUTEX_TRYLOCK(rsakey->ctx[i].mutex)) {
+			return &rsakey->ctx[i];
+		}
+	}
+	MUTEX_LOCK(rsakey->ctx[0].mutex);
+	return &rsakey->ctx[0];
+}
+
+/* Calculates buffer = buffer^d (mod n) in place */
+static void
+rsakey_modpow(rsakey_t *rsakey, unsigned char *buffer)
+{
+	rsakey_ctx_t *ctx;
+	bigint *bi_in;
+	bigint *bi_out;
+
+#if defined(CONFIG_BIGINT_MONT64)
+	if (rsakey->use_mont64) {
+		rsakey_modpow_mont64(rsakey, buffer);
+		return;
+	}
+#endif
+
+	ctx = rsakey_ctx_acquire(rsakey);
+	bi_in = bi_import(ctx->bi_ctx, buffer, rsakey->keylen);
 	if (rsakey->use_crt) {
-		return bi_crt(rsakey->bi_ctx, msg,
-		              rsakey->dP, rsakey->dQ,
-		              rsakey->p, rsakey->q, rsakey->qInv);
+		bi_out = bi_crt(ctx->bi_ctx, bi_in,
+		                ctx->dP, ctx->dQ,
+		                ctx->p, ctx->q, ctx->qInv);
 	} else {
-		rsakey->bi_ctx->mod_offset = BIGINT_M_OFFSET;
-		return bi_mod_power(rsakey->bi_ctx, msg, rsakey->d);
+		ctx->bi_ctx->mod_offset = BIGINT_M_OFFSET;
+		bi_out = bi_mod_power(ctx->bi_ctx, bi_in, ctx->d);
 	}
+	bi_export(ctx->bi_ctx, bi_out, buffer, rsakey->keylen);
+	MUTEX_UNLOCK(ctx->mutex);
 }
 
 int
@@ -200,11 +438,9 @@ rsakey_sign(rsakey_t *rsakey, char *dst, int dstlen, const char *b64digest,
             unsigned char *hwaddr, int hwaddrlen)
 {
 	unsigned char buffer[MAX_KEYLEN];
-	unsigned char *digest;
+	unsigned char digest[MAX_KEYLEN];
 	int digestlen;
 	int inputlen;
-	bigint *bi_in;
-	bigint *bi_out;
 	int idx;
 
 	assert(rsakey);
@@ -214,7 +450,7 @@ rsakey_sign(rsakey_t *rsakey, char *dst, int dstlen, const char *b64digest,
 	}
 
 	/* Decode the base64 digest */
-	digestlen = base64_decode(rsakey->base64, &digest, b64digest, strlen(b64digest));
+	digestlen = base64_decode_buf(rsakey->base64, digest, sizeof(digest), b64digest, strlen(b64digest));
 	if (digestlen < 0) {
 		return -2;
 	}
@@ -222,7 +458,6 @@ rsakey_sign(rsakey_t *rsakey, char *dst, int dstlen, const char *b64digest,
 	/* Calculate the input data length */
 	inputlen = digestlen+ipaddrlen+hwaddrlen;
 	if (inputlen > rsakey->keylen-3-RSA_MIN_PADLEN) {
-		free(digest);
 		return -3;
 	}
 	if (inputlen < 32) {
@@ -247,14 +482,10 @@ rsakey_sign(rsakey_t *rsakey, char *dst, int dstlen, const char *b64digest,
 	idx += hwaddrlen;
 
 	/* Calculate the signature s = m^d (mod n) */
-	bi_in = bi_import(rsakey->bi_ctx, buffer, rsakey->keylen);
-	bi_out = rsakey_modpow(rsakey, bi_in);
+	rsakey_modpow(rsakey, buffer);
 
 	/* Encode and save the signature into dst */
-	bi_export(rsakey->bi_ctx, bi_out, buffer, rsakey->keylen);
 	base64_encode(rsakey->base64, dst, buffer, rsakey->keylen);
-
-	free(digest);
 	return 0;
 }
 
@@ -292,38 +523,16 @@ rsakey_mfg1(unsigned char *dst, int dstlen, const unsigned char *seed, int seedl
 
 /* OAEP decryption with SHA-1 hash */
 /* See RFC 3447 7.1.2 for more information */
-int
-rsakey_decrypt(rsakey_t *rsakey, unsigned char *dst, int dstlen, const char *b64input)
+/* Decrypts the input of key length in buffer, buffer is overwritten */
+static int
+rsakey_decrypt_oaep(rsakey_t *rsakey, unsigned char *dst, int dstlen, unsigned char *buffer)
 {
-	unsigned char buffer[MAX_KEYLEN];
 	unsigned char maskbuf[MAX_KEYLEN];
-	unsigned char *input;
-	int inputlen;
-	bigint *bi_in;
-	bigint *bi_out;
 	int outlen;
 	int i, ret;
 
-	assert(rsakey);
-	if (!dst || !b64input) {
-		return -1;
-	}
-
-	memset(buffer, 0, sizeof(buffer));
-	inputlen = base64_decode(rsakey->base64, &input, b64input, strlen(b64input));
-	if (inputlen < 0 || inputlen > rsakey->keylen) {
-		return -2;
-	}
-	memcpy(buffer+rsakey->keylen-inputlen, input, inputlen);
-	free(input);
-	input = NULL;
-
 	/* Decrypt the input data m = c^d (mod n) */
-	bi_in = bi_import(rsakey->bi_ctx, buffer, rsakey->keylen);
-	bi_out = rsakey_modpow(rsakey, bi_in);
-
-	memset(buffer, 0, sizeof(buffer));
-	bi_export(rsakey->bi_ctx, bi_out, buffer, rsakey->keylen);
+	rsakey_modpow(rsakey, buffer);
 
 	/* First unmask seed in the buffer */
 	ret = rsakey_mfg1(maskbuf, sizeof(maskbuf),
@@ -360,10 +569,88 @@ rsakey_decrypt(rsakey_t *rsakey, unsigned char *dst, int dstlen, const char *b64
 	return outlen;
 }
 
+int
+rsakey_decrypt(rsakey_t *rsakey, unsigned char *dst, int dstlen, const char *b64input)
+{
+	unsigned char buffer[MAX_KEYLEN];
+	unsigned char input[MAX_KEYLEN];
+	unsigned char hash[SHA1_SIZE];
+	rsakey_cache_entry_t *entry;
+	SHA1_CTX sha_ctx;
+	int inputlen;
+	int ret, i;
+
+	assert(rsakey);
+	if (!dst || !b64input) {
+		return -1;
+	}
+
+	/* Decode and align to the end of buffer */
+	inputlen = base64_decode_buf(rsakey->base64, input, sizeof(input), b64input, strlen(b64input));
+	if (inputlen < 0 || inputlen > rsakey->keylen) {
+		return -2;
+	}
+	memset(buffer, 0, rsakey->keylen-inputlen);
+	memcpy(buffer+rsakey->keylen-inputlen, input, inputlen);
+
+	/* Cache by the aligned number, so any encoding of it finds the entry */
+	SHA1_Init(&sha_ctx);
+	SHA1_Update(&sha_ctx, buffer, rsakey->keylen);
+	SHA1_Final(hash, &sha_ctx);
+
+	/* Return the earlier result if the input has been seen */
+	MUTEX_LOCK(rsakey->cache_mutex);
+	for (i=0; i<RSAKEY_CACHE_ENTRIES; i++) {
+		entry = &rsakey->cache[i];
+		if (entry->used && !memcmp(entry->hash, hash, SHA1_SIZE)) {
+			if (entry->datalen > dstlen) {
+				break;
+			}
+			memcpy(dst, entry->data, entry->datalen);
+			entry->used = ++rsakey->cache_clock;
+			rsakey->cache_hits++;
+			MUTEX_UNLOCK(rsakey->cache_mutex);
+			return entry->datalen;
+		}
+	}
+	rsakey->cache_misses++;
+	MUTEX_UNLOCK(rsakey->cache_mutex);
+
+	ret = rsakey_decrypt_oaep(rsakey, dst, dstlen, buffer);
+	if (ret < 0 || ret > RSAKEY_CACHE_DATALEN) {
+		return ret;
+	}
+
+	/* Replace an empty or the least recently used entry */
+	MUTEX_LOCK(rsakey->cache_mutex);
+	entry = &rsakey->cache[0];
+	for (i=1; i<RSAKEY_CACHE_ENTRIES; i++) {
+		if (rsakey->cache[i].used < entry->used) {
+			entry = &rsakey->cache[i];
+		}
+	}
+	memcpy(entry->hash, hash, SHA1_SIZE);
+	memcpy(entry->data, dst, ret);
+	entry->datalen = ret;
+	entry->used = ++rsakey->cache_clock;
+	MUTEX_UNLOCK(rsakey->cache_mutex);
+	return ret;
+}
+
+void
+rsakey_get_cache_stats(rsakey_t *rsakey, unsigned long long *hits, unsigned long long *misses)
+{
+	assert(rsakey);
+
+	MUTEX_LOCK(rsakey->cache_mutex);
+	*hits = rsakey->cache_hits;
+	*misses = rsakey->cache_misses;
+	MUTEX_UNLOCK(rsakey->cache_mutex);
+}
+
 int
 rsakey_parseiv(rsakey_t *rsakey, unsigned char *dst, int dstlen, const char *b64input)
 {
-	unsigned char *tmpptr;
 	int length;
 
 	assert(rsakey);
@@ -371,15 +658,11 @@ rsakey_parseiv(rsakey_t *rsakey, unsigned char *dst, int dstlen, const char *b64
 		return -1;
 	}
 
-	length = base64_decode(rsakey->base64, &tmpptr, b64input, strlen(b64input));
-	if (length < 0) {
-		return -1;
-	} else if (length > dstlen) {
-		free(tmpptr);
+	length = base64_decode_buf(rsakey->base64, dst, dstlen, b64input, strlen(b64input));
+	if (length == -4) {
 		return -2;
+	} else if (length < 0) {
+		return -1;
 	}
-
-	memcpy(dst, tmpptr, length);
-	free(tmpptr);
 	return length;
 }
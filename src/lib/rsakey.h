@@ -26,6 +26,8 @@ rsakey_t *rsakey_init(const unsigned char *modulus, int mod_len,
                       const unsigned char *dQ, int dQ_len,
                       const unsigned char *qInv, int qInv_len);
 rsakey_t *rsakey_init_pem(const char *pemstr);
+/* Uses the portable bigint code even when faster arithmetic is built in */
+rsakey_t *rsakey_init_pem_portable(const char *pemstr);
 
 int rsakey_sign(rsakey_t *rsakey, char *dst, int dstlen, const char *b64digest,
                 unsigned char *ipaddr, int ipaddrlen,
@@ -33,6 +35,7 @@ int rsakey_sign(rsakey_t *rsakey, char *dst, int dstlen, const char *b64digest,
 
 int rsakey_decrypt(rsakey_t *rsakey, unsigned char *dst, int dstlen, const char *b64input);
 int rsakey_parseiv(rsakey_t *rsakey, unsigned char *dst, int dstlen, const char *b64input);
+void rsakey_get_cache_stats(rsakey_t *rsakey, unsigned long long *hits, unsigned long long *misses);
 
 void rsakey_destroy(rsakey_t *rsakey);
 
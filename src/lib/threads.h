@@ -31,6 +31,7 @@ typedef HANDLE mutex_handle_t;
 
 #define MUTEX_CREATE(handle) handle = CreateMutex(NULL, FALSE, NULL)
 #define MUTEX_LOCK(handle) WaitForSingleObject(handle, INFINITE)
+#define MUTEX_TRYLOCK(handle) (WaitForSingleObject(handle, 0) == WAIT_OBJECT_0)
 #define MUTEX_UNLOCK(handle) ReleaseMutex(handle)
 #define MUTEX_DESTROY(handle) CloseHandle(handle)
 
@@ -52,9 +53,18 @@ typedef pthread_mutex_t mutex_handle_t;
 
 #define MUTEX_CREATE(handle) pthread_mutex_init(&(handle), NULL)
 #define MUTEX_LOCK(handle) pthread_mutex_lock(&(handle))
+#define MUTEX_TRYLOCK(handle) (pthread_mutex_trylock(&(handle)) == 0)
 #define MUTEX_UNLOCK(handle) pthread_mutex_unlock(&(handle))
 #define MUTEX_DESTROY(handle) pthread_mutex_destroy(&(handle))
 
+typedef pthread_cond_t cond_handle_t;
+
+#define COND_CREATE(handle) pthread_cond_init(&(handle), NULL)
+#define COND_WAIT(handle, mutex) pthread_cond_wait(&(handle), &(mutex))
+#define COND_SIGNAL(handle) pthread_cond_signal(&(handle))
+#define COND_BROADCAST(handle) pthread_cond_broadcast(&(handle))
+#define COND_DESTROY(handle) pthread_cond_destroy(&(handle))
+
 #endif
 
 #endif /* THREADS_H */
@@ -0,0 +1,602 @@
+/**
+ *  Copyright (C) 2012-2013  Juho Vähä-Herttua
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining
+ *  a copy of this software and associated documentation files (the
+ *  "Software"), to deal in the Software without restriction, including
+ *  without limitation the rights to use, copy, modify, merge, publish,
+ *  distribute, sublicense, and/or sell copies of the Software, and to
+ *  permit persons to whom the Software is furnished to do so, subject to
+ *  the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included
+ *  in all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ *  EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ *  MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ *  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ *  CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ *  TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ *  SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Microbenchmarks of the library internals on the RTSP and audio paths.
+ * Where the approach that was replaced is still reachable, both are
+ * measured so the numbers can be compared on any machine. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef WIN32
+# include <windows.h>
+#else
+# include <time.h>
+#endif
+
+#include <stdint.h>
+#include "lib/crypto/crypto.h"
+#include "lib/http_request.h"
+#include "lib/rsakey.h"
+#include "lib/base64.h"
+#include "lib/digest.h"
+#include "lib/utils.h"
+
+/* Sessions and payload of the audio packet benchmarks, the payload is */
+/* the 16-byte aligned part of an uncompressed 352 sample stereo frame */
+#define BENCH_SESSIONS 64
+#define BENCH_PACKET_LEN 1408
+
+typedef struct {
+	double seconds;
+	const char *keyfile;
+	const char *names[16];
+	int num_names;
+} raopbench_options_t;
+
+typedef struct {
+	const char *name;
+	const char *description;
+	int (*run)(raopbench_options_t *opt);
+} raopbench_t;
+
+#if defined(__GLIBC__)
+/* glibc lets a program replace malloc, count the calls and pass them on */
+# define RAOPBENCH_COUNT_ALLOCATIONS
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static unsigned long allocations;
+
+void *
+malloc(size_t size)
+{
+	allocations++;
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+	allocations++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	allocations++;
+	return __libc_realloc(ptr, size);
+}
+
+void
+free(void *ptr)
+{
+	__libc_free(ptr);
+}
+#endif
+
+static double
+get_seconds(void)
+{
+#ifdef WIN32
+	return GetTickCount() / 1000.0;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+#endif
+}
+
+static const char bench_request[] =
+	"SET_PARAMETER rtsp://192.168.1.2/1234567 RTSP/1.0\r\n"
+	"CSeq: 12\r\n"
+	"Content-Type: text/parameters\r\n"
+	"User-Agent: AirPlay/190.9\r\n"
+	"Client-Instance: 1234567890ABCDEF\r\n"
+	"DACP-ID: 1234567890ABCDEF\r\n"
+	"Active-Remote: 123456789\r\n"
+	"Session: 1\r\n"
+	"Content-Length: 20\r\n"
+	"\r\n"
+	"volume: -20.000000\r\n";
+
+static int
+parse_request(http_request_t *request, int fragment)
+{
+	int length = sizeof(bench_request)-1;
+	int i;
+
+	for (i=0; i<length; i+=fragment) {
+		http_request_add_data(request, bench_request+i, (length-i < fragment) ? length-i : fragment);
+	}
+	if (!http_request_is_complete(request) ||
+	    strcmp(http_request_get_header_id(request, HTTP_HEADER_SESSION), "1")) {
+		return -1;
+	}
+	return 0;
+}
+
+static int
+run_request(raopbench_options_t *opt)
+{
+	static const int fragments[] = { sizeof(bench_request)-1, 16, 3 };
+	int i, reuse;
+
+	printf("SET_PARAMETER with 8 headers, %d bytes\n", (int) sizeof(bench_request)-1);
+	for (i=0; i<(int) (sizeof(fragments)/sizeof(fragments[0])); i++) {
+		for (reuse=0; reuse<2; reuse++) {
+			http_request_t *request = NULL;
+			unsigned long before = 0;
+			double start, elapsed;
+			long count = 0;
+			int n;
+
+			/* A reused request is warmed up before counting */
+			if (reuse) {
+				request = http_request_init();
+				if (!request || parse_request(request, fragments[i]) < 0) {
+					return -1;
+				}
+			}
+#if defined(RAOPBENCH_COUNT_ALLOCATIONS)
+			before = allocations;
+#endif
+			start = get_seconds();
+			do {
+				for (n=0; n<1000; n++) {
+					if (reuse) {
+						http_request_reset(request);
+					} else {
+						request = http_request_init();
+					}
+					if (!request || parse_request(request, fragments[i]) < 0) {
+						return -1;
+					}
+					if (!reuse) {
+						http_request_destroy(request);
+					}
+				}
+				count += n;
+				elapsed = get_seconds() - start;
+			} while (elapsed < opt->seconds);
+			if (reuse) {
+				http_request_destroy(request);
+			}
+
+			printf("  %3d byte fragments, %-7s", fragments[i], reuse ? "reused:" : "fresh:");
+#if defined(RAOPBENCH_COUNT_ALLOCATIONS)
+			printf(" %6.2f allocs/request", (double) (allocations-before) / count);
+#endif
+			printf(" %8.0f ns/request\n", elapsed * 1000000000.0 / count);
+		}
+	}
+	return 0;
+}
+
+typedef struct {
+	unsigned char key[BENCH_SESSIONS][16];
+	unsigned char iv[BENCH_SESSIONS][16];
+	unsigned char packet[BENCH_SESSIONS][BENCH_PACKET_LEN];
+	unsigned char output[BENCH_PACKET_LEN];
+	AES_CTX ctx[BENCH_SESSIONS];
+} bench_sessions_t;
+
+static bench_sessions_t *
+init_sessions(void)
+{
+	bench_sessions_t *sessions;
+	int i, j;
+
+	sessions = malloc(sizeof(bench_sessions_t));
+	if (!sessions) {
+		return NULL;
+	}
+	srand(1);
+	for (i=0; i<BENCH_SESSIONS; i++) {
+		for (j=0; j<16; j++) {
+			sessions->key[i][j] = rand();
+			sessions->iv[i][j] = rand();
+		}
+		for (j=0; j<BENCH_PACKET_LEN; j++) {
+			sessions->packet[i][j] = rand();
+		}
+		AES_set_key(&sessions->ctx[i], sessions->key[i], sessions->iv[i], AES_MODE_128);
+		AES_convert_key(&sessions->ctx[i]);
+	}
+	return sessions;
+}
+
+static int
+run_keyschedule(raopbench_options_t *opt)
+{
+	bench_sessions_t *sessions;
+	unsigned char check[BENCH_PACKET_LEN];
+	double results[2];
+	int cached;
+
+	sessions = init_sessions();
+	if (!sessions) {
+		return -1;
+	}
+
+	printf("%d sessions round robin, %d byte packets\n", BENCH_SESSIONS, BENCH_PACKET_LEN);
+	for (cached=0; cached<2; cached++) {
+		double start, elapsed;
+		long count = 0;
+
+		start = get_seconds();
+		do {
+			int i;
+
+			for (i=0; i<BENCH_SESSIONS*100; i++) {
+				int session = i%BENCH_SESSIONS;
+				AES_CTX ctx, *pctx;
+
+				if (cached) {
+					/* Only the IV is reset, like raop_buffer does now */
+					pctx = &sessions->ctx[session];
+					memcpy(pctx->iv, sessions->iv[session], AES_IV_SIZE);
+				} else {
+					pctx = &ctx;
+					AES_set_key(pctx, sessions->key[session], sessions->iv[session], AES_MODE_128);
+					AES_convert_key(pctx);
+				}
+				AES_cbc_decrypt(pctx, sessions->packet[session], sessions->output, BENCH_PACKET_LEN);
+			}
+			count += i;
+			elapsed = get_seconds() - start;
+		} while (elapsed < opt->seconds);
+		results[cached] = elapsed * 1000000000.0 / count;
+
+		/* Last packet of both runs is the same and has to decrypt the same */
+		if (!cached) {
+			memcpy(check, sessions->output, BENCH_PACKET_LEN);
+		} else if (memcmp(check, sessions->output, BENCH_PACKET_LEN)) {
+			free(sessions);
+			return -1;
+		}
+		printf("  key schedule per %-8s %8.0f ns/packet\n", cached ? "session:" : "packet:", results[cached]);
+	}
+	printf("  saved per packet:          %8.0f ns\n", results[0]-results[1]);
+
+	free(sessions);
+	return 0;
+}
+
+static double
+measure_decrypt(raopbench_options_t *opt, bench_sessions_t *sessions,
+                void (*decrypt)(AES_CTX *, const uint8_t *, uint8_t *, int))
+{
+	double start, elapsed;
+	long count = 0;
+
+	start = get_seconds();
+	do {
+		int i;
+
+		for (i=0; i<BENCH_SESSIONS*10; i++) {
+			int session = i%BENCH_SESSIONS;
+
+			memcpy(sessions->ctx[session].iv, sessions->iv[session], AES_IV_SIZE);
+			decrypt(&sessions->ctx[session], sessions->packet[session], sessions->output, BENCH_PACKET_LEN);
+		}
+		count += i;
+		elapsed = get_seconds() - start;
+	} while (elapsed < opt->seconds);
+	return elapsed * 1000000000.0 / count;
+}
+
+static int
+run_aes(raopbench_options_t *opt)
+{
+	bench_sessions_t *sessions;
+	unsigned char check[BENCH_PACKET_LEN];
+	double portable;
+
+	sessions = init_sessions();
+	if (!sessions) {
+		return -1;
+	}
+
+	printf("AES-128-CBC decrypt of %d byte packets\n", BENCH_PACKET_LEN);
+	portable = measure_decrypt(opt, sessions, AES_cbc_decrypt_portable);
+	memcpy(check, sessions->output, BENCH_PACKET_LEN);
+	printf("  portable: %8.0f ns/packet %8.1f MB/s\n", portable,
+	       BENCH_PACKET_LEN * 1000.0 / portable);
+#if defined(CONFIG_AES_NI)
+	if (AES_ni_available()) {
+		double ni = measure_decrypt(opt, sessions, AES_ni_cbc_decrypt);
+
+		if (memcmp(check, sessions->output, BENCH_PACKET_LEN)) {
+			free(sessions);
+			return -1;
+		}
+		printf("  AES-NI:   %8.0f ns/packet %8.1f MB/s %6.1fx\n", ni,
+		       BENCH_PACKET_LEN * 1000.0 / ni, portable / ni);
+	} else {
+		printf("  AES-NI:   not supported by this CPU\n");
+	}
+#endif
+
+	free(sessions);
+	return 0;
+}
+
+#define BENCH_RSA_INPUTS 16
+
+static int
+run_rsa(raopbench_options_t *opt)
+{
+	static const char *challenge = "dGVzdGNoYWxsZW5nZTEyMzQ1Ng==";
+	unsigned char ipaddr[4] = { 192, 168, 1, 2 };
+	unsigned char hwaddr[6] = { 0x48, 0x5d, 0x60, 0x7c, 0xee, 0x22 };
+	char inputs[BENCH_RSA_INPUTS][1024];
+	char signatures[2][1024];
+	base64_t *base64;
+	char *pemstr;
+	int portable, i, j;
+
+	if (utils_read_file(&pemstr, opt->keyfile) < 0) {
+		fprintf(stderr, "Could not read key from %s\n", opt->keyfile);
+		return -1;
+	}
+
+	/* Random 2048-bit inputs below the modulus, decrypting them fails OAEP */
+	/* check after the private key operation so nothing gets cached */
+	base64 = base64_init(NULL, 0, 0);
+	if (!base64) {
+		free(pemstr);
+		return -1;
+	}
+	srand(1);
+	for (i=0; i<BENCH_RSA_INPUTS; i++) {
+		unsigned char input[256];
+
+		input[0] = 0;
+		for (j=1; j<(int) sizeof(input); j++) {
+			input[j] = rand();
+		}
+		base64_encode(base64, inputs[i], input, sizeof(input));
+	}
+	base64_destroy(base64);
+
+	printf("private key operations with %s\n", opt->keyfile);
+	for (portable=0; portable<2; portable++) {
+		rsakey_t *rsakey;
+		unsigned char output[256];
+		double start, elapsed, sign, decrypt;
+		long count;
+
+		rsakey = portable ? rsakey_init_pem_portable(pemstr) : rsakey_init_pem(pemstr);
+		if (!rsakey) {
+			free(pemstr);
+			return -1;
+		}
+
+		count = 0;
+		start = get_seconds();
+		do {
+			if (rsakey_sign(rsakey, signatures[portable], sizeof(signatures[portable]), challenge,
+			                ipaddr, sizeof(ipaddr), hwaddr, sizeof(hwaddr)) < 0) {
+				rsakey_destroy(rsakey);
+				free(pemstr);
+				return -1;
+			}
+			count++;
+			elapsed = get_seconds() - start;
+		} while (elapsed < opt->seconds);
+		sign = elapsed / count;
+
+		count = 0;
+		start = get_seconds();
+		do {
+			rsakey_decrypt(rsakey, output, sizeof(output), inputs[count%BENCH_RSA_INPUTS]);
+			count++;
+			elapsed = get_seconds() - start;
+		} while (elapsed < opt->seconds);
+		decrypt = elapsed / count;
+		rsakey_destroy(rsakey);
+
+		printf("  %-9s sign %8.0f us %6.0f ops/s, decrypt %8.0f us %6.0f ops/s\n",
+		       portable ? "portable:" : "default:", sign * 1000000.0, 1.0 / sign,
+		       decrypt * 1000000.0, 1.0 / decrypt);
+	}
+	free(pemstr);
+
+	/* Both implementations have to sign the same */
+	return strcmp(signatures[0], signatures[1]) ? -1 : 0;
+}
+
+static void
+bench_md5_hex(const char *str, char *md5hex)
+{
+	MD5_CTX md5ctx;
+	unsigned char md5buf[MD5_SIZE];
+	int i;
+
+	MD5_Init(&md5ctx);
+	MD5_Update(&md5ctx, (const unsigned char *)str, strlen(str));
+	MD5_Final(md5buf, &md5ctx);
+	for (i=0; i<MD5_SIZE; i++) {
+		sprintf(md5hex+2*i, "%02x", md5buf[i]);
+	}
+}
+
+static int
+run_digest(raopbench_options_t *opt)
+{
+	static const char *realm = "AppleTV";
+	static const char *username = "iTunes";
+	static const char *password = "secret";
+	static const char *method = "ANNOUNCE";
+	static const char *uri = "rtsp://192.168.1.2/1234567";
+	char nonce[33];
+	char ha1[DIGEST_HA1_LEN+1];
+	char ha2[MD5_SIZE*2+1];
+	char response[MD5_SIZE*2+1];
+	char buffer[256];
+	char authorization[512];
+	int cached;
+
+	/* A valid Authorization header as sent by iTunes */
+	digest_generate_nonce(nonce, sizeof(nonce));
+	digest_get_ha1(username, realm, password, ha1);
+	ha1[DIGEST_HA1_LEN] = '\0';
+	snprintf(buffer, sizeof(buffer), "%s:%s", method, uri);
+	bench_md5_hex(buffer, ha2);
+	snprintf(buffer, sizeof(buffer), "%s:%s:%s", ha1, nonce, ha2);
+	bench_md5_hex(buffer, response);
+	snprintf(authorization, sizeof(authorization),
+	         "Digest username=\"%s\", realm=\"%s\", nonce=\"%s\", uri=\"%s\", response=\"%s\"",
+	         username, realm, nonce, uri, response);
+
+	printf("%s Authorization, %d bytes\n", method, (int) strlen(authorization));
+	for (cached=1; cached>=0; cached--) {
+		unsigned long before = 0;
+		double start, elapsed;
+		long count = 0;
+		int n;
+
+#if defined(RAOPBENCH_COUNT_ALLOCATIONS)
+		before = allocations;
+#endif
+		start = get_seconds();
+		do {
+			for (n=0; n<1000; n++) {
+				/* Without our HA1 it is calculated from the password */
+				if (!digest_is_valid(realm, password, username, cached ? ha1 : NULL,
+				                     nonce, method, uri, authorization)) {
+					return -1;
+				}
+			}
+			count += n;
+			elapsed = get_seconds() - start;
+		} while (elapsed < opt->seconds);
+
+		printf("  %-17s", cached ? "cached HA1:" : "HA1 per request:");
+		printf(" %9.0f verifications/s", count / elapsed);
+#if defined(RAOPBENCH_COUNT_ALLOCATIONS)
+		printf(" %6.2f allocs/verification", (double) (allocations-before) / count);
+#endif
+		printf(" %6.0f ns/verification\n", elapsed * 1000000000.0 / count);
+	}
+	return 0;
+}
+
+static const raopbench_t benchmarks[] = {
+	{ "request", "Parses RTSP requests with a fresh or a reused http_request_t", run_request },
+	{ "keyschedule", "Decrypts packets expanding the AES key per packet or per session", run_keyschedule },
+	{ "aes", "Decrypts packets with each AES implementation", run_aes },
+	{ "rsa", "Signs and decrypts with the RSA key, default and portable code", run_rsa },
+	{ "digest", "Verifies Digest authorization with a cached or a calculated HA1", run_digest }
+};
+#define NUM_BENCHMARKS ((int) (sizeof(benchmarks)/sizeof(benchmarks[0])))
+
+static int
+parse_options(raopbench_options_t *opt, int argc, char *argv[])
+{
+	char *path = argv[0];
+	char *arg;
+	int i;
+
+	opt->seconds = 1.0;
+	opt->keyfile = "airport.key";
+
+	while ((arg = *++argv)) {
+		if (!strcmp(arg, "-s") && argv[1]) {
+			opt->seconds = atof(*++argv);
+		} else if (!strncmp(arg, "--seconds=", 10)) {
+			opt->seconds = atof(arg+10);
+		} else if (!strcmp(arg, "-k") && argv[1]) {
+			opt->keyfile = *++argv;
+		} else if (!strncmp(arg, "--keyfile=", 10)) {
+			opt->keyfile = arg+10;
+		} else if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+			break;
+		} else if (arg[0] != '-' && opt->num_names < 16) {
+			for (i=0; i<NUM_BENCHMARKS; i++) {
+				if (!strcmp(arg, benchmarks[i].name)) {
+					break;
+				}
+			}
+			if (i == NUM_BENCHMARKS) {
+				break;
+			}
+			opt->names[opt->num_names++] = arg;
+		} else {
+			break;
+		}
+	}
+	if (arg || opt->seconds <= 0.0) {
+		fprintf(stderr, "Usage: %s [OPTION...] [benchmark...]\n", path);
+		fprintf(stderr, "\n");
+		fprintf(stderr, "Runs the given benchmarks, or all of them\n");
+		fprintf(stderr, "\n");
+		for (i=0; i<NUM_BENCHMARKS; i++) {
+			fprintf(stderr, "  %-32s%s\n", benchmarks[i].name, benchmarks[i].description);
+		}
+		fprintf(stderr, "\n");
+		fprintf(stderr, "  -s, --seconds=1                 Sets the minimum time of each measurement\n");
+		fprintf(stderr, "  -k, --keyfile=airport.key       Sets the RSA key of the rsa benchmark\n");
+		fprintf(stderr, "  -h, --help                      This help\n");
+		fprintf(stderr, "\n");
+		return 1;
+	}
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	raopbench_options_t options;
+	int i, j;
+
+	memset(&options, 0, sizeof(options));
+	if (parse_options(&options, argc, argv)) {
+		return 1;
+	}
+
+	for (i=0; i<NUM_BENCHMARKS; i++) {
+		int selected = !options.num_names;
+
+		for (j=0; j<options.num_names; j++) {
+			if (!strcmp(options.names[j], benchmarks[i].name)) {
+				selected = 1;
+			}
+		}
+		if (!selected) {
+			continue;
+		}
+		printf("%s: ", benchmarks[i].name);
+		if (benchmarks[i].run(&options) < 0) {
+			fprintf(stderr, "Benchmark %s failed\n", benchmarks[i].name);
+			return 1;
+		}
+	}
+	return 0;
+}
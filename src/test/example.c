@@ -91,6 +91,8 @@ main(int argc, char *argv[])
 	raop_cbs.audio_process = audio_process;
 	raop_cbs.audio_flush = audio_flush;
 	raop_cbs.audio_destroy = audio_destroy;
+	raop_cbs.audio_passthrough = NULL;
+	raop_cbs.audio_process_alac = NULL;
 
 	raop = raop_init_from_keyfile(10, &raop_cbs, "airport.key", NULL);
 	raop_set_log_level(raop, RAOP_LOG_DEBUG);